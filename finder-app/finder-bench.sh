@@ -0,0 +1,80 @@
+#!/bin/sh
+# Times the native finder against the find and grep pipelines of finder.sh on a generated tree and checks that
+# both print the same line. The index (-i) is timed building, answering a repeated query and answering a new
+# one. The tree has DIRS directories of FILES files each (100 x 1000 = 100k files by default), every file a few
+# log lines of which one in four holds the search string.
+# Usage: ./finder-bench.sh [dirs] [files per directory] [runs]
+# Run make first. The tree is kept in /tmp/finder-bench between runs and rebuilt when its size changes.
+
+set -e
+set -u
+
+DIRS=${1:-100}
+FILES=${2:-1000}
+RUNS=${3:-3}
+BENCHDIR=/tmp/finder-bench
+SEARCHSTR=AELD_IS_FUN
+cd "$(dirname "$0")"
+
+if [ ! -x ./finder ]; then
+	echo "Build the native finder with make first"
+	exit 1
+fi
+
+if [ "$(cat "$BENCHDIR.size" 2>/dev/null)" != "$DIRS $FILES" ]; then
+	echo "Writing $((DIRS * FILES)) files to $BENCHDIR"
+	rm -rf "$BENCHDIR"
+	for d in $(seq 1 "$DIRS"); do
+		mkdir -p "$BENCHDIR/dir$d"
+		for f in $(seq 1 "$FILES"); do
+			if [ $((f % 4)) -eq 0 ]; then
+				printf 'boot ok\nsensor=%d temp=21.5\nstatus %s\nshutdown\n' "$f" "$SEARCHSTR"
+			else
+				printf 'boot ok\nsensor=%d temp=21.5\nstatus idle\nshutdown\n' "$f"
+			fi > "$BENCHDIR/dir$d/log$f.txt"
+		done
+	done
+	echo "$DIRS $FILES" > "$BENCHDIR.size"
+fi
+
+# finder.sh runs the native finder when it sits next to it, so the pipelines run from a copy on its own
+SCRIPTDIR=$(mktemp -d)
+cp finder.sh "$SCRIPTDIR/"
+
+INDEX=/tmp/finder-bench.index
+
+# Function to time runs of a command, printing the best wall time and the command's output
+bench() {
+	name=$1
+	runs=$2
+	shift 2
+	best=
+	for run in $(seq 1 "$runs"); do
+		start=$(date +%s%N)
+		output=$("$@")
+		elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+		if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then best=$elapsed; fi
+	done
+	printf '%-14s %8d ms  %s\n' "$name" "$best" "$output"
+	eval "${name}_output=\"\$output\""
+}
+
+bench script "$RUNS" sh "$SCRIPTDIR/finder.sh" "$BENCHDIR" "$SEARCHSTR"
+bench native "$RUNS" ./finder "$BENCHDIR" "$SEARCHSTR"
+bench native_j1 "$RUNS" ./finder -j 1 "$BENCHDIR" "$SEARCHSTR"
+rm -f "$INDEX"
+bench index_build 1 ./finder -i "$INDEX" "$BENCHDIR" "$SEARCHSTR"
+sleep 1 # Files written within a second of their scan are read again
+bench index_repeat "$RUNS" ./finder -i "$INDEX" "$BENCHDIR" "$SEARCHSTR"
+bench index_new 1 ./finder -i "$INDEX" "$BENCHDIR" "sensor=7 "
+bench native_new 1 ./finder "$BENCHDIR" "sensor=7 "
+rm -rf "$SCRIPTDIR" "$INDEX"
+
+if [ "$script_output" = "$native_output" ] && [ "$script_output" = "$native_j1_output" ] &&
+	[ "$script_output" = "$index_build_output" ] && [ "$script_output" = "$index_repeat_output" ] &&
+	[ "$index_new_output" = "$native_new_output" ]; then
+	echo "counts match"
+else
+	echo "failed: outputs differ"
+	exit 1
+fi
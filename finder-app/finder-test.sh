@@ -52,10 +52,8 @@ fi
 #make clean
 #make
 
-for i in $( seq 1 $NUMFILES)
-do
-	./writer.sh "$WRITEDIR/${username}$i.txt" "$WRITESTR"
-done
+# One writer process creates all NUMFILES files, ${username}1.txt to ${username}${NUMFILES}.txt
+./writer -n "$NUMFILES" "$WRITEDIR" "${username}%d.txt" "$WRITESTR"
 
 OUTPUTSTRING=$(./finder.sh "$WRITEDIR" "$WRITESTR")
 
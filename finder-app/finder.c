@@ -0,0 +1,412 @@
+// finder.c
+// Native replacement for the find | wc -l and grep -r | wc -l pipelines of finder.sh: walks filesdir once and
+// prints the same line, "The number of files are N and the number of matching lines are M".
+// - Files are the regular files of the tree, symbolic links are not followed (find -type f). If filesdir itself
+//   is a symbolic link, find does not descend into it and no files are counted, while grep still searches it.
+// - Matching lines are the lines of those files that contain searchstr, read as a basic regular expression like
+//   grep does. Strings without special characters, the usual case, are searched with memmem().
+// - Like GNU grep 3.5 and later, a binary file (one holding a NUL byte) contributes no lines from the read
+//   buffer holding the first NUL on; grep only reports such matches on stderr.
+// The counts of binary files can differ from grep's. grep's buffer starts at FINDER_CHUNK bytes. It grows to
+// fit a longer line and stays that size for every later file of the run, so where a file stops depends on the
+// files grep read before it, in its walk order. finder always reads FINDER_CHUNK at a time, in no fixed order.
+// For example, after a file with a 600 KB line, grep drops all of a later file whose NUL comes after 160 KB.
+// finder still counts the lines of that file's chunks before the one holding the NUL. Text files, and binary
+// files read before grep has seen any line longer than FINDER_CHUNK, count the same.
+// The tree is walked by worker threads, each with its own deque of directories and files still to read. A worker
+// takes the newest entry of its own deque, which keeps a subtree on one thread, and idle workers steal the oldest
+// entry of another deque, so a single large directory is still spread over all threads.
+// With -i the counts and a trigram filter of every file are kept in an index file outside of filesdir, and later
+// runs only read the files whose metadata changed, see finder_index.h.
+// Usage: finder [-j threads] [-i index] filesdir searchstr
+
+#define _GNU_SOURCE // memmem(), memrchr()
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <pthread.h>
+#include <regex.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "finder_index.h"
+
+#define LOG_ERR(fmt, ...) fprintf(stderr, "[ERROR]: " fmt "\n", ##__VA_ARGS__)
+
+#define FINDER_CHUNK (96 * 1024) // Read size, GNU grep's initial buffer size, which decides where binary files stop
+#define FINDER_MAX_THREADS 64
+#define DEQUE_INITIAL 256
+
+struct item {
+    char *path;
+    bool is_dir;
+    struct file_meta meta; // Of files, with an index only
+};
+
+// Work of one thread: the owner pushes and pops at the tail, thieves take from the head
+struct deque {
+    pthread_mutex_t mutex;
+    struct item *items; // Ring of capacity entries
+    size_t head, tail; // Entries are head..tail-1, modulo capacity
+    size_t capacity;
+};
+
+struct worker {
+    pthread_t thread;
+    struct deque deque;
+    char *buffer; // Partial line carried over plus one chunk
+    size_t buffer_size;
+    unsigned long files;
+    unsigned long lines;
+    int index;
+    struct index_entry entry; // Entry of the file being read, with an index
+    struct index_out out; // Entries for the new index
+};
+
+static struct worker *workers;
+static int worker_count;
+static atomic_long pending; // Entries pushed but not yet processed; the walk is done when it drops to zero
+static bool count_files = true; // False when filesdir is a symbolic link, which find does not follow
+static const char *pattern;
+static size_t pattern_length;
+static bool use_regex; // The pattern holds characters special to a basic regular expression
+static regex_t regex;
+static bool regex_valid = true; // grep prints nothing for an invalid expression, so no line matches
+static bool use_index; // -i, see finder_index.h
+static struct finder_index file_index;
+static atomic_bool index_changed; // An entry was added, rebuilt or given a new count
+static atomic_bool index_failed; // An entry could not be stored, the index is not written
+
+static int deque_push(struct deque *deque, const struct item *item) {
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->tail - deque->head == deque->capacity) {
+        size_t capacity = deque->capacity ? deque->capacity * 2 : DEQUE_INITIAL;
+        struct item *items = malloc(capacity * sizeof(*items));
+        if (!items) {
+            pthread_mutex_unlock(&deque->mutex);
+            return -1;
+        }
+        for (size_t i = deque->head; i < deque->tail; i++) {
+            items[i - deque->head] = deque->items[i % deque->capacity];
+        }
+        free(deque->items);
+        deque->items = items;
+        deque->tail -= deque->head;
+        deque->head = 0;
+        deque->capacity = capacity;
+    }
+    deque->items[deque->tail++ % deque->capacity] = *item;
+    pthread_mutex_unlock(&deque->mutex);
+    return 0;
+}
+
+// Function to take an entry from a deque
+// Parameters:
+// - deque: Deque to take from.
+// - item: Receives the entry.
+// - steal: Take the oldest entry (another thread's deque) instead of the newest (the own deque).
+// Returns: true if an entry was taken, false if the deque is empty.
+static bool deque_pop(struct deque *deque, struct item *item, bool steal) {
+    pthread_mutex_lock(&deque->mutex);
+    bool found = deque->head != deque->tail;
+    if (found && steal) *item = deque->items[deque->head++ % deque->capacity];
+    else if (found) *item = deque->items[--deque->tail % deque->capacity];
+    pthread_mutex_unlock(&deque->mutex);
+    return found;
+}
+
+static void push(struct worker *worker, const struct item *item) {
+    atomic_fetch_add(&pending, 1); // Before the push, so the walk cannot look finished while it is queued
+    if (deque_push(&worker->deque, item) != 0) {
+        LOG_ERR("Out of memory, skipping %s", item->path);
+        free(item->path);
+        atomic_fetch_sub(&pending, 1);
+    }
+}
+
+// Count the matching lines of complete lines, the region ends with a newline unless it is the last line
+static unsigned long count_lines(const char *start, const char *end) {
+    unsigned long count = 0;
+    const char *p = start;
+    while (p < end) {
+        if (use_regex) {
+            const char *newline = memchr(p, '\n', (size_t)(end - p));
+            const char *line_end = newline ? newline : end;
+            regmatch_t match = { .rm_so = 0, .rm_eo = line_end - p };
+            if (regexec(&regex, p, 1, &match, REG_STARTEND) == 0) count++;
+            p = line_end + 1;
+            continue;
+        }
+        const char *found = memmem(p, (size_t)(end - p), pattern, pattern_length);
+        if (!found) break;
+        count++; // The line holding the match, then continue after it
+        const char *newline = memchr(found, '\n', (size_t)(end - found));
+        if (!newline) break;
+        p = newline + 1;
+    }
+    return count;
+}
+
+// Fill the buffer after carry with up to FINDER_CHUNK bytes, short only at the end of the file
+static ssize_t read_chunk(int fd, char *buffer) {
+    size_t got = 0;
+    while (got < FINDER_CHUNK) {
+        ssize_t n = read(fd, buffer + got, FINDER_CHUNK - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        got += (size_t)n;
+        if (got < FINDER_CHUNK) break; // A short read of a regular file ends it, saves a read() per small file
+    }
+    return (ssize_t)got;
+}
+
+// Function to count the matching lines of a file
+// Parameters:
+// - worker: Thread reading the file, its buffer is used.
+// - path: File to read.
+// - filter: Entry to add the file's trigrams to, NULL if none is built.
+// - lines: Receives the number of matching lines.
+// Returns: true if the file was read up to its end or up to the chunk where it turns out binary.
+static bool scan_file(struct worker *worker, const char *path, struct index_entry *filter, unsigned long *lines) {
+    *lines = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    bool complete = false;
+    size_t carry = 0; // Bytes of an unfinished line at the start of the buffer
+    for (;;) {
+        if (worker->buffer_size - carry < FINDER_CHUNK) {
+            // A line longer than the buffer, keep all of it
+            size_t size = worker->buffer_size * 2;
+            char *buffer = realloc(worker->buffer, size);
+            if (!buffer) {
+                LOG_ERR("Out of memory, skipping the rest of %s", path);
+                break;
+            }
+            worker->buffer = buffer;
+            worker->buffer_size = size;
+        }
+        ssize_t got = read_chunk(fd, worker->buffer + carry);
+        if (got < 0) {
+            fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+            break;
+        }
+        if (memchr(worker->buffer + carry, '\0', (size_t)got)) { // Binary from here on
+            complete = true;
+            break;
+        }
+        char *end = worker->buffer + carry + got;
+        if (filter) finder_index_add(filter, worker->buffer, (size_t)(end - worker->buffer));
+        if (got < FINDER_CHUNK) {
+            *lines += count_lines(worker->buffer, end); // The last line may lack its newline
+            complete = true;
+            break;
+        }
+        char *last = memrchr(worker->buffer, '\n', (size_t)(end - worker->buffer));
+        char *lines_end = last ? last + 1 : worker->buffer;
+        *lines += count_lines(worker->buffer, lines_end);
+        carry = (size_t)(end - lines_end);
+        memmove(worker->buffer, lines_end, carry);
+    }
+    close(fd);
+    return complete;
+}
+
+static void search_file(struct worker *worker, const struct item *item) {
+    if (!regex_valid) return;
+    unsigned long lines;
+    if (!use_index) {
+        scan_file(worker, item->path, NULL, &lines);
+        worker->lines += lines;
+        return;
+    }
+    struct index_entry *entry = &worker->entry;
+    uint8_t slot_bit = file_index.slot >= 0 ? (uint8_t)(1u << file_index.slot) : 0;
+    if (finder_index_get(&file_index, item->path, &item->meta, entry)) {
+        if (entry->known & slot_bit) {
+            worker->lines += entry->counts[file_index.slot]; // Unchanged and searched for before
+            if (finder_index_put(&file_index, &worker->out, item->path, entry) != 0) atomic_store(&index_failed, true);
+            return;
+        }
+        if (!finder_index_may_match(&file_index, entry)) lines = 0; // Lacks a trigram of the search string
+        else if (!scan_file(worker, item->path, NULL, &lines)) return; // Unchanged, the filter stays valid
+    } else {
+        finder_index_reset(entry, &item->meta);
+        if (!scan_file(worker, item->path, entry, &lines)) return; // Left out of the index, read on the next run
+    }
+    worker->lines += lines;
+    if (slot_bit && lines <= UINT32_MAX) {
+        entry->known |= slot_bit;
+        entry->counts[file_index.slot] = (uint32_t)lines;
+    }
+    atomic_store(&index_changed, true);
+    if (finder_index_put(&file_index, &worker->out, item->path, entry) != 0) atomic_store(&index_failed, true);
+}
+
+static void read_directory(struct worker *worker, const char *path) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        return;
+    }
+    size_t path_length = strlen(path);
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+        unsigned char type = entry->d_type;
+        struct stat st;
+        if (type == DT_UNKNOWN || (use_index && type == DT_REG)) {
+            // Not every file system fills in d_type, and the index checks the metadata of every file
+            if (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+        }
+        if (type != DT_DIR && type != DT_REG) continue; // Links, devices, FIFOs and sockets are skipped
+        size_t name_length = strlen(name);
+        char *child = malloc(path_length + name_length + 2);
+        if (!child) {
+            LOG_ERR("Out of memory, skipping %s/%s", path, name);
+            continue;
+        }
+        memcpy(child, path, path_length);
+        child[path_length] = '/';
+        memcpy(child + path_length + 1, name, name_length + 1);
+        struct item item = { .path = child, .is_dir = type == DT_DIR };
+        if (use_index && type == DT_REG) {
+            item.meta = (struct file_meta){
+                .size = (uint64_t)st.st_size,
+                .ino = (uint64_t)st.st_ino,
+                .mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec,
+                .ctime_ns = (int64_t)st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec,
+            };
+        }
+        if (type == DT_REG && count_files) worker->files++;
+        push(worker, &item);
+    }
+    closedir(dir);
+}
+
+static void *walk(void *arg) {
+    struct worker *worker = (struct worker *)arg;
+    int victim = worker->index;
+    for (;;) {
+        struct item item;
+        bool found = deque_pop(&worker->deque, &item, false);
+        for (int i = 1; !found && i < worker_count; i++) {
+            victim = (victim + 1) % worker_count;
+            if (victim != worker->index) found = deque_pop(&workers[victim].deque, &item, true);
+        }
+        if (!found) {
+            if (atomic_load(&pending) == 0) break; // Nothing queued and nothing being read that could add more
+            sched_yield();
+            continue;
+        }
+        if (item.is_dir) read_directory(worker, item.path);
+        else search_file(worker, &item);
+        free(item.path);
+        atomic_fetch_sub(&pending, 1);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, ""); // Regular expressions match characters the way grep does in this locale
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = online > 0 ? (int)online : 1;
+    const char *index_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "+j:i:")) != -1) { // Stop at filesdir, searchstr may start with '-'
+        switch (opt) {
+        case 'j': threads = atoi(optarg); break;
+        case 'i': index_path = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-j threads] [-i index] filesdir searchstr\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (threads < 1) threads = 1;
+    if (threads > FINDER_MAX_THREADS) threads = FINDER_MAX_THREADS;
+    const char *filesdir = optind < argc ? argv[optind] : "";
+    pattern = optind + 1 < argc ? argv[optind + 1] : "";
+    pattern_length = strlen(pattern);
+
+    // Same messages as finder.sh
+    struct stat st;
+    if (filesdir[0] == '\0') {
+        printf("No files directory specified, using current directory\n");
+        return EXIT_FAILURE;
+    }
+    if (stat(filesdir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        printf("Files directory %s does not exist\n", filesdir);
+        return EXIT_FAILURE;
+    }
+    if (lstat(filesdir, &st) == 0 && S_ISLNK(st.st_mode)) count_files = false;
+
+    use_regex = strpbrk(pattern, ".[]*^$\\") != NULL;
+    if (use_regex) {
+        int error = regcomp(&regex, pattern, REG_NOSUB);
+        if (error != 0) {
+            char message[256];
+            regerror(error, &regex, message, sizeof(message));
+            fprintf(stderr, "finder: %s\n", message);
+            regex_valid = false;
+        }
+    }
+    if (index_path && regex_valid) { // Nothing is read for an invalid expression
+        if (finder_index_open(&file_index, index_path, filesdir, pattern, !use_regex) != 0) return EXIT_FAILURE;
+        use_index = true;
+    }
+
+    workers = calloc((size_t)threads, sizeof(*workers));
+    if (!workers) return EXIT_FAILURE;
+    worker_count = threads;
+    for (int i = 0; i < threads; i++) {
+        workers[i].index = i;
+        workers[i].buffer_size = 2 * FINDER_CHUNK;
+        workers[i].buffer = malloc(workers[i].buffer_size);
+        pthread_mutex_init(&workers[i].deque.mutex, NULL);
+        if (!workers[i].buffer) return EXIT_FAILURE;
+    }
+    char *root = strdup(filesdir);
+    if (!root) return EXIT_FAILURE;
+    push(&workers[0], &(struct item){ .path = root, .is_dir = true });
+    int started = 0;
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&workers[i].thread, NULL, walk, &workers[i]) != 0) {
+            LOG_ERR("Failed to start worker thread, continuing with %d", started + 1);
+            break; // Threads that never started own empty deques, stealing from them finds nothing
+        }
+        started++;
+    }
+    walk(&workers[0]);
+    unsigned long files = 0, lines = 0;
+    for (int i = 1; i <= started; i++) pthread_join(workers[i].thread, NULL);
+    struct index_out *outs = use_index ? malloc((size_t)threads * sizeof(*outs)) : NULL;
+    if (outs && !atomic_load(&index_failed)) {
+        for (int i = 0; i < threads; i++) outs[i] = workers[i].out;
+        finder_index_save(&file_index, outs, threads, atomic_load(&index_changed)); // A failure only costs the next run
+    }
+    free(outs);
+    if (use_index) finder_index_close(&file_index);
+    for (int i = 0; i < threads; i++) {
+        files += workers[i].files;
+        lines += workers[i].lines;
+        free(workers[i].out.data);
+        free(workers[i].buffer);
+        free(workers[i].deque.items);
+        pthread_mutex_destroy(&workers[i].deque.mutex);
+    }
+    free(workers);
+    if (use_regex && regex_valid) regfree(&regex);
+    printf("The number of files are %lu and the number of matching lines are %lu\n", files, lines);
+    return EXIT_SUCCESS;
+}
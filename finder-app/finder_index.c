@@ -0,0 +1,318 @@
+// finder_index.c
+// On-disk index of finder -i, see finder_index.h. The file is the header, the root path and one entry per file:
+// struct entry_header, the path relative to the root and the Bloom filter.
+
+#include "finder_index.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_ERR(fmt, ...) fprintf(stderr, "[ERROR]: " fmt "\n", ##__VA_ARGS__)
+
+struct index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t root_length; // The root path follows the header
+    uint64_t records;
+    uint64_t data_bytes; // Bytes of the entries after the root path
+    uint64_t sequence;
+    struct index_query queries[FINDER_INDEX_QUERIES];
+};
+
+struct entry_header {
+    uint16_t path_length;
+    uint16_t bloom_bytes;
+    uint8_t known;
+    uint8_t reserved[3];
+    struct file_meta meta;
+    uint32_t counts[FINDER_INDEX_QUERIES];
+};
+
+static uint64_t hash_path(const char *path, size_t length) {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)path[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Both filter bits of a trigram, the filter has mask + 1 bits
+static void trigram_bits(uint32_t trigram, size_t mask, size_t *first, size_t *second) {
+    uint64_t hash = trigram * 0x9E3779B97F4A7C15ULL;
+    *first = (size_t)(hash >> 40) & mask;
+    *second = (size_t)(hash >> 13) & mask;
+}
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static bool read_all(int fd, char *data, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, data + done, size - done, (off_t)done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += (size_t)n;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+    const char *p = (const char *)data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return false;
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+// Check the loaded index and build the lookup table, false if it is not an index of this root
+static bool load(struct finder_index *index) {
+    struct index_header header;
+    if (index->size < sizeof(header) || index->size > UINT32_MAX) return false;
+    memcpy(&header, index->data, sizeof(header));
+    if (memcmp(header.magic, FINDER_INDEX_MAGIC, sizeof(header.magic)) != 0 || header.version != FINDER_INDEX_VERSION) {
+        return false;
+    }
+    size_t start = sizeof(header) + header.root_length;
+    if (header.root_length != index->root_length || start > index->size || header.data_bytes != index->size - start ||
+        memcmp(index->data + sizeof(header), index->root, index->root_length) != 0) {
+        return false;
+    }
+    if (header.records > header.data_bytes / sizeof(struct entry_header)) return false;
+    size_t table_size = 16;
+    while (table_size < header.records * 2) table_size *= 2;
+    index->table = calloc(table_size, sizeof(*index->table));
+    if (!index->table) return false;
+    index->table_mask = table_size - 1;
+    size_t offset = start;
+    for (uint64_t i = 0; i < header.records; i++) {
+        struct entry_header entry;
+        if (index->size - offset < sizeof(entry)) return false;
+        memcpy(&entry, index->data + offset, sizeof(entry));
+        if (index->size - offset - sizeof(entry) < (size_t)entry.path_length + entry.bloom_bytes) return false;
+        size_t slot = hash_path(index->data + offset + sizeof(entry), entry.path_length) & index->table_mask;
+        while (index->table[slot]) slot = (slot + 1) & index->table_mask;
+        index->table[slot] = (uint32_t)offset + 1;
+        offset += sizeof(entry) + entry.path_length + entry.bloom_bytes;
+    }
+    if (offset != index->size) return false;
+    index->records = header.records;
+    index->sequence = header.sequence;
+    memcpy(index->queries, header.queries, sizeof(index->queries));
+    return true;
+}
+
+// Pick the query slot of this run's search string: its own, a free one or the least recently used
+static void choose_slot(struct finder_index *index) {
+    index->slot = -1;
+    if (index->pattern_length > FINDER_INDEX_PATTERN_MAX) return;
+    int oldest = 0;
+    for (int i = 0; i < FINDER_INDEX_QUERIES; i++) {
+        struct index_query *query = &index->queries[i];
+        if (query->last_used && query->length == index->pattern_length &&
+            memcmp(query->pattern, index->pattern, index->pattern_length) == 0) {
+            index->slot = i;
+            break;
+        }
+        if (query->last_used < index->queries[oldest].last_used) oldest = i;
+    }
+    if (index->slot < 0) {
+        index->slot = oldest;
+        index->slot_reused = true;
+        struct index_query *query = &index->queries[oldest];
+        query->length = (uint32_t)index->pattern_length;
+        memcpy(query->pattern, index->pattern, index->pattern_length);
+        query->pattern[index->pattern_length] = '\0';
+    }
+    index->queries[index->slot].last_used = ++index->sequence;
+}
+
+int finder_index_open(struct finder_index *index, const char *path, const char *root, const char *pattern,
+                      bool literal) {
+    memset(index, 0, sizeof(*index));
+    index->fd = -1;
+    index->root = root;
+    index->root_length = strlen(root);
+    index->pattern = pattern;
+    index->pattern_length = strlen(pattern);
+    index->literal = literal;
+    index->started_ns = now_ns();
+    index->path = strdup(path);
+    if (!index->path) return -1;
+    int fd = open(path, O_RDWR);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        index->size = (size_t)st.st_size;
+        index->data = malloc(index->size);
+        if (index->data && read_all(fd, index->data, index->size) && load(index)) {
+            index->fd = fd; // Kept for rewriting the header
+        } else {
+            LOG_ERR("Ignoring index %s, it is not an index of %s, rebuilding it", path, root);
+            free(index->data);
+            free(index->table);
+            index->data = NULL;
+            index->table = NULL;
+            index->size = 0;
+            index->records = 0;
+            index->sequence = 0;
+            memset(index->queries, 0, sizeof(index->queries));
+        }
+    }
+    if (fd >= 0 && index->fd < 0) close(fd);
+    choose_slot(index);
+    return 0;
+}
+
+bool finder_index_get(const struct finder_index *index, const char *path, const struct file_meta *meta,
+                      struct index_entry *entry) {
+    if (!index->table) return false;
+    path += index->root_length + 1;
+    size_t length = strlen(path);
+    for (size_t slot = hash_path(path, length) & index->table_mask; index->table[slot];
+         slot = (slot + 1) & index->table_mask) {
+        const char *at = index->data + index->table[slot] - 1;
+        struct entry_header header;
+        memcpy(&header, at, sizeof(header));
+        if (header.path_length != length || memcmp(at + sizeof(header), path, length) != 0) continue;
+        if (memcmp(&header.meta, meta, sizeof(*meta)) != 0) return false;
+        entry->meta = header.meta;
+        entry->known = header.known;
+        if (index->slot_reused) entry->known &= (uint8_t)~(1u << index->slot);
+        memcpy(entry->counts, header.counts, sizeof(entry->counts));
+        entry->bloom_bytes = header.bloom_bytes;
+        memcpy(entry->bloom, at + sizeof(header) + length, header.bloom_bytes);
+        return true;
+    }
+    return false;
+}
+
+void finder_index_reset(struct index_entry *entry, const struct file_meta *meta) {
+    entry->meta = *meta;
+    entry->known = 0;
+    memset(entry->counts, 0, sizeof(entry->counts));
+    size_t wanted = (size_t)(meta->size / 2); // 4 bits per byte of file
+    entry->bloom_bytes = 0;
+    if (meta->size / 2 <= FINDER_INDEX_BLOOM_MAX) {
+        entry->bloom_bytes = FINDER_INDEX_BLOOM_MIN;
+        while (entry->bloom_bytes < wanted) entry->bloom_bytes *= 2;
+        memset(entry->bloom, 0, entry->bloom_bytes);
+    }
+}
+
+void finder_index_add(struct index_entry *entry, const char *data, size_t length) {
+    if (entry->bloom_bytes == 0 || length < 3) return;
+    const unsigned char *p = (const unsigned char *)data;
+    size_t mask = entry->bloom_bytes * 8 - 1;
+    uint32_t trigram = (uint32_t)p[0] << 8 | p[1];
+    for (size_t i = 2; i < length; i++) {
+        trigram = (trigram << 8 | p[i]) & 0xFFFFFF;
+        size_t first, second;
+        trigram_bits(trigram, mask, &first, &second);
+        entry->bloom[first / 8] |= (uint8_t)(1u << (first % 8));
+        entry->bloom[second / 8] |= (uint8_t)(1u << (second % 8));
+    }
+}
+
+bool finder_index_may_match(const struct finder_index *index, const struct index_entry *entry) {
+    if (!index->literal || index->pattern_length < 3 || entry->bloom_bytes == 0) return true;
+    const unsigned char *p = (const unsigned char *)index->pattern;
+    size_t mask = entry->bloom_bytes * 8 - 1;
+    for (size_t i = 2; i < index->pattern_length; i++) {
+        size_t first, second;
+        trigram_bits((uint32_t)p[i - 2] << 16 | (uint32_t)p[i - 1] << 8 | p[i], mask, &first, &second);
+        if (!(entry->bloom[first / 8] & (1u << (first % 8))) || !(entry->bloom[second / 8] & (1u << (second % 8)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int finder_index_put(const struct finder_index *index, struct index_out *out, const char *path,
+                     const struct index_entry *entry) {
+    path += index->root_length + 1;
+    size_t length = strlen(path);
+    if (length > UINT16_MAX) return 0; // Not indexed, read on every run
+    size_t size = sizeof(struct entry_header) + length + entry->bloom_bytes;
+    if (out->capacity - out->used < size) {
+        size_t capacity = out->capacity ? out->capacity * 2 : 64 * 1024;
+        while (capacity - out->used < size) capacity *= 2;
+        char *data = realloc(out->data, capacity);
+        if (!data) return -1;
+        out->data = data;
+        out->capacity = capacity;
+    }
+    struct entry_header header = {
+        .path_length = (uint16_t)length,
+        .bloom_bytes = (uint16_t)entry->bloom_bytes,
+        .known = entry->known,
+        .meta = entry->meta,
+    };
+    memcpy(header.counts, entry->counts, sizeof(header.counts));
+    if (entry->meta.mtime_ns > index->started_ns - FINDER_INDEX_RACY_NS ||
+        entry->meta.ctime_ns > index->started_ns - FINDER_INDEX_RACY_NS) {
+        header.meta.mtime_ns = INT64_MIN; // Never matches, so the next run reads the file again
+    }
+    char *at = out->data + out->used;
+    memcpy(at, &header, sizeof(header));
+    memcpy(at + sizeof(header), path, length);
+    memcpy(at + sizeof(header) + length, entry->bloom, entry->bloom_bytes);
+    out->used += size;
+    out->records++;
+    return 0;
+}
+
+int finder_index_save(struct finder_index *index, struct index_out *outs, int count, bool changed) {
+    struct index_header header = { .version = FINDER_INDEX_VERSION, .root_length = (uint32_t)index->root_length };
+    memcpy(header.magic, FINDER_INDEX_MAGIC, sizeof(header.magic));
+    for (int i = 0; i < count; i++) {
+        header.records += outs[i].records;
+        header.data_bytes += outs[i].used;
+    }
+    header.sequence = index->sequence;
+    memcpy(header.queries, index->queries, sizeof(header.queries));
+    if (!changed && index->fd >= 0 && header.records == index->records) {
+        // Same entries, only the query slots moved on
+        if (pwrite(index->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+            LOG_ERR("Failed to update index %s: %s", index->path, strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+    size_t length = strlen(index->path);
+    char *temporary = malloc(length + sizeof(".tmp"));
+    if (!temporary) return -1;
+    memcpy(temporary, index->path, length);
+    memcpy(temporary + length, ".tmp", sizeof(".tmp"));
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool written = fd >= 0 && write_all(fd, &header, sizeof(header)) && write_all(fd, index->root, index->root_length);
+    for (int i = 0; written && i < count; i++) written = write_all(fd, outs[i].data, outs[i].used);
+    if (fd >= 0 && close(fd) != 0) written = false;
+    if (!written || rename(temporary, index->path) != 0) {
+        LOG_ERR("Failed to write index %s: %s", index->path, strerror(errno));
+        unlink(temporary);
+        free(temporary);
+        return -1;
+    }
+    free(temporary);
+    return 0;
+}
+
+void finder_index_close(struct finder_index *index) {
+    if (index->fd >= 0) close(index->fd);
+    free(index->data);
+    free(index->table);
+    free(index->path);
+}
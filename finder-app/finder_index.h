@@ -0,0 +1,132 @@
+#ifndef FINDER_INDEX_H
+#define FINDER_INDEX_H
+// finder_index.h
+// On-disk index of a directory tree for finder -i, so repeated queries over a mostly unchanged tree skip the
+// content of unchanged files. For every regular file the index keeps
+// - its stat metadata (size, inode, mtime, ctime), which decides whether the rest of the entry is still valid,
+// - the number of matching lines for each of the last FINDER_INDEX_QUERIES search strings, and
+// - a Bloom filter of the file's trigrams, so a literal search string with a trigram the file lacks is known
+//   to match no line without reading the file.
+// Files whose metadata changed are read again and their entries rebuilt; the other entries are copied over.
+// A file modified within a second of its last scan is read again on the next run, since its timestamps may
+// not reflect a change made right after it was read.
+// The index is rewritten (to path.tmp, then renamed) only when an entry changed; a run that finds everything in
+// the index only updates the query slots in the header. An index of another tree, or one that does not parse,
+// is ignored and rebuilt.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FINDER_INDEX_MAGIC "AESDFIX1"
+#define FINDER_INDEX_VERSION 1
+#define FINDER_INDEX_QUERIES 8 // Search strings whose counts are kept, the least recently used one is replaced
+#define FINDER_INDEX_PATTERN_MAX 255 // Longer search strings are not cached
+#define FINDER_INDEX_BLOOM_MAX 8192 // Bytes of the largest filter, 4 bits per byte of file
+#define FINDER_INDEX_BLOOM_MIN 64
+#define FINDER_INDEX_RACY_NS 1000000000LL // Files modified this close to their scan are not trusted
+
+struct file_meta {
+    uint64_t size;
+    uint64_t ino;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+};
+
+// Entry of one file, filled from the index or while the file is read
+struct index_entry {
+    struct file_meta meta;
+    uint8_t known; // Bit per query slot whose count is valid
+    uint32_t counts[FINDER_INDEX_QUERIES];
+    size_t bloom_bytes; // 0 if the file is too large for a filter and may contain any string
+    uint8_t bloom[FINDER_INDEX_BLOOM_MAX];
+};
+
+// Entries written by one thread, concatenated into the new index
+struct index_out {
+    char *data;
+    size_t used;
+    size_t capacity;
+    size_t records;
+};
+
+struct index_query {
+    uint64_t last_used; // 0 for a free slot
+    uint32_t length;
+    char pattern[FINDER_INDEX_PATTERN_MAX + 1];
+};
+
+struct finder_index {
+    char *path;
+    int fd; // Loaded index, -1 if there was none
+    char *data; // Its contents
+    size_t size;
+    size_t records;
+    const char *root; // Entries hold paths relative to root
+    size_t root_length;
+    uint32_t *table; // Open addressing, offset + 1 of the entry in data, 0 for an empty slot
+    size_t table_mask;
+    uint64_t sequence; // Last query slot use
+    struct index_query queries[FINDER_INDEX_QUERIES];
+    int slot; // Slot of this run's search string, -1 if it is not cached
+    bool slot_reused; // The slot held another search string, its old counts are void
+    const char *pattern;
+    size_t pattern_length;
+    bool literal; // The search string is matched as is, its trigrams must all be in a matching file
+    int64_t started_ns; // Start of this run
+};
+
+// Function to open the index of a tree
+// A missing or unusable index leaves an empty one that finder_index_save() creates.
+// Parameters:
+// - index: Index to initialize.
+// - path: Index file.
+// - root: filesdir, every file path handed to the index starts with it and a '/'.
+// - pattern: Search string of this run.
+// - literal: The search string has no characters special to a regular expression.
+// Returns: 0 on success, -1 if out of memory.
+int finder_index_open(struct finder_index *index, const char *path, const char *root, const char *pattern,
+                      bool literal);
+
+// Function to look a file up
+// Parameters:
+// - index: Opened index.
+// - path: Path of the file below root.
+// - meta: Its current metadata.
+// - entry: Receives the entry if the metadata is unchanged.
+// Returns: true if the file is indexed and unchanged.
+bool finder_index_get(const struct finder_index *index, const char *path, const struct file_meta *meta,
+                      struct index_entry *entry);
+
+// Function to start a new entry for a file that is read
+// Parameters:
+// - entry: Entry to reset.
+// - meta: Metadata of the file, its size decides the filter size.
+void finder_index_reset(struct index_entry *entry, const struct file_meta *meta);
+
+// Function to add the trigrams of file content to an entry's filter
+void finder_index_add(struct index_entry *entry, const char *data, size_t length);
+
+// Function to check whether a file may hold a match of this run's search string
+// Returns: false only if the file lacks a trigram of a literal search string.
+bool finder_index_may_match(const struct finder_index *index, const struct index_entry *entry);
+
+// Function to append an entry to a thread's part of the new index
+// Returns: 0 on success, -1 if out of memory.
+int finder_index_put(const struct finder_index *index, struct index_out *out, const char *path,
+                     const struct index_entry *entry);
+
+// Function to write the new index
+// Parameters:
+// - index: Opened index.
+// - outs: Entries written by each thread.
+// - count: Number of outs.
+// - changed: An entry was added, rebuilt or given a new count; otherwise only a file that disappeared
+//   changes the entries, which the record count tells.
+// Returns: 0 on success, -1 on error.
+int finder_index_save(struct finder_index *index, struct index_out *outs, int count, bool changed);
+
+// Function to release the index
+void finder_index_close(struct finder_index *index);
+
+#endif // FINDER_INDEX_H
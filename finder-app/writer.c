@@ -1,11 +1,218 @@
+#define _GNU_SOURCE // syncfs()
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #define LOG_DEBUG(fmt, ...) fprintf(stdout, "[DEBUG]: " fmt "\n", ##__VA_ARGS__)
 #define LOG_ERR(fmt, ...) fprintf(stderr, "[ERROR]: " fmt "\n", ##__VA_ARGS__)
 
+#define WRITER_MAX_THREADS 64
+
+// Batch mode creates many files in one process instead of one process per file:
+//   writer [-j threads] [-s none|file|end] -n count dir template content
+//     writes content to dir/template for 1..count, the first %d of template replaced by the number
+//   writer [-j threads] [-s none|file|end] -b path content [path content ...]
+//     writes each content to its path
+// Files are created with openat() on a directory descriptor kept open while consecutive files share it, and
+// the work is split into contiguous ranges over the threads. -s none (the default) leaves the data to the page
+// cache like the single file mode, file fsyncs every file, and end defers to one syncfs() per directory a
+// thread leaves.
+enum sync_policy { SYNC_NONE, SYNC_FILE, SYNC_END };
+
+struct batch {
+    enum sync_policy sync;
+    const char *content;
+    // -n: dir/prefix<number>suffix
+    const char *dir;
+    const char *prefix;
+    size_t prefix_length;
+    const char *suffix;
+    // -b: path and content pairs
+    char **pairs;
+};
+
+struct range {
+    pthread_t thread;
+    const struct batch *batch;
+    long first; // Files first..last-1
+    long last;
+    long failed;
+};
+
+// Open directory of a thread, reused while the following files are in it
+struct dir_cache {
+    char *path;
+    int fd;
+};
+
+// Function to write one file below an open directory
+// Returns: 0 on success, -1 on error (logged).
+static int write_file(int dir_fd, const char *name, const char *content, enum sync_policy sync) {
+    int fd = openat(dir_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERR("Failed to open file %s: %s", name, strerror(errno));
+        return -1;
+    }
+    struct iovec iov[2] = {
+        { .iov_base = (void *)content, .iov_len = strlen(content) },
+        { .iov_base = "\n", .iov_len = 1 },
+    };
+    size_t total = iov[0].iov_len + 1;
+    ssize_t written = writev(fd, iov, 2); // A short write of a regular file only happens on a full disk
+    int status = written == (ssize_t)total ? 0 : -1;
+    if (status == 0 && sync == SYNC_FILE && fsync(fd) != 0) status = -1;
+    if (close(fd) != 0) status = -1;
+    if (status != 0) LOG_ERR("Failed to write to file %s: %s", name, written < 0 ? strerror(errno) : "short write");
+    return status;
+}
+
+static void dir_release(struct dir_cache *cache, enum sync_policy sync) {
+    if (cache->fd < 0) return;
+    if (sync == SYNC_END && syncfs(cache->fd) != 0) LOG_ERR("Failed to sync %s: %s", cache->path, strerror(errno));
+    close(cache->fd);
+    free(cache->path);
+    cache->fd = -1;
+    cache->path = NULL;
+}
+
+// Function to get an open directory, opening it unless it is the cached one
+// Parameters:
+// - cache: Directory cache of the thread.
+// - dir: Directory path, dir_length bytes long.
+// - sync: Sync policy, a directory left with SYNC_END is synced.
+// Returns: Directory descriptor, -1 on error (logged).
+static int dir_open(struct dir_cache *cache, const char *dir, size_t dir_length, enum sync_policy sync) {
+    if (cache->fd >= 0 && strlen(cache->path) == dir_length && memcmp(cache->path, dir, dir_length) == 0) {
+        return cache->fd;
+    }
+    dir_release(cache, sync);
+    cache->path = strndup(dir, dir_length);
+    if (!cache->path) return -1;
+    cache->fd = open(cache->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cache->fd < 0) {
+        LOG_ERR("Failed to open directory %s: %s", cache->path, strerror(errno));
+        free(cache->path);
+        cache->path = NULL;
+    }
+    return cache->fd;
+}
+
+static void *write_range(void *arg) {
+    struct range *range = (struct range *)arg;
+    const struct batch *batch = range->batch;
+    struct dir_cache cache = { .path = NULL, .fd = -1 };
+    char name[4096];
+    for (long i = range->first; i < range->last; i++) {
+        const char *file = name;
+        const char *content = batch->content;
+        int dir_fd;
+        if (batch->pairs) {
+            const char *path = batch->pairs[2 * i];
+            const char *slash = strrchr(path, '/');
+            content = batch->pairs[2 * i + 1];
+            file = slash ? slash + 1 : path;
+            if (!slash) dir_fd = dir_open(&cache, ".", 1, batch->sync);
+            else dir_fd = dir_open(&cache, path, slash == path ? 1 : (size_t)(slash - path), batch->sync);
+        } else {
+            int length = snprintf(name, sizeof(name), "%.*s%ld%s", (int)batch->prefix_length, batch->prefix, i + 1,
+                                  batch->suffix);
+            if (length < 0 || (size_t)length >= sizeof(name)) {
+                LOG_ERR("File name in %s too long", batch->dir);
+                range->failed++;
+                continue;
+            }
+            dir_fd = dir_open(&cache, batch->dir, strlen(batch->dir), batch->sync);
+        }
+        if (dir_fd < 0 || write_file(dir_fd, file, content, batch->sync) != 0) range->failed++;
+    }
+    dir_release(&cache, batch->sync);
+    return NULL;
+}
+
+static int batch_main(int argc, char *argv[]) {
+    struct batch batch = { .sync = SYNC_NONE };
+    long count = -1;
+    bool pairs = false;
+    int threads = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:bj:s:")) != -1) {
+        switch (opt) {
+        case 'n': count = atol(optarg); break;
+        case 'b': pairs = true; break;
+        case 'j': threads = atoi(optarg); break;
+        case 's':
+            if (strcmp(optarg, "none") == 0) batch.sync = SYNC_NONE;
+            else if (strcmp(optarg, "file") == 0) batch.sync = SYNC_FILE;
+            else if (strcmp(optarg, "end") == 0) batch.sync = SYNC_END;
+            else count = -2;
+            break;
+        default: count = -2; break;
+        }
+    }
+    int rest = argc - optind;
+    if (count == -2 || pairs == (count >= 0) || (pairs && (rest == 0 || rest % 2 != 0)) || (!pairs && rest != 3)) {
+        LOG_ERR("Invalid batch arguments");
+        fprintf(stderr, "Usage: %s [-j threads] [-s none|file|end] -n count dir template content\n", argv[0]);
+        fprintf(stderr, "       %s [-j threads] [-s none|file|end] -b path content [path content ...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (pairs) {
+        batch.pairs = argv + optind;
+        count = rest / 2;
+    } else {
+        batch.dir = argv[optind];
+        const char *template = argv[optind + 1];
+        const char *number = strstr(template, "%d");
+        if (!number) {
+            LOG_ERR("Template %s has no %%d for the file number", template);
+            return EXIT_FAILURE;
+        }
+        batch.prefix = template;
+        batch.prefix_length = (size_t)(number - template);
+        batch.suffix = number + 2;
+        batch.content = argv[optind + 2];
+    }
+    if (threads < 1) threads = 1;
+    if (threads > WRITER_MAX_THREADS) threads = WRITER_MAX_THREADS;
+    if (threads > count) threads = count > 0 ? (int)count : 1;
+    struct range ranges[WRITER_MAX_THREADS];
+    long leftover = count; // First file of the ranges whose thread did not start
+    int started = 0;
+    for (int t = 0; t < threads; t++) {
+        ranges[t] = (struct range){ .batch = &batch, .first = count * t / threads, .last = count * (t + 1) / threads };
+        if (t == 0) continue; // Written by this thread below
+        if (pthread_create(&ranges[t].thread, NULL, write_range, &ranges[t]) != 0) {
+            LOG_ERR("Failed to start writer thread, writing its files here");
+            leftover = ranges[t].first;
+            break;
+        }
+        started++;
+    }
+    write_range(&ranges[0]);
+    long failed = ranges[0].failed;
+    if (leftover < count) {
+        struct range rest = { .batch = &batch, .first = leftover, .last = count };
+        write_range(&rest);
+        failed += rest.failed;
+    }
+    for (int t = 1; t <= started; t++) {
+        pthread_join(ranges[t].thread, NULL);
+        failed += ranges[t].failed;
+    }
+    LOG_DEBUG("Wrote %ld of %ld files", count - failed, count);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[]) {
+    if (argc > 1 && argv[1][0] == '-') {
+        return batch_main(argc, argv);
+    }
     if (argc < 2) {
         LOG_ERR("No filename provided");
         fprintf(stderr, "Usage: %s <filename>\n", argv[1]);
@@ -32,4 +239,4 @@ int main(int argc, char *argv[]) {
     fclose(file);
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -1,19 +1,19 @@
 #!/bin/sh
-# Start and stop the AESD socket service
-# Usage: ./aesdsocket-start-stop.sh start|stop
+# Start, stop and restart the AESD socket service
+# Usage: ./aesdsocket-start-stop.sh start|stop|restart
 # Set the action to start by default
 if [ "$#" -eq 0 ]; then
     ACTION="start"
 elif [ "$#" -eq 1 ]; then
     ACTION=$1
 else
-    echo "Usage: $0 start|stop"
+    echo "Usage: $0 start|stop|restart"
     exit 1
 fi
 
 # Check if the action is valid
-if [ "$ACTION" != "start" ] && [ "$ACTION" != "stop" ]; then
-    echo "Invalid action: $ACTION. Use 'start' or 'stop'."
+if [ "$ACTION" != "start" ] && [ "$ACTION" != "stop" ] && [ "$ACTION" != "restart" ]; then
+    echo "Invalid action: $ACTION. Use 'start', 'stop' or 'restart'."
     exit 1
 fi
 
@@ -25,7 +25,7 @@ if [ "$ACTION" == "start" ]; then
     fi
     # Start the AESD socket service
     echo "Starting AESD socket service..."
-    /usr/bin/aesdsocket -d &
+    /usr/bin/aesdsocket -d # Returns once the daemon accepts connections, or fails if it exits before
     if [ $? -eq 0 ]; then
         echo "AESD socket service started successfully."
     else
@@ -46,6 +46,20 @@ elif [ "$ACTION" == "stop" ]; then
         echo "Failed to stop AESD socket service."
         exit 1
     fi
+elif [ "$ACTION" == "restart" ]; then
+    # The new instance takes over the listening sockets and accepts at once, so clients are never
+    # refused; the old one drains its connections for up to 5 s and exits. Without a running
+    # instance this is a start.
+    echo "Restarting AESD socket service..."
+    # $? covers the setup up to accepting connections. The log is opened later, once the old instance has
+    # released it; if that fails the new instance logs it and exits.
+    /usr/bin/aesdsocket -d -R
+    if [ $? -eq 0 ]; then
+        echo "AESD socket service restarted successfully."
+    else
+        echo "Failed to restart AESD socket service."
+        exit 1
+    fi
 fi
 # Exit successfully
 exit 0
\ No newline at end of file
@@ -11,17 +11,56 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include "socket.h"
+#include "record_log.h"
+#include "shm_ring.h"
+#include "trace.h"
+#include "timer_wheel.h"
+#include "ratelimit.h"
+#include "handoff.h"
+#include "metrics.h"
+#include "replication.h"
+#include "segment.h"
+#include "memacct.h"
+#include "capture.h"
+#include "config.h"
 
-extern struct thread_list_head thread_list;
-extern pthread_mutex_t file_mutex;
+extern struct prof_mutex file_mutex;
 extern sig_atomic_t exit_requested;
+extern struct record_log record_log;
 
 extern int global_server_socket_fd;
 
+static const char *local_namespace; // Namespace of local producers (-n), NULL for the default one
+
+// Open the namespace of local producers, if there is one
+static int open_local_namespace(void) {
+    if (local_namespace && !(local_shard = namespace_open(local_namespace, strlen(local_namespace)))) return -1;
+    return 0;
+}
+
+// Open the logs once the previous instance has released them (see handoff_take_log())
+static int take_log(void) {
+    LOG_SYS("The previous instance released the log");
+    if (persistent_log && record_log_open(&record_log, persist_path, 0) != 0) return -1;
+    return open_local_namespace();
+}
+
+// The parent waits for the daemon to accept connections, or to exit without doing so, and exits with the
+// outcome: a start script's $? covers the whole setup (see daemon_ready_fd)
 void daemonize() {
+    int ready[2];
+    if (pipe(ready) < 0) exit(EXIT_FAILURE);
     pid_t pid = fork();
     if (pid < 0) exit(EXIT_FAILURE);
-    if (pid > 0) exit(EXIT_SUCCESS);
+    if (pid > 0) {
+        close(ready[1]);
+        char byte;
+        ssize_t got;
+        while ((got = read(ready[0], &byte, 1)) < 0 && errno == EINTR);
+        exit(got == 1 ? EXIT_SUCCESS : EXIT_FAILURE); // EOF: the daemon exited before accepting
+    }
+    close(ready[0]);
+    daemon_ready_fd = ready[1];
 
     if (setsid() < 0) exit(EXIT_FAILURE);
 
@@ -52,6 +91,16 @@ void handle_signal_main(int signo) {
     //unlink(AESD_SOCKET_FILE); // Remove the socket file if it exists
 }
 
+void handle_lock_report(int signo) {
+    (void)signo;
+    lock_report_requested = 1; // Printed by client_handler(), outside of the signal handler
+}
+
+void handle_reload(int signo) {
+    (void)signo;
+    reload_requested = 1; // Applied by client_handler(), outside of the signal handler
+}
+
 void setup_signal_handlers_main() {
     struct sigaction sa;
     sa.sa_handler = handle_signal_main;
@@ -61,20 +110,118 @@ void setup_signal_handlers_main() {
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
 
+    sa.sa_handler = handle_lock_report;
+    sigaction(SIGUSR2, &sa, NULL);
+
+    sa.sa_handler = handle_reload;
+    sa.sa_flags = SA_RESTART; // Connections keep running through a reload
+    sigaction(SIGHUP, &sa, NULL);
+
     signal(SIGPIPE, SIG_IGN);
 }
 
 int main(int argc, char *argv[]) {
+    startup_ns = metrics_now(); // Reference point of the startup gauges
     setup_signal_handlers_main();
 
-    bool run_as_daemon = false;
     int opt;
-    while ((opt = getopt(argc, argv, "d")) != -1) {
-        if (opt == 'd') run_as_daemon = true;
+    const char *config_path = NULL;
+    while ((opt = getopt(argc, argv, CONFIG_OPTIONS "F:")) != -1) {
+        if (opt == 'F') config_path = optarg; // Settings not given on the command line come from this file
+        else if (config_option(opt, optarg) != 0) { // Unknown option or invalid value, logged
+            config_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (config_path && config_load(config_path) != 0) return EXIT_FAILURE;
+    const char *unix_path = server_options.unix_path;
+    const char *stats_path = server_options.stats_path;
+    local_namespace = server_options.local_namespace;
+    const char *replication_path = server_options.replication_path;
+    const char *primary_path = server_options.primary_path;
+    // A follower's data file holds its replica, followers sharing a host need a -D each
+    const char *data_file = server_options.data_file ? server_options.data_file
+                            : primary_path ? AESD_REPLICA_FILE : AESD_SOCKET_FILE;
+    if (namespace_set_data_file(data_file) != 0) return EXIT_FAILURE;
+    if (primary_path) {
+        // A follower keeps a plain copy of the primary's default namespace and stores nothing of its own
+        read_only = true;
+        if (persistent_log) LOG_SYS("A follower keeps its replica in %s, ignoring -p", data_file);
+        persistent_log = false;
+        namespace_limit = 0;
+        local_namespace = NULL;
+        replication_path = NULL;
+        segment_size = 0;
+    }
+    if (record_log_dedup && !persistent_log) {
+        // Back-references need the framing of the record log
+        LOG_ERR("Deduplication needs the record log (-p), ignoring -e");
+        record_log_dedup = false;
+    }
+    if (replication_path && segment_size) {
+        // Followers stream the default namespace's log by offset, which sealing would move
+        LOG_ERR("Log segments are not supported with a replication stream, ignoring -z");
+        segment_size = 0;
+    }
+    int inherited[HANDOFF_LISTENERS];
+    // Listeners opened by a service manager: clients may already be queued in their backlogs
+    bool activated = handoff_activation(inherited, stats_path) > 0;
+    bool hot_restart = !activated && !read_only; // Followers leave the handoff socket to the primary
+    int control = -1;
+    if (server_options.take_over && hot_restart) {
+        control = handoff_request(AESD_HANDOFF_SOCKET, inherited);
+        if (control < 0) LOG_SYS("No running instance to take over from, starting normally");
+    }
+    if (control >= 0) {
+        // The previous instance still appends to the log; it is opened once that instance has exited
+    } else if (persistent_log) {
+        // Keep the records of previous runs; recover before daemonizing so failures are reported
+        if (record_log_open(&record_log, persist_path, 0) != 0) return EXIT_FAILURE;
+    } else {
+        unlink(default_shard.path); // Remove the socket file if it exists
+        segment_remove(default_shard.path);
+        if (!read_only) namespace_purge(); // And the logs of named namespaces
+    }
+    if (server_options.run_as_daemon && !activated) {
+        daemonize(); // A socket activated service is supervised and stays in the foreground
+    }
+    if (log_start(server_options.log_sink) != 0) { // After daemonize(), the logger thread would not survive the fork
+        LOG_ERR("Failed to start the logger, logging synchronously");
     }
-    unlink(AESD_SOCKET_FILE); // Remove the socket file if it exists
-    if (run_as_daemon) {
-        daemonize();
+    atexit(log_stop); // Emit queued messages on every return from main
+    if (control >= 0) {
+        // Accept right away: connections and writers wait in handoff_log_wait() until take_log() has run
+        LOG_SYS("Took over the listening sockets of the previous instance");
+        if (handoff_take_log(control, take_log) != 0) {
+            LOG_ERR("Failed to start the takeover thread, waiting for the previous instance to exit");
+            handoff_wait(control);
+            if (take_log() != 0) return EXIT_FAILURE;
+        }
+    } else if (open_local_namespace() != 0) {
+        return EXIT_FAILURE;
+    }
+    global_unix_socket_fd = inherited[HANDOFF_UNIX];
+    global_stats_socket_fd = inherited[HANDOFF_STATS];
+    if (unix_path && global_unix_socket_fd < 0 && setup_unix_socket(unix_path) < 0) {
+        return EXIT_FAILURE;
+    }
+    if (stats_path && global_stats_socket_fd < 0 && setup_stats_socket(stats_path) < 0) {
+        return EXIT_FAILURE;
+    }
+    if (hot_restart) {
+        // The service manager keeps activated listeners open across restarts itself
+        global_handoff_socket_fd = handoff_listen(AESD_HANDOFF_SOCKET); // Hot restarts are optional
+    }
+    if (replication_path && (global_replication_socket_fd = replication_listen(replication_path)) < 0) {
+        return EXIT_FAILURE;
+    }
+    if (primary_path && replication_follow_start(primary_path) != 0) {
+        LOG_ERR("Failed to start following %s", primary_path);
+        return EXIT_FAILURE;
+    }
+
+    if (server_options.capture_path && capture_open(server_options.capture_path) != 0) {
+        return EXIT_FAILURE;
     }
 
     struct connection_info *conn_info = malloc(sizeof(struct connection_info));
@@ -83,16 +230,45 @@ int main(int argc, char *argv[]) {
     memset(&conn_info->_addr, 0, sizeof(conn_info->_addr));
     conn_info->_addr.sin_family = AF_INET;
     conn_info->_addr.sin_addr.s_addr = INADDR_ANY;
-    conn_info->_addr.sin_port = htons(MY_PORT);
+    conn_info->_addr.sin_port = htons(server_options.port);
     snprintf(conn_info->_ip, INET_ADDRSTRLEN, "0.0.0.0");
-    conn_info->_sockfd = -1;
+    conn_info->_sockfd = inherited[HANDOFF_TCP]; // client_handler() sets up a new listener if none was inherited
     LOG_SYS("Connection info initialized");
     
-    global_server_socket_fd = conn_info->_sockfd;
+    // An activated listener belongs to the service manager: a signal must not shut it down, only our copy is closed
+    global_server_socket_fd = activated ? -1 : conn_info->_sockfd;
+
+    if ((idle_timeout_ms || request_timeout_ms || config_path) && timer_wheel_start() != 0) { // A reload may set them
+        LOG_ERR("Failed to start the timer thread, connection deadlines are disabled");
+    }
+    if (segment_start() != 0) {
+        LOG_ERR("Failed to start the segment compression thread, segments stay uncompressed");
+    }
+    if (trace_start() != 0) { // No-op unless built with TRACE=1
+        LOG_ERR("Failed to start trace dump thread");
+    }
 
     pthread_t timestamp_thread;
     pthread_create(&timestamp_thread, NULL, timestamp, NULL);
     LOG_SYS("Timestamp thread started");
+
+    struct shm_ring ring;
+    pthread_t ingest_thread;
+    bool ingest_started = false;
+    if (server_options.ring_name) {
+        // After a takeover the ring of the previous instance is adopted: producers stay attached to it and
+        // the records it did not ingest are still in it
+        bool adopted = control >= 0 && shm_ring_attach(&ring, server_options.ring_name) == 0;
+        if (!adopted && shm_ring_create(&ring, server_options.ring_name, SHM_RING_DEFAULT_SIZE) != 0) {
+            LOG_ERR("Failed to create shared memory ring %s: %s", server_options.ring_name, strerror(errno));
+        } else if (pthread_create(&ingest_thread, NULL, shm_ingest, &ring) != 0) {
+            LOG_ERR("Failed to start shared memory ingest thread");
+            shm_ring_destroy(&ring);
+        } else {
+            ingest_started = true;
+            LOG_SYS("Shared memory ingest ring %s %s", server_options.ring_name, adopted ? "adopted" : "ready");
+        }
+    }
     client_handler(conn_info);
     pthread_cancel(timestamp_thread);
     if (conn_info->_sockfd >= 0) {
@@ -101,18 +277,52 @@ int main(int argc, char *argv[]) {
 
     pthread_join(timestamp_thread, NULL);
 
-    thread_node_t *node;
-    while (!SLIST_EMPTY(&thread_list)) {
-        node = SLIST_FIRST(&thread_list);
-        pthread_join(node->data_node, NULL);
-        SLIST_REMOVE_HEAD(&thread_list, entries);
-        free(node);
+    // After a handoff the new instance waits for the log: the connections get HANDOFF_DRAIN_MS to complete.
+    // Otherwise exit_requested already ends them.
+    drain_connections(handed_off ? HANDOFF_DRAIN_MS : 0);
+    exit_requested = 1;
+    bool log_taken = handoff_log_taken(); // Waits for a takeover still in progress
+    capture_close(); // Every connection has ended
+    if (ingest_started) {
+        pthread_join(ingest_thread, NULL);
+        if (handed_off || !log_taken) shm_ring_detach(&ring); // Left to the next instance with any records in it
+        else shm_ring_destroy(&ring);
     }
 
+    replication_follow_stop();
+    segment_stop();
+    trace_stop();
+    timer_wheel_stop();
     free_connection_info(conn_info);
-    pthread_mutex_destroy(&file_mutex);
+    log_lock_report(); // Lock contention over the whole run
+    pthread_mutex_destroy(&file_mutex.mutex);
+    if (!log_taken) {
+        return EXIT_FAILURE; // The log was released but could not be opened, nothing here is ours to remove
+    }
 
-    unlink(AESD_SOCKET_FILE);
+    if (persistent_log) {
+        record_log_close(&record_log);
+    }
+    namespace_close(!handed_off);
+    if (handed_off) {
+        return EXIT_SUCCESS; // The paths and the data file belong to the new instance now
+    }
+    if (replication_path) {
+        unlink(replication_path);
+    }
+    if (!activated) { // Otherwise the paths belong to the service manager
+        if (hot_restart) unlink(AESD_HANDOFF_SOCKET);
+        if (unix_path) {
+            unlink(unix_path);
+        }
+        if (stats_path) {
+            unlink(stats_path);
+        }
+    }
+    if (!persistent_log) {
+        unlink(default_shard.path);
+        segment_remove(default_shard.path);
+    }
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,123 @@
+#ifndef BENCH_H
+#define BENCH_H
+// bench.h
+// Helpers shared by the benchmarks under bench/ and by the load tools (loadgen, capreplay). They are static
+// inline, so every program keeps linking only the objects it drives.
+// Benches that take -c drop the file under test from the page cache before every replay or open with
+// drop_cache(), so it is read from the device; without -c it is served from memory and only the code that
+// processes it is measured.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+// Socket pair that replays are sent into, read by a drainer thread
+struct sink {
+    int fds[2]; // Replays are sent to fds[0], -1 if the sink is not open
+    pthread_t drainer; // Reads everything from fds[1]
+    uint32_t (*checksum)(uint32_t sum, const void *data, size_t length); // NULL discards the bytes unchecked
+    uint32_t sum; // checksum of the bytes drained since the last sink_drained()
+    uint64_t bytes; // Bytes drained since the last sink_drained()
+    pthread_mutex_t mutex; // Protects sum and bytes
+};
+
+// Function to read the monotonic clock in seconds
+static inline double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to drop a file from the page cache (-c)
+static inline void drop_cache(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+// qsort() comparison of latency samples
+static inline int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to read a percentile of sorted samples
+// Parameters:
+// - sorted: Samples in ascending order.
+// - count: Number of samples.
+// - p: Percentile as a fraction, 0.99 for p99.
+// Returns: The nearest sample, 0 if there are none.
+static inline double percentile(const double *sorted, long count, double p) {
+    if (count == 0) return 0;
+    long index = (long)(p * (count - 1) + 0.5);
+    return sorted[index];
+}
+
+static inline void *sink_drain(void *arg) {
+    struct sink *sink = (struct sink *)arg;
+    char buffer[64 * 1024];
+    ssize_t got;
+    while ((got = read(sink->fds[1], buffer, sizeof(buffer))) > 0) {
+        if (!sink->checksum) continue;
+        pthread_mutex_lock(&sink->mutex);
+        sink->sum = sink->checksum(sink->sum, buffer, (size_t)got);
+        sink->bytes += (uint64_t)got;
+        pthread_mutex_unlock(&sink->mutex);
+    }
+    return NULL;
+}
+
+// Function to open a sink and start its drainer
+// Parameters:
+// - sink: Sink to open.
+// - checksum: Folded over the drained bytes for sink_drained(), NULL to discard them.
+// Returns: 0 on success, -1 on failure, with the sink left closed.
+static inline int sink_open(struct sink *sink, uint32_t (*checksum)(uint32_t, const void *, size_t)) {
+    sink->checksum = checksum;
+    sink->sum = 0;
+    sink->bytes = 0;
+    pthread_mutex_init(&sink->mutex, NULL);
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sink->fds) != 0) {
+        sink->fds[0] = sink->fds[1] = -1;
+        return -1;
+    }
+    if (pthread_create(&sink->drainer, NULL, sink_drain, sink) != 0) {
+        close(sink->fds[0]);
+        close(sink->fds[1]);
+        sink->fds[0] = sink->fds[1] = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// Function to wait until the drainer has read bytes, then return their checksum and start over
+static inline uint32_t sink_drained(struct sink *sink, uint64_t bytes) {
+    for (;;) {
+        pthread_mutex_lock(&sink->mutex);
+        bool done = sink->bytes >= bytes;
+        uint32_t sum = sink->sum;
+        if (done) sink->sum = 0, sink->bytes = 0;
+        pthread_mutex_unlock(&sink->mutex);
+        if (done) return sum;
+        usleep(100);
+    }
+}
+
+// Function to stop the drainer and close a sink; a sink that is not open is left alone
+static inline void sink_close(struct sink *sink) {
+    if (sink->fds[0] < 0) return;
+    shutdown(sink->fds[0], SHUT_WR);
+    pthread_join(sink->drainer, NULL);
+    close(sink->fds[0]);
+    close(sink->fds[1]);
+    sink->fds[0] = sink->fds[1] = -1;
+    pthread_mutex_destroy(&sink->mutex);
+}
+
+#endif // BENCH_H
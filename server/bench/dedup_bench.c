@@ -0,0 +1,135 @@
+// dedup_bench.c
+// Bytes on disk and replay throughput of the record log with and without deduplication (-e), for streams with
+// different shares of repeated records. Every stream is a sequence of sensor lines where the given percentage
+// of records repeats one of the last few distinct lines byte for byte, the way polling sensors report an
+// unchanged reading. Each stream is appended in batches with record_log_append_batch() and replayed into a
+// socket pair with record_log_replay(), as the server does; the drained replay is checked against the
+// stream with a CRC32C, so a replay that does not expand to the original bytes is reported.
+// - -c replays a cold log (see bench.h), which is where the smaller log pays off.
+// Usage: dedup_bench [-d dir] [-n records] [-r percent,percent] [-R replays] [-c]
+// Example: dedup_bench -d /var/tmp -n 1000000 -r 0,50,90 -c
+
+#include "../socket.h"
+#include "../record_log.h"
+#include "bench.h"
+
+#define MAX_RATES 16
+#define RECENT_LINES 16 // Repeats are drawn from this many most recent distinct lines
+#define BATCH 256
+
+// Generate the stream: records point into text, which holds every line back to back
+static size_t generate(char **text, struct iovec **records, long count, int repeat_percent) {
+    size_t capacity = (size_t)count * 96; // Longer than any line
+    *text = (char *)malloc(capacity);
+    *records = (struct iovec *)malloc((size_t)count * sizeof(**records));
+    if (!*text || !*records) return 0;
+    size_t used = 0, total = 0;
+    size_t recent[RECENT_LINES][2] = { { 0 } }; // Offset and length of the last distinct lines
+    long distinct = 0;
+    unsigned seed = 42;
+    for (long i = 0; i < count; i++) {
+        seed = seed * 1103515245u + 12345u;
+        size_t at, length;
+        if (distinct > 0 && (long)((seed >> 8) % 100) < repeat_percent) {
+            size_t *line = recent[(seed >> 4) % (distinct < RECENT_LINES ? distinct : RECENT_LINES)];
+            at = line[0];
+            length = line[1];
+        } else {
+            seed = seed * 1103515245u + 12345u;
+            int n = snprintf(*text + used, capacity - used, "sensor=%u temp=%u.%u humidity=%u%% status=ok seq=%ld\n",
+                             seed >> 28, 20 + (seed >> 24) % 8, (seed >> 16) % 10, 40 + (seed >> 8) % 20, i);
+            at = used;
+            length = (size_t)n;
+            used += length;
+            recent[distinct % RECENT_LINES][0] = at;
+            recent[distinct % RECENT_LINES][1] = length;
+            distinct++;
+        }
+        (*records)[i] = (struct iovec){ .iov_base = *text + at, .iov_len = length };
+        total += length;
+    }
+    return total;
+}
+
+static int run(const char *path, const struct iovec *records, long count, size_t raw_bytes, uint32_t raw_crc,
+               int percent, bool dedup, int replays, bool cold, struct sink *sink) {
+    unlink(path);
+    record_log_dedup = dedup;
+    struct record_log log;
+    if (record_log_open(&log, path, 1) != 0) return -1;
+    double begin = now_sec();
+    for (long done = 0; done < count; done += BATCH) {
+        record_log_append_batch(&log, records + done, (size_t)(count - done < BATCH ? count - done : BATCH));
+    }
+    double write_sec = now_sec() - begin;
+    double elapsed = 0;
+    bool exact = true;
+    for (int i = 0; i < replays; i++) {
+        if (cold) drop_cache(path);
+        begin = now_sec();
+        ssize_t sent = record_log_replay(&log, sink->fds[0]);
+        elapsed += now_sec() - begin;
+        if (sent != (ssize_t)raw_bytes || sink_drained(sink, raw_bytes) != raw_crc) exact = false;
+    }
+    printf("%7d %-6s %14lld %7.2f %12.1f %12.1f %s\n", percent, dedup ? "on" : "off", (long long)log.end,
+           (double)raw_bytes / log.end, raw_bytes / write_sec / 1e6, raw_bytes * (double)replays / elapsed / 1e6,
+           exact ? "yes" : "NO");
+    fflush(stdout);
+    record_log_close(&log);
+    unlink(path);
+    return exact ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *dir = "/var/tmp";
+    long count = 500000;
+    int replays = 5;
+    bool cold = false;
+    char rates_arg[] = "0,50,90";
+    char *rates_list = rates_arg;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:n:r:R:c")) != -1) {
+        switch (opt) {
+        case 'd': dir = optarg; break;
+        case 'n': count = atol(optarg); break;
+        case 'r': rates_list = optarg; break;
+        case 'R': replays = atoi(optarg); break;
+        case 'c': cold = true; break;
+        default:
+            fprintf(stderr, "Usage: %s [-d dir] [-n records] [-r percent,percent] [-R replays] [-c]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (replays < 1) replays = 1;
+    if (count < 1) count = 1;
+    int rates[MAX_RATES], nrates = 0;
+    for (char *save = NULL, *item = strtok_r(rates_list, ",", &save); item && nrates < MAX_RATES; item = strtok_r(NULL, ",", &save)) {
+        rates[nrates++] = atoi(item);
+    }
+    char path[256];
+    snprintf(path, sizeof(path), "%s/dedup_bench.rec", dir);
+    log_set_level("error"); // Recovery messages of every open would clutter the table
+    struct sink sink;
+    if (sink_open(&sink, crc32c) != 0) return EXIT_FAILURE; // Replays are checked against the stream
+    fsync_policy = FSYNC_NEVER; // Compare the bytes written, not the device's sync latency
+    int status = EXIT_SUCCESS;
+    printf("%7s %-6s %14s %7s %12s %12s %s\n", "repeat%", "dedup", "bytes_on_disk", "ratio", "write_MB/s",
+           "replay_MB/s", "exact");
+    for (int r = 0; r < nrates; r++) {
+        char *text;
+        struct iovec *records;
+        size_t raw_bytes = generate(&text, &records, count, rates[r]);
+        if (raw_bytes == 0) return EXIT_FAILURE;
+        uint32_t raw_crc = 0;
+        for (long i = 0; i < count; i++) raw_crc = crc32c(raw_crc, records[i].iov_base, records[i].iov_len);
+        for (int dedup = 0; dedup <= 1; dedup++) {
+            if (run(path, records, count, raw_bytes, raw_crc, rates[r], dedup, replays, cold, &sink) != 0) {
+                status = EXIT_FAILURE;
+            }
+        }
+        free(records);
+        free(text);
+    }
+    sink_close(&sink);
+    return status;
+}
@@ -0,0 +1,119 @@
+// namespace_bench.c
+// Aggregate append throughput as the number of active namespaces grows. A fixed set of threads appends
+// records the way the server does (lock_shard(), store_record(), unlock_shard()); thread i writes to
+// namespace i % namespaces, so with one namespace every thread contends for the same mutex and fsync, and
+// with as many namespaces as threads none do. Every case is run for the text and the record log, and for
+// each fsync policy.
+// Usage: namespace_bench [-N namespaces] [-t threads] [-s size] [-f always,never] [-n ops]
+// The logs are created next to AESD_SOCKET_FILE (AESD_NAMESPACE_FILE) and removed afterwards.
+
+#include "../socket.h"
+#include "bench.h"
+
+#define MAX_LIST 16
+#define MAX_THREADS 64
+
+struct runner {
+    struct log_shard *shard;
+    const char *record;
+    size_t size;
+    long ops;
+};
+
+static void *run_ops(void *arg) {
+    struct runner *r = (struct runner *)arg;
+    for (long i = 0; i < r->ops; i++) {
+        lock_shard(r->shard); // Same serialization and instrumentation as the server
+        store_record(r->shard, r->record, r->size);
+        unlock_shard(r->shard);
+    }
+    return NULL;
+}
+
+static int parse_list(char *arg, char **items) {
+    int n = 0;
+    for (char *save = NULL, *item = strtok_r(arg, ",", &save); item && n < MAX_LIST; item = strtok_r(NULL, ",", &save)) {
+        items[n++] = item;
+    }
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    char namespaces_arg[] = "1,2,4,8", policies_arg[] = "always,never";
+    char *namespaces[MAX_LIST], *policies[MAX_LIST];
+    int nnamespaces = parse_list(namespaces_arg, namespaces), npolicies = parse_list(policies_arg, policies);
+    int nthread = 8;
+    size_t size = 256;
+    long ops = 4000;
+    int opt;
+    while ((opt = getopt(argc, argv, "N:t:s:f:n:")) != -1) {
+        switch (opt) {
+        case 'N': nnamespaces = parse_list(optarg, namespaces); break;
+        case 't': nthread = atoi(optarg); break;
+        case 's': size = strtoull(optarg, NULL, 0); break;
+        case 'f': npolicies = parse_list(optarg, policies); break;
+        case 'n': ops = atol(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-N namespaces] [-t threads] [-s size] [-f always,never] [-n ops]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    log_set_level("error"); // Keep namespace creation messages out of the table
+    if (nthread < 1) nthread = 1;
+    if (nthread > MAX_THREADS) nthread = MAX_THREADS;
+    if (size < 1) size = 1;
+    if (ops < nthread) ops = nthread;
+    char *record = malloc(size);
+    if (!record) return EXIT_FAILURE;
+    memset(record, 'r', size);
+    record[size - 1] = '\n';
+
+    printf("%-6s %10s %7s %-6s %12s %12s\n", "log", "namespaces", "threads", "fsync", "records/s", "ns/op");
+    for (int mode = 0; mode < 2; mode++) {
+        persistent_log = mode == 1;
+        const char *log_name = persistent_log ? "record" : "text";
+        for (int p = 0; p < npolicies; p++) {
+            fsync_policy = strcmp(policies[p], "never") == 0 ? FSYNC_NEVER : FSYNC_ALWAYS;
+            for (int k = 0; k < nnamespaces; k++) {
+                int count = atoi(namespaces[k]);
+                if (count < 1) continue;
+                if (count > nthread) count = nthread;
+                struct log_shard *shards[MAX_THREADS];
+                bool ready = true;
+                for (int i = 0; i < count && ready; i++) {
+                    char name[NAMESPACE_NAME_MAX + 1], path[PATH_MAX];
+                    snprintf(name, sizeof(name), "bench-%s-%s-%d-%d", log_name, policies[p], count, i);
+                    snprintf(path, sizeof(path), persistent_log ? AESD_NAMESPACE_PERSIST_FILE : AESD_NAMESPACE_FILE,
+                             "/var/tmp/aesdsocketdata", name); // Stem of AESD_SOCKET_FILE
+                    unlink(path);
+                    shards[i] = namespace_open(name, strlen(name));
+                    ready = shards[i] != NULL;
+                }
+                if (!ready) {
+                    fprintf(stderr, "Failed to create %d namespaces\n", count);
+                    continue;
+                }
+                pthread_t tids[MAX_THREADS];
+                struct runner runners[MAX_THREADS];
+                double begin = now_sec();
+                for (int i = 0; i < nthread; i++) {
+                    runners[i] = (struct runner){ shards[i % count], record, size, ops / nthread };
+                    pthread_create(&tids[i], NULL, run_ops, &runners[i]);
+                }
+                for (int i = 0; i < nthread; i++) pthread_join(tids[i], NULL);
+                double elapsed = now_sec() - begin;
+                long total = ops / nthread * nthread;
+                printf("%-6s %10d %7d %-6s %12.0f %12.0f\n", log_name, count, nthread, policies[p], total / elapsed,
+                       elapsed * 1e9 / total);
+                fflush(stdout);
+                for (int i = 0; i < count && persistent_log; i++) unlink(shards[i]->path);
+            }
+        }
+    }
+    persistent_log = true;
+    namespace_close(false); // Close the record logs
+    persistent_log = false;
+    namespace_close(true); // Remove the text logs
+    free(record);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,112 @@
+// recovery_bench.c
+// Startup recovery time of the record log (-p) for different numbers of recovery threads. A log of the given
+// size is built once from sensor lines with record_log_append_batch(), then opened repeatedly with
+// record_log_open() at every thread count; each open validates every record against its CRC and rebuilds the
+// offset index, as the server does at startup. The record count of every open is checked against the log.
+// - -c recovers a cold log (see bench.h); without it the CRC scan itself is measured.
+// Usage: recovery_bench [-d dir] [-s megabytes] [-t threads,threads] [-R runs] [-c]
+// Example: recovery_bench -d /var/tmp -s 1024 -t 1,2,4,8 -c
+
+#include "../socket.h"
+#include "../record_log.h"
+#include "bench.h"
+
+#define MAX_THREAD_COUNTS 16
+#define BATCH 256
+
+// Build a log of at least target bytes; returns the number of records, 0 on failure
+static size_t build(const char *path, uint64_t target) {
+    unlink(path);
+    struct record_log log;
+    if (record_log_open(&log, path, 1) != 0) return 0;
+    char lines[BATCH][96];
+    struct iovec records[BATCH];
+    unsigned seed = 42;
+    uint64_t sequence = 0;
+    while ((uint64_t)log.end < target) {
+        for (int i = 0; i < BATCH; i++) {
+            seed = seed * 1103515245u + 12345u;
+            int n = snprintf(lines[i], sizeof(lines[i]), "sensor=%u temp=%u.%u humidity=%u%% status=ok seq=%llu\n",
+                             seed >> 28, 20 + (seed >> 24) % 8, (seed >> 16) % 10, 40 + (seed >> 8) % 20,
+                             (unsigned long long)sequence++);
+            records[i] = (struct iovec){ .iov_base = lines[i], .iov_len = (size_t)n };
+        }
+        if (record_log_append_batch(&log, records, BATCH) != 0) {
+            record_log_close(&log);
+            return 0;
+        }
+    }
+    size_t count = log.count;
+    record_log_close(&log);
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    const char *dir = "/var/tmp";
+    long megabytes = 1024;
+    int runs = 3;
+    bool cold = false;
+    char threads_arg[] = "1,2,4,8";
+    char *threads_list = threads_arg;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:s:t:R:c")) != -1) {
+        switch (opt) {
+        case 'd': dir = optarg; break;
+        case 's': megabytes = atol(optarg); break;
+        case 't': threads_list = optarg; break;
+        case 'R': runs = atoi(optarg); break;
+        case 'c': cold = true; break;
+        default:
+            fprintf(stderr, "Usage: %s [-d dir] [-s megabytes] [-t threads,threads] [-R runs] [-c]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (runs < 1) runs = 1;
+    if (megabytes < 1) megabytes = 1;
+    int thread_counts[MAX_THREAD_COUNTS], ncounts = 0;
+    for (char *save = NULL, *item = strtok_r(threads_list, ",", &save); item && ncounts < MAX_THREAD_COUNTS;
+         item = strtok_r(NULL, ",", &save)) {
+        thread_counts[ncounts++] = atoi(item);
+    }
+    char path[256];
+    snprintf(path, sizeof(path), "%s/recovery_bench.rec", dir);
+    log_set_level("error"); // Recovery messages of every open would clutter the table
+    fsync_policy = FSYNC_NEVER; // Building the log is not what is measured
+    double begin = now_sec();
+    size_t count = build(path, (uint64_t)megabytes * 1024 * 1024);
+    if (count == 0) {
+        fprintf(stderr, "Failed to build %s\n", path);
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+    struct stat st;
+    if (stat(path, &st) != 0) return EXIT_FAILURE;
+    printf("log: %lld bytes, %zu records, built in %.1f s, %s cache\n", (long long)st.st_size, count,
+           now_sec() - begin, cold ? "cold" : "warm");
+    printf("%7s %10s %10s %10s %s\n", "threads", "best_ms", "mean_ms", "GB/s", "records");
+    int status = EXIT_SUCCESS;
+    for (int t = 0; t < ncounts; t++) {
+        double best = 0, total = 0;
+        bool exact = true;
+        for (int run = 0; run < runs; run++) {
+            if (cold) drop_cache(path);
+            struct record_log log;
+            begin = now_sec();
+            if (record_log_open(&log, path, thread_counts[t]) != 0) {
+                exact = false;
+                break;
+            }
+            double elapsed = now_sec() - begin;
+            if (log.count != count || (uint64_t)log.end != (uint64_t)st.st_size) exact = false;
+            record_log_close(&log);
+            total += elapsed;
+            if (run == 0 || elapsed < best) best = elapsed;
+        }
+        printf("%7d %10.1f %10.1f %10.2f %s\n", thread_counts[t], best * 1e3, total / runs * 1e3,
+               st.st_size / best / 1e9, exact ? "ok" : "MISMATCH");
+        fflush(stdout);
+        if (!exact) status = EXIT_FAILURE;
+    }
+    unlink(path);
+    return status;
+}
@@ -0,0 +1,97 @@
+// scan_bench.c
+// Microbenchmark of the newline scanners in newline_scan.c against a memchr() loop.
+// Every variant collects all newline positions of a block, in batches, the way the framer and log indexers do.
+// Usage: scan_bench [-m max_bytes] [-l mean_line_length]
+
+#include "../newline_scan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include "bench.h"
+
+#define BATCH 4096 // Positions collected per call
+
+static size_t memchr_scan(const char *buf, size_t length, size_t *positions) {
+    size_t total = 0;
+    size_t found = 0;
+    const char *p = buf;
+    const char *end = buf + length;
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        positions[found++] = p - buf;
+        if (found == BATCH) {
+            total += found;
+            found = 0;
+        }
+        p++;
+    }
+    return total + found;
+}
+
+static size_t vector_scan(const char *buf, size_t length, size_t *positions) {
+    size_t total = 0;
+    size_t start = 0;
+    for (;;) {
+        size_t found = scan_newlines(buf + start, length - start, positions, BATCH);
+        total += found;
+        if (found < BATCH) return total;
+        start += positions[found - 1] + 1;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    size_t max_bytes = 1ull << 30;
+    size_t line_length = 64;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:l:")) != -1) {
+        if (opt == 'm') max_bytes = strtoull(optarg, NULL, 0);
+        else if (opt == 'l') line_length = strtoull(optarg, NULL, 0);
+        else {
+            fprintf(stderr, "Usage: %s [-m max_bytes] [-l mean_line_length]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (line_length < 2) line_length = 2;
+
+    char *buf = malloc(max_bytes);
+    size_t *positions = malloc(BATCH * sizeof(*positions));
+    if (!buf || !positions) {
+        fprintf(stderr, "Failed to allocate %zu bytes\n", max_bytes);
+        return EXIT_FAILURE;
+    }
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < max_bytes; i++) {
+        seed = seed * 1103515245u + 12345u;
+        buf[i] = ((seed >> 16) % line_length == 0) ? '\n' : (char)('a' + (seed >> 8) % 26);
+    }
+
+    const char *impls[] = { "memchr", "generic", "sse2", "avx2" };
+    printf("%-12s %-8s %12s %10s %10s\n", "size", "impl", "newlines", "GB/s", "ns/line");
+    for (size_t size = 1024; size <= max_bytes; size *= 32) {
+        size_t rounds = (1ull << 30) / size; // Scan about 1 GB per measurement
+        if (rounds < 3) rounds = 3;
+        size_t expected = memchr_scan(buf, size, positions);
+        for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); k++) {
+            bool is_memchr = strcmp(impls[k], "memchr") == 0;
+            if (!is_memchr && scan_select(impls[k]) != 0) continue; // Not supported on this CPU
+            size_t found = 0;
+            double begin = now_sec();
+            for (size_t r = 0; r < rounds; r++) {
+                found = is_memchr ? memchr_scan(buf, size, positions) : vector_scan(buf, size, positions);
+            }
+            double elapsed = now_sec() - begin;
+            if (found != expected) {
+                fprintf(stderr, "%s found %zu newlines, expected %zu\n", impls[k], found, expected);
+                return EXIT_FAILURE;
+            }
+            printf("%-12zu %-8s %12zu %10.2f %10.2f\n", size, impls[k], found, (double)size * rounds / elapsed / 1e9,
+                   found ? elapsed * 1e9 / ((double)found * rounds) : 0.0);
+        }
+    }
+    free(positions);
+    free(buf);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,100 @@
+// segment_bench.c
+// Bytes on disk and replay throughput of compressed log segments against the uncompressed text log.
+// A synthetic log of repetitive sensor lines and timestamps (what the devices typically send) is written to
+// a text file, compressed with every codec into a segment (segment_compress(), as the background thread does),
+// and both are replayed into a socket pair the way the server replays them: send_file() for the text log,
+// segment_send() for the segment. The replay column is decompressed bytes delivered per second.
+// - -c replays cold files (see bench.h), which is where the smaller segment pays off.
+// Usage: segment_bench [-d dir] [-S log_bytes] [-n replays] [-c]
+// Example: segment_bench -d /var/tmp -S 67108864 -c
+
+#include "../socket.h"
+#include "../segment.h"
+#include "bench.h"
+
+static int generate(const char *path, size_t bytes) {
+    FILE *file = fopen(path, "w");
+    if (!file) return -1;
+    unsigned seed = 42;
+    size_t written = 0;
+    for (unsigned line = 0; written < bytes; line++) {
+        int n;
+        if (line % 100 == 0) {
+            n = fprintf(file, "timestamp:Mon, 19 Oct 2026 11:%02u:%02u +0000\n", line / 6000 % 60, line / 100 % 60);
+        } else {
+            seed = seed * 1103515245u + 12345u;
+            n = fprintf(file, "sensor=%u temp=%u.%u humidity=%u%% status=ok\n", seed >> 28, 20 + (seed >> 24) % 8,
+                        (seed >> 16) % 10, 40 + (seed >> 8) % 20);
+        }
+        if (n < 0) break;
+        written += n;
+    }
+    fclose(file);
+    return written >= bytes ? 0 : -1;
+}
+
+static off_t file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+static void report(const char *name, const char *path, off_t raw_bytes, double write_sec, struct sink *sink,
+                   int replays, bool cold, bool compressed) {
+    double elapsed = 0;
+    for (int i = 0; i < replays; i++) {
+        if (cold) drop_cache(path);
+        double begin = now_sec();
+        ssize_t sent = compressed ? segment_send(path, sink->fds[0]) : send_file(path, sink->fds[0]);
+        elapsed += now_sec() - begin;
+        if (sent != raw_bytes) fprintf(stderr, "%s: replayed %zd of %lld bytes\n", name, sent, (long long)raw_bytes);
+    }
+    off_t size = file_size(path);
+    printf("%-6s %14lld %7.2f %12.1f %12.1f\n", name, (long long)size, (double)raw_bytes / size,
+           write_sec > 0 ? raw_bytes / write_sec / 1e6 : 0.0, raw_bytes * (double)replays / elapsed / 1e6);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    const char *dir = "/var/tmp";
+    size_t bytes = 32 * 1024 * 1024;
+    int replays = 5;
+    bool cold = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:S:n:c")) != -1) {
+        switch (opt) {
+        case 'd': dir = optarg; break;
+        case 'S': bytes = strtoull(optarg, NULL, 0); break;
+        case 'n': replays = atoi(optarg); break;
+        case 'c': cold = true; break;
+        default:
+            fprintf(stderr, "Usage: %s [-d dir] [-S log_bytes] [-n replays] [-c]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (replays < 1) replays = 1;
+    char raw_path[SEGMENT_PATH_MAX], packed_path[SEGMENT_PATH_MAX];
+    snprintf(raw_path, sizeof(raw_path), "%s/segment_bench.txt", dir);
+    snprintf(packed_path, sizeof(packed_path), "%s/segment_bench.txt.1.z", dir);
+    if (generate(raw_path, bytes) != 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", raw_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    struct sink sink;
+    if (sink_open(&sink, NULL) != 0) return EXIT_FAILURE;
+    off_t raw_bytes = file_size(raw_path);
+    printf("%-6s %14s %7s %12s %12s\n", "codec", "bytes_on_disk", "ratio", "write_MB/s", "replay_MB/s");
+    report("none", raw_path, raw_bytes, 0, &sink, replays, cold, false);
+    const struct codec *codecs[] = { &lz_codec };
+    for (size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+        double begin = now_sec();
+        if (segment_compress(codecs[i], raw_path, packed_path) < 0) {
+            fprintf(stderr, "Failed to compress with %s\n", codecs[i]->name);
+            continue;
+        }
+        report(codecs[i]->name, packed_path, raw_bytes, now_sec() - begin, &sink, replays, cold, true);
+        unlink(packed_path);
+    }
+    sink_close(&sink);
+    unlink(raw_path);
+    return EXIT_SUCCESS;
+}
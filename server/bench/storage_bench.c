@@ -0,0 +1,260 @@
+// storage_bench.c
+// Microbenchmark of the storage hot path without the network stack: write_to_file(), write_records_to_file(),
+// read_from_file(), send_file() and the persistent record log, each called the way the server calls it
+// (under lock_file()). Every case is run for each directory, record size, thread count and fsync policy.
+// - ns/op is wall time divided by the number of operations over all threads.
+// - syscalls/op is counted in a separate single-threaded run of the same case under ptrace, minus a run
+//   that does no operations, so timing is not disturbed by the tracing.
+// - allocs/op counts malloc/calloc/realloc calls (glibc only), including those made inside stdio.
+// Usage: storage_bench [-d dir,dir] [-s sizes] [-t threads] [-f always,never] [-F prefill_bytes] [-n ops]
+// Example: storage_bench -d /dev/shm,/var/tmp compares tmpfs with the disk that holds the real log.
+
+#include "../socket.h"
+#include "../record_log.h"
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "bench.h"
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+static atomic_ulong allocations;
+
+void *malloc(size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+#define ALLOCATIONS() atomic_load(&allocations)
+#else
+#define ALLOCATIONS() 0ul
+#endif
+
+#define MAX_LIST 16
+
+struct bench_ctx {
+    char path[256]; // File under test
+    size_t record_size;
+    char *record; // Newline terminated record of record_size bytes
+    size_t prefill; // Bytes written before timing starts
+    char *read_buffer; // Destination of read_from_file()
+    struct record_log log; // Used by the record log cases
+    struct sink sink; // Receives the replays
+};
+
+struct bench_case {
+    const char *name;
+    bool uses_log; // Operates on ctx->log instead of ctx->path
+    bool writes; // Affected by the fsync policy
+    void (*op)(struct bench_ctx *ctx);
+};
+
+static void op_write_to_file(struct bench_ctx *ctx) {
+    write_to_file(ctx->path, ctx->record, ctx->record_size);
+}
+
+static void op_write_records(struct bench_ctx *ctx) {
+    struct iovec record = { .iov_base = ctx->record, .iov_len = ctx->record_size };
+    write_records_to_file(ctx->path, &record, 1);
+}
+
+static void op_record_log_append(struct bench_ctx *ctx) {
+    record_log_append(&ctx->log, ctx->record, ctx->record_size);
+}
+
+static void op_read_from_file(struct bench_ctx *ctx) {
+    read_from_file(ctx->path, ctx->read_buffer, ctx->prefill + 1);
+}
+
+static void op_send_file(struct bench_ctx *ctx) {
+    send_file(ctx->path, ctx->sink.fds[0]);
+}
+
+static void op_record_log_replay(struct bench_ctx *ctx) {
+    record_log_replay(&ctx->log, ctx->sink.fds[0]);
+}
+
+static const struct bench_case cases[] = {
+    { "write_to_file", false, true, op_write_to_file },
+    { "write_records", false, true, op_write_records },
+    { "record_log_append", true, true, op_record_log_append },
+    { "read_from_file", false, false, op_read_from_file },
+    { "send_file", false, false, op_send_file },
+    { "record_log_replay", true, false, op_record_log_replay },
+};
+
+static int setup(struct bench_ctx *ctx, const struct bench_case *c, const char *dir, size_t record_size,
+                 size_t prefill) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->sink.fds[0] = ctx->sink.fds[1] = -1;
+    ctx->record_size = record_size;
+    ctx->prefill = prefill;
+    snprintf(ctx->path, sizeof(ctx->path), "%s/aesd-storage-bench.%s", dir, c->uses_log ? "rec" : "txt");
+    unlink(ctx->path);
+    ctx->record = malloc(record_size);
+    ctx->read_buffer = malloc(prefill + 1);
+    if (!ctx->record || !ctx->read_buffer) return -1;
+    memset(ctx->record, 'r', record_size);
+    ctx->record[record_size - 1] = '\n';
+
+    // Prefill without syncing, in large batches
+    enum fsync_policy saved = fsync_policy;
+    fsync_policy = FSYNC_NEVER;
+    size_t batch = 256;
+    struct iovec *records = malloc(batch * sizeof(*records));
+    if (!records) return -1;
+    for (size_t i = 0; i < batch; i++) records[i] = (struct iovec){ .iov_base = ctx->record, .iov_len = record_size };
+    if (c->uses_log && record_log_open(&ctx->log, ctx->path, 0) != 0) return -1;
+    for (size_t filled = 0; filled < prefill; filled += batch * record_size) {
+        if (c->uses_log) record_log_append_batch(&ctx->log, records, batch);
+        else write_records_to_file(ctx->path, records, batch);
+    }
+    if (!c->uses_log && prefill == 0) write_records_to_file(ctx->path, records, 0); // Make sure the file exists
+    free(records);
+    fsync_policy = saved;
+
+    return sink_open(&ctx->sink, NULL);
+}
+
+static void teardown(struct bench_ctx *ctx, const struct bench_case *c) {
+    sink_close(&ctx->sink);
+    if (c->uses_log) record_log_close(&ctx->log);
+    unlink(ctx->path);
+    free(ctx->record);
+    free(ctx->read_buffer);
+}
+
+struct runner {
+    struct bench_ctx *ctx;
+    const struct bench_case *c;
+    long ops;
+};
+
+static void *run_ops(void *arg) {
+    struct runner *r = (struct runner *)arg;
+    for (long i = 0; i < r->ops; i++) {
+        lock_file(); // Same serialization and instrumentation as the server
+        r->c->op(r->ctx);
+        unlock_file();
+    }
+    return NULL;
+}
+
+// Count the system calls made by a child process that sets up the case and runs ops operations
+static long traced_syscalls(const struct bench_case *c, const char *dir, size_t record_size, size_t prefill,
+                            long ops) {
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) != 0) _exit(1);
+        raise(SIGSTOP);
+        struct bench_ctx ctx;
+        if (setup(&ctx, c, dir, record_size, prefill) != 0) _exit(1);
+        struct runner r = { &ctx, c, ops };
+        run_ops(&r);
+        teardown(&ctx, c);
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)(PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL));
+    long stops = 0;
+    for (;;) {
+        if (ptrace(PTRACE_SYSCALL, pid, NULL, NULL) != 0) break;
+        if (waitpid(pid, &status, 0) < 0 || WIFEXITED(status) || WIFSIGNALED(status)) break;
+        if (WIFSTOPPED(status) && WSTOPSIG(status) == (SIGTRAP | 0x80)) stops++;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+    return stops / 2; // One stop on entry and one on exit
+}
+
+static int parse_list(char *arg, char **items) {
+    int n = 0;
+    for (char *save = NULL, *item = strtok_r(arg, ",", &save); item && n < MAX_LIST; item = strtok_r(NULL, ",", &save)) {
+        items[n++] = item;
+    }
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    char dirs_arg[] = "/dev/shm,/var/tmp", sizes_arg[] = "64,1024,16384", threads_arg[] = "1,4",
+         policies_arg[] = "always,never";
+    char *dirs[MAX_LIST], *sizes[MAX_LIST], *threads[MAX_LIST], *policies[MAX_LIST];
+    int ndirs = parse_list(dirs_arg, dirs), nsizes = parse_list(sizes_arg, sizes),
+        nthreads = parse_list(threads_arg, threads), npolicies = parse_list(policies_arg, policies);
+    size_t prefill = 1024 * 1024;
+    long ops = 2000;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:s:t:f:F:n:")) != -1) {
+        switch (opt) {
+        case 'd': ndirs = parse_list(optarg, dirs); break;
+        case 's': nsizes = parse_list(optarg, sizes); break;
+        case 't': nthreads = parse_list(optarg, threads); break;
+        case 'f': npolicies = parse_list(optarg, policies); break;
+        case 'F': prefill = strtoull(optarg, NULL, 0); break;
+        case 'n': ops = atol(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-d dir,dir] [-s sizes] [-t threads] [-f always,never] [-F prefill_bytes] [-n ops]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (ops < 1) ops = 1;
+    long traced_ops = ops < 100 ? ops : 100;
+
+    printf("%-18s %-10s %8s %7s %-6s %12s %12s %10s\n", "case", "dir", "size", "threads", "fsync", "ns/op",
+           "syscalls/op", "allocs/op");
+    for (int d = 0; d < ndirs; d++) {
+        for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); k++) {
+            const struct bench_case *c = &cases[k];
+            for (int s = 0; s < nsizes; s++) {
+                size_t size = strtoull(sizes[s], NULL, 0);
+                if (size < 1) continue;
+                for (int p = 0; p < (c->writes ? npolicies : 1); p++) {
+                    fsync_policy = strcmp(policies[p], "never") == 0 ? FSYNC_NEVER : FSYNC_ALWAYS;
+                    long with_ops = traced_syscalls(c, dirs[d], size, prefill, traced_ops);
+                    long without_ops = traced_syscalls(c, dirs[d], size, prefill, 0);
+                    double syscalls = (with_ops < 0 || without_ops < 0) ? -1 : (double)(with_ops - without_ops) / traced_ops;
+                    for (int t = 0; t < nthreads; t++) {
+                        int nthread = atoi(threads[t]);
+                        if (nthread < 1) continue;
+                        struct bench_ctx ctx;
+                        if (setup(&ctx, c, dirs[d], size, prefill) != 0) {
+                            fprintf(stderr, "Failed to set up %s in %s\n", c->name, dirs[d]);
+                            teardown(&ctx, c);
+                            continue;
+                        }
+                        pthread_t tids[MAX_LIST * 16];
+                        struct runner runner = { &ctx, c, ops / nthread };
+                        if (nthread > (int)(sizeof(tids) / sizeof(tids[0]))) nthread = sizeof(tids) / sizeof(tids[0]);
+                        unsigned long allocs_before = ALLOCATIONS();
+                        double begin = now_sec();
+                        for (int i = 0; i < nthread; i++) pthread_create(&tids[i], NULL, run_ops, &runner);
+                        for (int i = 0; i < nthread; i++) pthread_join(tids[i], NULL);
+                        double elapsed = now_sec() - begin;
+                        long total = runner.ops * nthread;
+                        double allocs = (double)(ALLOCATIONS() - allocs_before) / total;
+                        teardown(&ctx, c);
+                        printf("%-18s %-10s %8zu %7d %-6s %12.0f ", c->name, dirs[d], size, nthread,
+                               c->writes ? policies[p] : "-", elapsed * 1e9 / total);
+                        if (syscalls < 0) printf("%12s ", "n/a");
+                        else printf("%12.2f ", syscalls);
+                        printf("%10.2f\n", allocs);
+                        fflush(stdout);
+                    }
+                }
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+// transport_bench.c
+// Compares loopback TCP with the AF_UNIX listener (-u) of a running aesdsocket.
+// Latency: connect, send a one line packet and read the replay to EOF, repeated -n times.
+// Throughput: one connection streams -r length-prefixed records of -s bytes, then reads the replay.
+// Usage: transport_bench -u unix_path [-p port] [-n round_trips] [-r records] [-s record_size]
+// Note: every round trip appends to the server log, so run it against a scratch server.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "bench.h"
+
+static const char *unix_path;
+static int port = 9000;
+
+static int connect_to(bool local) {
+    int fd;
+    if (local) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        strncpy(addr.sun_path, unix_path, sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) return fd;
+    } else {
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) return fd;
+    }
+    fprintf(stderr, "Failed to connect over %s: %s\n", local ? "unix" : "tcp", strerror(errno));
+    if (fd >= 0) close(fd);
+    return -1;
+}
+
+static int send_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0) return -1;
+        data += sent;
+        length -= sent;
+    }
+    return 0;
+}
+
+static ssize_t drain(int fd) {
+    char buf[65536];
+    ssize_t total = 0, got;
+    while ((got = recv(fd, buf, sizeof(buf), 0)) > 0) total += got;
+    return got < 0 ? -1 : total;
+}
+
+static int latency(bool local, int rounds) {
+    double *samples = malloc(rounds * sizeof(*samples));
+    if (!samples) return -1;
+    for (int i = 0; i < rounds; i++) {
+        double begin = now_sec();
+        int fd = connect_to(local);
+        if (fd < 0 || send_all(fd, "x\n", 2) < 0 || drain(fd) < 0) {
+            if (fd >= 0) close(fd);
+            free(samples);
+            return -1;
+        }
+        close(fd);
+        samples[i] = (now_sec() - begin) * 1e6;
+    }
+    qsort(samples, rounds, sizeof(*samples), cmp_double);
+    printf("%-5s latency    p50 %8.1f us  p99 %8.1f us  max %8.1f us\n", local ? "unix" : "tcp",
+           percentile(samples, rounds, 0.50), percentile(samples, rounds, 0.99), samples[rounds - 1]);
+    free(samples);
+    return 0;
+}
+
+static int throughput(bool local, int records, size_t size) {
+    char *frame = malloc(4 + size);
+    if (!frame) return -1;
+    uint32_t length = htonl((uint32_t)size);
+    memcpy(frame, &length, 4);
+    memset(frame + 4, 'b', size);
+    double begin = now_sec();
+    int fd = connect_to(local);
+    if (fd < 0 || send_all(fd, "\0LP1", 4) < 0) goto fail;
+    for (int i = 0; i < records; i++) {
+        if (send_all(fd, frame, 4 + size) < 0) goto fail;
+    }
+    uint32_t end = 0;
+    if (send_all(fd, (const char *)&end, 4) < 0 || drain(fd) < 0) goto fail;
+    double elapsed = now_sec() - begin;
+    printf("%-5s throughput %10.0f records/s  %8.2f MB/s\n", local ? "unix" : "tcp", records / elapsed,
+           records * size / elapsed / 1e6);
+    close(fd);
+    free(frame);
+    return 0;
+fail:
+    if (fd >= 0) close(fd);
+    free(frame);
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = 1000, records = 10000;
+    size_t size = 64;
+    int opt;
+    while ((opt = getopt(argc, argv, "u:p:n:r:s:")) != -1) {
+        switch (opt) {
+        case 'u': unix_path = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'n': rounds = atoi(optarg); break;
+        case 'r': records = atoi(optarg); break;
+        case 's': size = strtoull(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "Usage: %s -u unix_path [-p port] [-n round_trips] [-r records] [-s record_size]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!unix_path || rounds < 1 || records < 1) {
+        fprintf(stderr, "Usage: %s -u unix_path [-p port] [-n round_trips] [-r records] [-s record_size]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (int local = 0; local <= 1; local++) {
+        if (latency(local, rounds) < 0 || throughput(local, records, size) < 0) return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,356 @@
+// capreplay.c
+// Replays a traffic capture recorded with aesdsocket -C against a server, to compare server builds on the
+// same realistic workload. Every connection of the trace is opened, fed the same chunks of bytes and shut
+// down for writing at the times they happened, scaled by the speed factor, while the replies are read as
+// they arrive. One thread drives all connections with poll(), so thousands of concurrent clients are cheap.
+// Per session it reports:
+// - connect: connect() latency,
+// - first_byte: the last request byte sent until the first reply byte arrives (append and sync),
+// - response: the last request byte sent until the server closes the connection (including the replay),
+// and how late events were sent compared to the schedule, which shows whether the results are trustworthy.
+// Usage: capreplay [-H host] [-p port] [-u unix_path] [-s speed] [-j] trace
+// -s 1 replays at the original pace (default), -s 10 ten times faster, -s 0 as fast as possible.
+
+#define _GNU_SOURCE // ppoll
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "capture.h"
+#include "bench/bench.h"
+
+#define LOG_ERR(fmt, ...) fprintf(stderr, "[ERROR]: " fmt "\n", ##__VA_ARGS__)
+
+enum phase { PHASE_CONNECT, PHASE_FIRST_BYTE, PHASE_RESPONSE, PHASE_LAG, PHASES };
+static const char *phase_names[PHASES] = { "connect", "first_byte", "response", "schedule_lag" };
+
+struct options {
+    const char *host;
+    int port;
+    const char *unix_path;
+    double speed; // 0 for as fast as possible
+    bool json;
+};
+
+struct event {
+    enum capture_event type;
+    uint32_t connection;
+    double at; // Seconds since the start of the trace
+    const unsigned char *data; // Points into the mapped trace
+    size_t length;
+};
+
+struct chunk {
+    const unsigned char *data;
+    size_t length;
+    struct chunk *next;
+};
+
+struct session {
+    int fd; // -1 before the open and after the end
+    struct chunk *head, *tail; // Bytes still to be sent
+    bool shutdown_pending; // Shut down for writing once the queue is empty
+    bool request_sent; // Some bytes have been sent since the last reply byte
+    double last_sent; // When the last queued byte left
+    double first_byte; // First reply byte after last_sent, 0 if none yet
+    uint64_t received;
+};
+
+struct samples {
+    double *values[PHASES]; // Microseconds
+    long count[PHASES];
+    long capacity;
+};
+
+static int get_varint(const unsigned char **p, const unsigned char *end, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*p >= end) return -1;
+        unsigned char byte = *(*p)++;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return 0;
+    }
+    return -1;
+}
+
+// Decode the whole trace; returns the number of events or -1 if the trace is corrupt
+static long parse_trace(const unsigned char *p, const unsigned char *end, struct event **events, uint32_t *max_id) {
+    struct capture_header header;
+    if ((size_t)(end - p) < sizeof(header)) return -1;
+    memcpy(&header, p, sizeof(header));
+    if (memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0) return -1;
+    p += sizeof(header);
+    long count = 0, capacity = 0;
+    double at = 0;
+    *max_id = 0;
+    while (p < end) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            struct event *grown = realloc(*events, capacity * sizeof(**events));
+            if (!grown) return -1;
+            *events = grown;
+        }
+        struct event *e = &(*events)[count];
+        uint64_t connection, delta, length = 0;
+        e->type = (enum capture_event)*p++;
+        if (get_varint(&p, end, &connection) != 0 || get_varint(&p, end, &delta) != 0 || connection == 0 ||
+            connection > UINT32_MAX) {
+            return -1;
+        }
+        if (e->type == CAPTURE_DATA && (get_varint(&p, end, &length) != 0 || length > (uint64_t)(end - p))) return -1;
+        if (e->type != CAPTURE_OPEN && e->type != CAPTURE_DATA && e->type != CAPTURE_CLOSE) return -1;
+        at += delta / 1e6;
+        e->connection = (uint32_t)connection;
+        e->at = at;
+        e->data = p;
+        e->length = length;
+        p += length;
+        if (e->connection > *max_id) *max_id = e->connection;
+        count++;
+    }
+    return count;
+}
+
+static int connect_server(const struct options *options) {
+    int fd;
+    if (options->unix_path) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        strncpy(addr.sun_path, options->unix_path, sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) return fd;
+    } else {
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(options->port) };
+        inet_pton(AF_INET, options->host, &addr.sin_addr);
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int one = 1;
+        if (fd >= 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) return fd;
+    }
+    if (fd >= 0) close(fd);
+    return -1;
+}
+
+static void add_sample(struct samples *s, enum phase phase, double us) {
+    if (s->count[phase] == s->capacity) return; // Sized for one sample per event
+    s->values[phase][s->count[phase]++] = us;
+}
+
+// Send as much of the queue as the socket takes without blocking; returns -1 if the connection failed
+static int flush_session(struct session *s) {
+    while (s->head) {
+        ssize_t sent = send(s->fd, s->head->data, s->head->length, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        s->head->data += sent;
+        s->head->length -= sent;
+        s->request_sent = true;
+        s->first_byte = 0;
+        s->last_sent = now_sec();
+        if (s->head->length == 0) {
+            struct chunk *done = s->head;
+            s->head = done->next;
+            if (!s->head) s->tail = NULL;
+            free(done);
+        }
+    }
+    if (s->shutdown_pending) {
+        shutdown(s->fd, SHUT_WR);
+        s->shutdown_pending = false;
+    }
+    return 0;
+}
+
+static void end_session(struct session *s) {
+    close(s->fd);
+    s->fd = -1;
+    while (s->head) {
+        struct chunk *next = s->head->next;
+        free(s->head);
+        s->head = next;
+    }
+    s->tail = NULL;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-H host] [-p port] [-u unix_path] [-s speed] [-j] trace\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    struct options options = { .host = "127.0.0.1", .port = 9000, .speed = 1 };
+    int opt;
+    while ((opt = getopt(argc, argv, "H:p:u:s:j")) != -1) {
+        switch (opt) {
+        case 'H': options.host = optarg; break;
+        case 'p': options.port = atoi(optarg); break;
+        case 'u': options.unix_path = optarg; break;
+        case 's': options.speed = atof(optarg); break;
+        case 'j': options.json = true; break;
+        default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || options.speed < 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    int trace_fd = open(argv[optind], O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (trace_fd < 0 || fstat(trace_fd, &st) != 0) {
+        LOG_ERR("Failed to open %s: %s", argv[optind], strerror(errno));
+        return EXIT_FAILURE;
+    }
+    const unsigned char *trace = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, trace_fd, 0) : NULL;
+    struct event *events = NULL;
+    uint32_t max_id = 0;
+    long nevents = trace && trace != MAP_FAILED ? parse_trace(trace, trace + st.st_size, &events, &max_id) : -1;
+    if (nevents < 0) {
+        LOG_ERR("%s is not a valid capture", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    struct session *sessions = calloc(max_id + 1, sizeof(*sessions));
+    struct pollfd *fds = malloc((max_id + 1) * sizeof(*fds));
+    uint32_t *polled = malloc((max_id + 1) * sizeof(*polled)); // Session of every pollfd
+    struct samples samples = { .capacity = nevents + 1 };
+    for (int p = 0; p < PHASES; p++) samples.values[p] = malloc(samples.capacity * sizeof(double));
+    char *discard = malloc(65536);
+    if (!sessions || !fds || !polled || !discard || !samples.values[PHASES - 1]) return EXIT_FAILURE;
+    for (uint32_t i = 0; i <= max_id; i++) sessions[i].fd = -1;
+
+    long next = 0, completed = 0, failed = 0, open_sessions = 0;
+    uint64_t sent = 0, received = 0;
+    double begin = now_sec();
+    while (next < nevents || open_sessions > 0) {
+        // Dispatch every event that is due
+        double now = now_sec();
+        while (next < nevents && (options.speed == 0 || begin + events[next].at / options.speed <= now)) {
+            struct event *e = &events[next++];
+            struct session *s = &sessions[e->connection];
+            if (options.speed > 0) add_sample(&samples, PHASE_LAG, (now - begin - e->at / options.speed) * 1e6);
+            if (e->type == CAPTURE_OPEN) {
+                double start = now_sec();
+                s->fd = connect_server(&options);
+                if (s->fd < 0) {
+                    failed++;
+                    continue;
+                }
+                fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL) | O_NONBLOCK);
+                add_sample(&samples, PHASE_CONNECT, (now_sec() - start) * 1e6);
+                open_sessions++;
+            } else if (s->fd >= 0 && e->type == CAPTURE_DATA) {
+                struct chunk *c = malloc(sizeof(*c));
+                if (!c) return EXIT_FAILURE;
+                *c = (struct chunk){ e->data, e->length, NULL };
+                if (s->tail) s->tail->next = c;
+                else s->head = c;
+                s->tail = c;
+                sent += e->length;
+            } else if (s->fd >= 0 && e->type == CAPTURE_CLOSE) {
+                s->shutdown_pending = true;
+            }
+            if (s->fd >= 0 && flush_session(s) != 0) {
+                end_session(s);
+                open_sessions--;
+                failed++;
+            }
+            now = now_sec();
+        }
+        // Wait for replies, writable sockets or the next event
+        nfds_t n = 0;
+        for (uint32_t i = 1; i <= max_id; i++) {
+            if (sessions[i].fd < 0) continue;
+            fds[n] = (struct pollfd){ .fd = sessions[i].fd, .events = POLLIN | (sessions[i].head ? POLLOUT : 0) };
+            polled[n++] = i;
+        }
+        struct timespec timeout = { 0, 0 };
+        if (next < nevents && options.speed > 0) {
+            double wait = begin + events[next].at / options.speed - now_sec();
+            if (wait > 0) timeout = (struct timespec){ (time_t)wait, (long)((wait - (time_t)wait) * 1e9) };
+        }
+        if (ppoll(fds, n, next < nevents ? &timeout : NULL, NULL) < 0 && errno != EINTR) break;
+        for (nfds_t k = 0; k < n; k++) {
+            struct session *s = &sessions[polled[k]];
+            if ((fds[k].revents & POLLOUT) && flush_session(s) != 0) {
+                end_session(s);
+                open_sessions--;
+                failed++;
+                continue;
+            }
+            if (!(fds[k].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            ssize_t got = recv(s->fd, discard, 65536, 0);
+            if (got < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+            double at = now_sec();
+            if (got > 0) {
+                if (s->request_sent && s->first_byte == 0) s->first_byte = at;
+                s->received += got;
+                received += got;
+                continue;
+            }
+            if (got == 0 && s->request_sent) {
+                if (s->first_byte) add_sample(&samples, PHASE_FIRST_BYTE, (s->first_byte - s->last_sent) * 1e6);
+                add_sample(&samples, PHASE_RESPONSE, (at - s->last_sent) * 1e6);
+            }
+            if (got < 0) failed++;
+            else completed++;
+            end_session(s);
+            open_sessions--;
+        }
+    }
+    double elapsed = now_sec() - begin;
+
+    double stats[PHASES][4]; // p50, p99, p999, max
+    for (int p = 0; p < PHASES; p++) {
+        long count = samples.count[p];
+        qsort(samples.values[p], count, sizeof(double), cmp_double);
+        stats[p][0] = percentile(samples.values[p], count, 0.50);
+        stats[p][1] = percentile(samples.values[p], count, 0.99);
+        stats[p][2] = percentile(samples.values[p], count, 0.999);
+        stats[p][3] = count ? samples.values[p][count - 1] : 0;
+    }
+    double trace_seconds = nevents ? events[nevents - 1].at : 0;
+    if (options.json) {
+        printf("{\"trace\":\"%s\",\"events\":%ld,\"trace_s\":%.6f,\"speed\":%.3f,\"elapsed_s\":%.6f,\"sessions\":%ld,"
+               "\"failed\":%ld,\"bytes_sent\":%llu,\"bytes_received\":%llu,\"latency_us\":{",
+               argv[optind], nevents, trace_seconds, options.speed, elapsed, completed, failed,
+               (unsigned long long)sent, (unsigned long long)received);
+        for (int p = 0; p < PHASES; p++) {
+            printf("%s\"%s\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}", p ? "," : "", phase_names[p],
+                   stats[p][0], stats[p][1], stats[p][2], stats[p][3]);
+        }
+        printf("}}\n");
+    } else {
+        printf("%ld events over %.3f s of trace replayed in %.3f s (speed %s%.3g)\n", nevents, trace_seconds, elapsed,
+               options.speed == 0 ? "max, " : "", options.speed);
+        printf("%ld sessions, %ld failed, sent %.2f MB, received %.2f MB\n", completed, failed, sent / 1e6,
+               received / 1e6);
+        printf("%-12s %12s %12s %12s %12s\n", "phase (us)", "p50", "p99", "p999", "max");
+        for (int p = 0; p < PHASES; p++) {
+            printf("%-12s %12.1f %12.1f %12.1f %12.1f\n", phase_names[p], stats[p][0], stats[p][1], stats[p][2],
+                   stats[p][3]);
+        }
+    }
+
+    for (int p = 0; p < PHASES; p++) free(samples.values[p]);
+    free(discard);
+    free(polled);
+    free(fds);
+    free(sessions);
+    free(events);
+    munmap((void *)trace, st.st_size);
+    close(trace_fd);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
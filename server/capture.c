@@ -0,0 +1,104 @@
+#include "capture.h"
+#include "socket.h"
+#include "metrics.h"
+
+static FILE *trace_file;
+static char *trace_buffer;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t last_event_ns; // metrics_now() of the previous event, under trace_mutex
+static uint32_t connections; // Connection numbers handed out, under trace_mutex
+
+static void put_varint(uint64_t value) {
+    unsigned char bytes[10];
+    int n = 0;
+    do {
+        bytes[n] = value & 0x7f;
+        value >>= 7;
+        if (value) bytes[n] |= 0x80;
+        n++;
+    } while (value);
+    fwrite(bytes, 1, n, trace_file);
+}
+
+// Write the common part of an event; the caller holds trace_mutex
+static void put_event(enum capture_event type, uint32_t connection) {
+    uint64_t now = metrics_now();
+    fputc(type, trace_file);
+    put_varint(connection);
+    put_varint((now - last_event_ns) / 1000);
+    last_event_ns = now - (now - last_event_ns) % 1000; // Keep the remainder, so rounding does not drift
+}
+
+int capture_open(const char *path) {
+    char own_path[PATH_MAX];
+    trace_file = fopen(path, "wxe");
+    if (!trace_file && errno == EEXIST) { // Kept from an earlier run, or written by the instance taken over (-R)
+        if (snprintf(own_path, sizeof(own_path), "%s.%ld", path, (long)getpid()) >= (int)sizeof(own_path)) {
+            errno = ENAMETOOLONG;
+        } else {
+            path = own_path;
+            trace_file = fopen(path, "wxe");
+        }
+    }
+    trace_buffer = (char *)malloc(CAPTURE_BUFFER);
+    if (!trace_file || !trace_buffer) {
+        LOG_ERR("Failed to create trace %s: %s", path, strerror(errno));
+        if (trace_file) fclose(trace_file);
+        trace_file = NULL;
+        free(trace_buffer);
+        trace_buffer = NULL;
+        return -1;
+    }
+    setvbuf(trace_file, trace_buffer, _IOFBF, CAPTURE_BUFFER);
+    struct capture_header header;
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    header.start_unix_ns = (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+    last_event_ns = metrics_now();
+    fwrite(&header, sizeof(header), 1, trace_file);
+    LOG_SYS("Capturing client traffic to %s", path);
+    return 0;
+}
+
+void capture_close(void) {
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_file) {
+        if (fclose(trace_file) != 0) LOG_ERR("Failed to write the trace: %s", strerror(errno));
+        trace_file = NULL;
+        LOG_SYS("Captured %u connections", connections);
+    }
+    pthread_mutex_unlock(&trace_mutex);
+    free(trace_buffer);
+    trace_buffer = NULL;
+}
+
+uint32_t capture_connection(void) {
+    if (!trace_file) return 0;
+    pthread_mutex_lock(&trace_mutex);
+    uint32_t connection = 0;
+    if (trace_file) {
+        connection = ++connections;
+        put_event(CAPTURE_OPEN, connection);
+    }
+    pthread_mutex_unlock(&trace_mutex);
+    return connection;
+}
+
+void capture_data(uint32_t connection, const void *data, size_t length) {
+    if (connection == 0 || length == 0) return;
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_file) {
+        put_event(CAPTURE_DATA, connection);
+        put_varint(length);
+        fwrite(data, 1, length, trace_file);
+    }
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+void capture_end(uint32_t connection) {
+    if (connection == 0) return;
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_file) put_event(CAPTURE_CLOSE, connection);
+    pthread_mutex_unlock(&trace_mutex);
+}
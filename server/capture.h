@@ -0,0 +1,51 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+// capture.h
+// Arrival trace of client traffic (-C path), to reproduce production workloads with capreplay.
+// The trace records when every data connection opened, every chunk of bytes as the server received it
+// (so the segmentation of the stream is kept), and when the connection was closed. Traces are compact:
+// after a fixed header, every event is a type byte followed by unsigned LEB128 varints:
+//   CAPTURE_OPEN:  connection, delta_us
+//   CAPTURE_DATA:  connection, delta_us, length, then length bytes
+//   CAPTURE_CLOSE: connection, delta_us
+// delta_us is the time since the previous event of the trace, connection numbers start at 1.
+// Events are written in the order they happened, through one mutex and a large stdio buffer; nothing
+// is done per event unless capturing is enabled.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CAPTURE_MAGIC "AESDCAP1"
+#define CAPTURE_BUFFER (1024 * 1024) // stdio buffer of the trace file
+
+enum capture_event {
+    CAPTURE_OPEN = 1,
+    CAPTURE_DATA = 2,
+    CAPTURE_CLOSE = 3,
+};
+
+struct capture_header {
+    char magic[8]; // CAPTURE_MAGIC, not NUL terminated
+    uint64_t start_unix_ns; // Wall clock time of the first event's reference point
+};
+
+// Function to start writing a trace
+// Parameters:
+// - path: Trace file. An existing file is never overwritten: the trace then goes to <path>.<pid>.
+// Returns: 0 on success, -1 if the file cannot be created.
+int capture_open(const char *path);
+
+// Function to finish the trace and close the file
+void capture_close(void);
+
+// Function to record a new connection
+// Returns: The connection number to pass to the other functions, 0 if capturing is disabled.
+uint32_t capture_connection(void);
+
+// Function to record bytes received on a connection, as they were received
+void capture_data(uint32_t connection, const void *data, size_t length);
+
+// Function to record the end of a connection
+void capture_end(uint32_t connection);
+
+#endif // CAPTURE_H
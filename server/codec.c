@@ -0,0 +1,130 @@
+#include "codec.h"
+#include <string.h>
+
+// Sequence format of lz: a token byte whose high nibble is the literal count and whose low nibble is the match
+// length minus LZ_MIN_MATCH (a nibble of 15 continues in extra bytes of 255 until a smaller one), the literals,
+// then a little endian 16 bit offset back into the output and the extra match length bytes. The last sequence
+// of a block has literals only.
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t lz_hash(uint32_t value) {
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static unsigned char *put_length(unsigned char *op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+static int get_length(const unsigned char **ip, const unsigned char *end, size_t *length) {
+    unsigned char byte;
+    do {
+        if (*ip >= end) return -1;
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+static unsigned char *put_sequence(unsigned char *op, const unsigned char *literals, size_t count, size_t offset,
+                                   size_t match) {
+    unsigned char *token = op++;
+    *token = (unsigned char)((count < 15 ? count : 15) << 4);
+    if (count >= 15) op = put_length(op, count - 15);
+    memcpy(op, literals, count);
+    op += count;
+    if (offset == 0) return op; // Last sequence
+    *op++ = (unsigned char)offset;
+    *op++ = (unsigned char)(offset >> 8);
+    *token |= (unsigned char)(match < 15 ? match : 15);
+    if (match >= 15) op = put_length(op, match - 15);
+    return op;
+}
+
+static size_t lz_bound(size_t length) {
+    return length + length / 255 + 16;
+}
+
+static ssize_t lz_compress(const char *src, size_t length, char *dst, size_t capacity) {
+    if (capacity < lz_bound(length)) return -1;
+    const unsigned char *base = (const unsigned char *)src, *end = base + length;
+    const unsigned char *ip = base, *anchor = base;
+    unsigned char *op = (unsigned char *)dst;
+    uint32_t table[1 << LZ_HASH_BITS] = { 0 }; // Offset + 1 of the last position with each hash, 0 for none
+    while (end - ip >= LZ_MIN_MATCH) {
+        uint32_t sequence = read32(ip);
+        uint32_t *slot = &table[lz_hash(sequence)];
+        const unsigned char *ref = *slot ? base + *slot - 1 : NULL;
+        *slot = (uint32_t)(ip - base) + 1;
+        if (!ref || ip - ref > LZ_MAX_OFFSET || read32(ref) != sequence) {
+            ip++;
+            continue;
+        }
+        const unsigned char *match_end = ip + LZ_MIN_MATCH;
+        while (match_end < end && *match_end == ref[match_end - ip]) match_end++;
+        op = put_sequence(op, anchor, ip - anchor, ip - ref, match_end - ip - LZ_MIN_MATCH);
+        ip = anchor = match_end;
+    }
+    op = put_sequence(op, anchor, end - anchor, 0, 0);
+    return (ssize_t)(op - (unsigned char *)dst);
+}
+
+static ssize_t lz_decompress(const char *src, size_t length, char *dst, size_t capacity) {
+    const unsigned char *ip = (const unsigned char *)src, *end = ip + length;
+    unsigned char *op = (unsigned char *)dst, *out_end = op + capacity;
+    while (ip < end) {
+        unsigned token = *ip++;
+        size_t count = token >> 4;
+        if (count == 15 && get_length(&ip, end, &count) != 0) return -1;
+        if (count > (size_t)(end - ip) || count > (size_t)(out_end - op)) return -1;
+        memcpy(op, ip, count);
+        op += count;
+        ip += count;
+        if (ip == end) break; // The last sequence has no match
+        if (end - ip < 2) return -1;
+        size_t offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t match = token & 15;
+        if (match == 15 && get_length(&ip, end, &match) != 0) return -1;
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - (unsigned char *)dst) || match > (size_t)(out_end - op)) return -1;
+        const unsigned char *ref = op - offset;
+        if (offset >= match) {
+            memcpy(op, ref, match);
+            op += match;
+        } else {
+            while (match--) *op++ = *ref++; // Overlapping copy repeats the last offset bytes
+        }
+    }
+    return (ssize_t)(op - (unsigned char *)dst);
+}
+
+const struct codec lz_codec = { "lz", 1, lz_bound, lz_compress, lz_decompress };
+
+static const struct codec *const codecs[] = { &lz_codec };
+
+const struct codec *codec_find(const char *name) {
+    for (size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+        if (strcmp(codecs[i]->name, name) == 0) return codecs[i];
+    }
+    return NULL;
+}
+
+const struct codec *codec_by_id(uint32_t id) {
+    for (size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+        if (codecs[i]->id == id) return codecs[i];
+    }
+    return NULL;
+}
@@ -0,0 +1,34 @@
+#ifndef CODEC_H
+#define CODEC_H
+// codec.h
+// Block codecs used to compress sealed log segments (see segment.h). A codec turns one block of at most
+// SEGMENT_BLOCK bytes into a self-contained compressed block, so segments can be decompressed as a stream.
+// Every compressed segment records the id of its codec, which therefore must never change once assigned.
+// The bundled codec "lz" is a byte-oriented LZ77 variant in the spirit of LZ4: fast to compress, faster to
+// decompress, and good at the highly repetitive text the server usually logs.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+struct codec {
+    const char *name; // Selected with -Z name
+    uint32_t id; // Stored in the header of every compressed segment
+    size_t (*bound)(size_t length); // Largest output of compress() for length input bytes
+    // Compress length bytes of src into dst; returns the compressed size, or -1 if dst is too small
+    ssize_t (*compress)(const char *src, size_t length, char *dst, size_t capacity);
+    // Decompress a whole block; returns the decompressed size, or -1 if the block is corrupt or too large
+    ssize_t (*decompress)(const char *src, size_t length, char *dst, size_t capacity);
+};
+
+extern const struct codec lz_codec;
+
+// Function to look up a codec by the name given on the command line
+// Returns: The codec, or NULL if there is none of that name.
+const struct codec *codec_find(const char *name);
+
+// Function to look up the codec of a compressed segment
+// Returns: The codec, or NULL if the id is unknown.
+const struct codec *codec_by_id(uint32_t id);
+
+#endif // CODEC_H
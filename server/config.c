@@ -0,0 +1,300 @@
+#include "config.h"
+#include <ctype.h>
+#include "socket.h"
+#include "ratelimit.h"
+#include "segment.h"
+#include "memacct.h"
+#include "record_log.h"
+#include "metrics.h"
+
+struct server_options server_options = { .port = MY_PORT };
+sig_atomic_t reload_requested = 0;
+
+enum config_type {
+    CONFIG_FLAG,
+    CONFIG_NUMBER,
+    CONFIG_TEXT,
+};
+
+struct config_key {
+    const char *name; // Key in the configuration file
+    int opt; // Command-line option of the same setting
+    enum config_type type;
+    double min, max; // Range of a number
+    bool reloadable; // Applied again on SIGHUP
+};
+
+static const struct config_key keys[] = {
+    { "daemon", 'd', CONFIG_FLAG, 0, 0, false },
+    { "persistent", 'p', CONFIG_FLAG, 0, 0, false },
+    { "dedup", 'e', CONFIG_FLAG, 0, 0, false },
+    { "port", 'P', CONFIG_NUMBER, 1, 65535, false },
+    { "backlog", 'B', CONFIG_NUMBER, 1, 65535, false },
+    { "data_file", 'D', CONFIG_TEXT, 0, 0, false },
+    { "unix_socket", 'u', CONFIG_TEXT, 0, 0, false },
+    { "stats_socket", 's', CONFIG_TEXT, 0, 0, false },
+    { "shm_ring", 'm', CONFIG_TEXT, 0, 0, false },
+    { "log_sink", 'l', CONFIG_TEXT, 0, 0, false },
+    { "local_namespace", 'n', CONFIG_TEXT, 0, 0, false },
+    { "namespaces", 'N', CONFIG_NUMBER, 0, 1e6, false },
+    { "replication_socket", 'x', CONFIG_TEXT, 0, 0, false },
+    { "primary", 'X', CONFIG_TEXT, 0, 0, false },
+    { "segment_size", 'z', CONFIG_NUMBER, 0, 1e15, false },
+    { "segment_codec", 'Z', CONFIG_TEXT, 0, 0, false },
+    { "capture", 'C', CONFIG_TEXT, 0, 0, false },
+    { "log_level", 'L', CONFIG_TEXT, 0, 0, true },
+    { "fsync", 'f', CONFIG_TEXT, 0, 0, true },
+    { "idle_timeout", 'i', CONFIG_NUMBER, 0, 1e7, true }, // Seconds
+    { "request_timeout", 'T', CONFIG_NUMBER, 0, 1e7, true }, // Seconds
+    { "records_per_second", 'r', CONFIG_NUMBER, 0, 1e12, true },
+    { "bytes_per_second", 'b', CONFIG_NUMBER, 0, 1e15, true },
+    { "max_connections", 'c', CONFIG_NUMBER, 0, 1e6, true },
+    { "memory_budget", 'M', CONFIG_NUMBER, 0, 1e15, true }, // Bytes
+    { "buffer_size", 'S', CONFIG_NUMBER, 64, 1 << 20, true }, // Bytes per recv() of newline framing
+    { "timestamp_interval", 't', CONFIG_NUMBER, 1, 86400, true }, // Seconds
+};
+#define CONFIG_KEYS (sizeof(keys) / sizeof(keys[0]))
+
+static bool overridden[CONFIG_KEYS]; // Set on the command line, the file does not change it
+static char *loaded[CONFIG_KEYS]; // Value from the file that is in effect, NULL if the file does not set it
+static char *loaded_path; // Absolute path of the file, NULL if none was loaded
+
+static int key_by_name(const char *name) {
+    for (size_t i = 0; i < CONFIG_KEYS; i++) {
+        if (strcmp(keys[i].name, name) == 0) return (int)i;
+    }
+    return -1;
+}
+
+static int key_by_opt(int opt) {
+    for (size_t i = 0; i < CONFIG_KEYS; i++) {
+        if (keys[i].opt == opt) return (int)i;
+    }
+    return -1;
+}
+
+static int parse_flag(const char *value, bool *flag) {
+    if (!value) { // A flag on the command line
+        *flag = true;
+        return 0;
+    }
+    static const char *const yes[] = { "yes", "true", "on", "1" }, *const no[] = { "no", "false", "off", "0" };
+    for (size_t i = 0; i < sizeof(yes) / sizeof(yes[0]); i++) {
+        if (strcmp(value, yes[i]) == 0 || strcmp(value, no[i]) == 0) {
+            *flag = strcmp(value, yes[i]) == 0;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Check a value without applying it
+// Returns: 0 if the value is valid for the key, with numbers and flags parsed into number and flag.
+static int check(const struct config_key *key, const char *value, double *number, bool *flag) {
+    if (key->type == CONFIG_FLAG) return parse_flag(value, flag);
+    if (!value || *value == '\0') return -1;
+    if (key->type == CONFIG_NUMBER) {
+        char *end;
+        errno = 0;
+        *number = strtod(value, &end);
+        return *end == '\0' && errno == 0 && *number >= key->min && *number <= key->max ? 0 : -1;
+    }
+    if (key->opt == 'f') return strcmp(value, "always") == 0 || strcmp(value, "never") == 0 ? 0 : -1;
+    if (key->opt == 'L') return strcmp(value, "error") && strcmp(value, "sys") && strcmp(value, "debug") ? -1 : 0;
+    if (key->opt == 'D') { // The logs named after it and their segment names fit
+        return strlen(value) + NAMESPACE_SUFFIX_MAX + SEGMENT_SUFFIX_MAX <= SEGMENT_PATH_MAX ? 0 : -1;
+    }
+    if (key->opt == 'Z') return strcmp(value, "none") == 0 || codec_find(value) ? 0 : -1;
+    return 0;
+}
+
+// Copy of a string setting; values read from the file do not outlive the reading
+static const char *keep(const char *value) {
+    char *copy = strdup(value);
+    if (!copy) LOG_ERR("Failed to allocate memory for a setting: %s", strerror(errno));
+    return copy;
+}
+
+// Apply a checked value to the setting of a key
+static void apply(const struct config_key *key, const char *value) {
+    double n = 0;
+    bool flag = false;
+    check(key, value, &n, &flag);
+    int opt = key->opt;
+    if (opt == 'd') server_options.run_as_daemon = flag;
+    if (opt == 'p') persistent_log = flag;
+    if (opt == 'e') record_log_dedup = flag; // Store repeats of recent records as back-references
+    if (opt == 'P') server_options.port = (int)n;
+    if (opt == 'B') listen_backlog = (int)n;
+    if (opt == 'D') server_options.data_file = keep(value); // Text log of the default namespace, names the others
+    if (opt == 'u') server_options.unix_path = keep(value);
+    if (opt == 's') server_options.stats_path = keep(value);
+    if (opt == 'm') server_options.ring_name = keep(value);
+    if (opt == 'l') server_options.log_sink = keep(value);
+    if (opt == 'n') server_options.local_namespace = keep(value); // Namespace of local clients and the ring
+    if (opt == 'N') namespace_limit = (unsigned)n; // Route records by "@name " prefix
+    if (opt == 'x') server_options.replication_path = keep(value); // Serve the replication stream to followers
+    if (opt == 'X') server_options.primary_path = keep(value); // Run as a read-only follower of this primary
+    if (opt == 'z') segment_size = (uint64_t)n; // Seal text logs into segments of this size
+    if (opt == 'Z') segment_codec = strcmp(value, "none") == 0 ? NULL : codec_find(value); // NULL keeps them raw
+    if (opt == 'C') server_options.capture_path = keep(value); // Record an arrival trace for capreplay
+    if (opt == 'L') log_set_level(value);
+    if (opt == 'f') fsync_policy = strcmp(value, "never") == 0 ? FSYNC_NEVER : FSYNC_ALWAYS;
+    if (opt == 'i') idle_timeout_ms = (uint64_t)(n * 1000);
+    if (opt == 'T') request_timeout_ms = (uint64_t)(n * 1000);
+    if (opt == 'r') ratelimit_config.records_per_second = n; // Per client address
+    if (opt == 'b') ratelimit_config.bytes_per_second = n;
+    if (opt == 'c') ratelimit_config.max_connections = (unsigned)n; // Counts connections accepted since it was set
+    if (opt == 'M') memacct_budget = (uint64_t)n; // Bytes of in-flight receive buffers
+    if (opt == 'S') recv_buffer_size = (size_t)n; // Used by connections accepted from now on
+    if (opt == 't') timestamp_interval_s = (unsigned)n; // From the next timestamp on
+}
+
+void config_usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-F file] [-R] [options]\n", name);
+    fprintf(stderr, "  -F file  configuration file, the command line takes precedence\n");
+    fprintf(stderr, "  -R       take the listeners over from the running instance\n");
+    for (size_t i = 0; i < CONFIG_KEYS; i++) {
+        const struct config_key *key = &keys[i];
+        if (key->type == CONFIG_FLAG) fprintf(stderr, "  -%c       %s\n", key->opt, key->name);
+        else fprintf(stderr, "  -%c value %s%s\n", key->opt, key->name, key->reloadable ? " (reloadable)" : "");
+    }
+}
+
+int config_option(int opt, const char *value) {
+    if (opt == 'R') { // Hot restart: take the listeners of the running instance
+        server_options.take_over = true;
+        return 0;
+    }
+    int i = key_by_opt(opt);
+    double n;
+    bool flag;
+    if (i < 0) return -1;
+    if (check(&keys[i], value, &n, &flag) != 0) {
+        LOG_ERR("Invalid value for -%c (%s): %s", opt, keys[i].name, value ? value : "");
+        return -1;
+    }
+    apply(&keys[i], value);
+    overridden[i] = true;
+    ratelimit_publish();
+    return 0;
+}
+
+static char *trim(char *text) {
+    while (isspace((unsigned char)*text)) text++;
+    char *end = text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return text;
+}
+
+// Read and check a whole configuration file
+// Parameters:
+// - path: The file.
+// - values: Filled with a copy of the value of every key the file sets; the last line setting a key wins.
+// Returns: 0 on success, -1 if the file cannot be read or any line is invalid. Every error is logged.
+static int read_file(const char *path, char *values[CONFIG_KEYS]) {
+    FILE *file = fopen(path, "re");
+    if (!file) {
+        LOG_ERR("Failed to open configuration file %s: %s", path, strerror(errno));
+        return -1;
+    }
+    char line[CONFIG_LINE_MAX];
+    int number = 0, result = 0;
+    while (fgets(line, sizeof(line), file)) {
+        number++;
+        if (!strchr(line, '\n') && !feof(file)) {
+            LOG_ERR("%s:%d: line longer than %d bytes", path, number, CONFIG_LINE_MAX - 1);
+            result = -1;
+            break;
+        }
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        char *name = trim(line);
+        if (*name == '\0') continue;
+        char *equals = strchr(name, '=');
+        if (!equals) {
+            LOG_ERR("%s:%d: expected key = value", path, number);
+            result = -1;
+            continue;
+        }
+        *equals = '\0';
+        name = trim(name);
+        char *value = trim(equals + 1);
+        int i = key_by_name(name);
+        double n;
+        bool flag;
+        if (i < 0) {
+            LOG_ERR("%s:%d: unknown key %s", path, number, name);
+            result = -1;
+        } else if (check(&keys[i], value, &n, &flag) != 0) {
+            LOG_ERR("%s:%d: invalid value for %s: %s", path, number, name, value);
+            result = -1;
+        } else {
+            free(values[i]);
+            if (!(values[i] = strdup(value))) result = -1;
+        }
+    }
+    if (ferror(file)) {
+        LOG_ERR("Failed to read configuration file %s: %s", path, strerror(errno));
+        result = -1;
+    }
+    fclose(file);
+    return result;
+}
+
+static void free_values(char *values[CONFIG_KEYS]) {
+    for (size_t i = 0; i < CONFIG_KEYS; i++) free(values[i]);
+}
+
+int config_load(const char *path) {
+    char *values[CONFIG_KEYS] = { NULL };
+    if (read_file(path, values) != 0 || !(loaded_path = realpath(path, NULL))) { // daemonize() changes to /
+        free_values(values);
+        return -1;
+    }
+    for (size_t i = 0; i < CONFIG_KEYS; i++) {
+        if (values[i] && !overridden[i]) apply(&keys[i], values[i]);
+        loaded[i] = values[i];
+    }
+    ratelimit_publish();
+    LOG_SYS("Loaded configuration file %s", loaded_path);
+    return 0;
+}
+
+void config_reload(void) {
+    if (!loaded_path) {
+        LOG_SYS("No configuration file to reload, start with -F path");
+        return;
+    }
+    char *values[CONFIG_KEYS] = { NULL };
+    if (read_file(loaded_path, values) != 0) {
+        LOG_ERR("Rejected configuration file %s, keeping the running configuration", loaded_path);
+        free_values(values);
+        return;
+    }
+    unsigned changed = 0;
+    for (size_t i = 0; i < CONFIG_KEYS; i++) {
+        if (!values[i] || (loaded[i] && strcmp(loaded[i], values[i]) == 0)) {
+            free(values[i]);
+            continue;
+        }
+        if (overridden[i]) {
+            LOG_SYS("%s is set on the command line, ignoring the configuration file", keys[i].name);
+            free(values[i]);
+        } else if (!keys[i].reloadable) {
+            // loaded[] keeps the value in effect, so the pending change is reported on every reload
+            LOG_SYS("%s changed to %s, it takes effect at the next start", keys[i].name, values[i]);
+            free(values[i]);
+        } else {
+            apply(&keys[i], values[i]);
+            LOG_SYS("Reloaded %s = %s", keys[i].name, values[i]);
+            free(loaded[i]);
+            loaded[i] = values[i];
+            changed++;
+        }
+    }
+    ratelimit_publish(); // Once all of the file's limits are applied
+    metrics_add(METRIC_CONFIG_RELOADS, 1);
+    LOG_SYS("Reloaded configuration file %s, %u settings changed", loaded_path, changed);
+}
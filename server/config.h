@@ -0,0 +1,61 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+// config.h
+// Server configuration. Every tunable has a key in the configuration file given with -F path and a
+// command-line option; options on the command line override the file. The file holds one "key = value" per
+// line, '#' starts a comment, and flags take yes/no, true/false, on/off or 1/0:
+//   port = 9000
+//   idle_timeout = 30        # seconds
+//   fsync = never
+// On SIGHUP the file is read again and the reloadable keys (timeouts, rate limits, fsync policy, log level,
+// memory budget, receive buffer size and timestamp interval) are applied to the running server; listeners
+// and connections stay open. A file with an error is rejected as a whole, keeping the running configuration.
+// Changes to other keys are logged and take effect at the next start; keys removed from the file keep their
+// value, and command-line options keep precedence over the file across reloads.
+
+#include <stdbool.h>
+#include <signal.h>
+
+#define CONFIG_OPTIONS "dpeRu:m:f:s:l:L:i:T:r:b:c:n:N:x:X:P:z:Z:M:C:B:S:D:t:" // getopt() string, without -F
+#define CONFIG_LINE_MAX 1024
+
+// Settings main() uses once to start the server
+struct server_options {
+    bool run_as_daemon; // daemon (-d)
+    bool take_over; // Take the listeners of the running instance over (-R, command line only)
+    const char *unix_path; // unix_socket (-u)
+    const char *ring_name; // shm_ring (-m)
+    const char *stats_path; // stats_socket (-s)
+    const char *log_sink; // log_sink (-l)
+    const char *local_namespace; // local_namespace (-n)
+    const char *replication_path; // replication_socket (-x)
+    const char *primary_path; // primary (-X)
+    const char *capture_path; // capture (-C)
+    const char *data_file; // data_file (-D), NULL for AESD_SOCKET_FILE or, on a follower, AESD_REPLICA_FILE
+    int port; // port (-P)
+};
+
+extern struct server_options server_options;
+extern sig_atomic_t reload_requested; // Set on SIGHUP, client_handler() reloads the configuration file
+
+// Function to apply a command-line option
+// The setting is marked as overridden, so the configuration file cannot change it.
+// Parameters:
+// - opt: Option character returned by getopt() for CONFIG_OPTIONS.
+// - value: Its argument, NULL for flags.
+// Returns: 0 on success, -1 if the value is invalid (the setting is left unchanged).
+int config_option(int opt, const char *value);
+
+// Function to print the command-line options and their configuration file keys to stderr
+void config_usage(const char *name);
+
+// Function to load the configuration file at startup
+// Every setting of the file that is not overridden on the command line is applied.
+// Returns: 0 on success, -1 if the file cannot be read or holds an error.
+int config_load(const char *path);
+
+// Function to read the configuration file again and apply its reloadable settings
+// Does nothing but log a message if no file was loaded.
+void config_reload(void);
+
+#endif // CONFIG_H
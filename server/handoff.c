@@ -0,0 +1,211 @@
+#include "handoff.h"
+#include "socket.h"
+
+static pthread_mutex_t owner_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t owner_cond = PTHREAD_COND_INITIALIZER; // Signaled when the takeover ends
+static atomic_bool log_owned = true; // False until the previous instance has released the log
+static bool take_failed; // The log was released but could not be opened, under owner_mutex
+static pthread_t take_thread;
+static bool taking; // take_thread was started
+static int take_control = -1;
+static int (*take_function)(void);
+
+struct handoff_message {
+    uint32_t magic; // HANDOFF_MAGIC
+    int32_t present[HANDOFF_LISTENERS]; // 1 if the listener is among the passed descriptors, in this order
+};
+
+static int connect_unix(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) return -1;
+    if (connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+int handoff_listen(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) return -1;
+    unlink(path); // Left behind by an instance that did not exit cleanly
+    mode_t mask = umask(077); // Only the owner may take the listeners over
+    int result = bind(sockfd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (result < 0 || listen(sockfd, 1) < 0) {
+        LOG_ERR("Failed to set up handoff socket %s: %s", path, strerror(errno));
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+int handoff_send(int control, const int fds[HANDOFF_LISTENERS]) {
+    struct handoff_message message = { .magic = HANDOFF_MAGIC };
+    int passed[HANDOFF_LISTENERS];
+    int count = 0;
+    for (int i = 0; i < HANDOFF_LISTENERS; i++) {
+        message.present[i] = fds[i] >= 0;
+        if (fds[i] >= 0) passed[count++] = fds[i];
+    }
+    char control_buffer[CMSG_SPACE(sizeof(passed))];
+    memset(control_buffer, 0, sizeof(control_buffer));
+    struct iovec iov = { .iov_base = &message, .iov_len = sizeof(message) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+    if (count > 0) {
+        msg.msg_control = control_buffer;
+        msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), passed, count * sizeof(int));
+    }
+    if (sendmsg(control, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(message)) {
+        LOG_ERR("Failed to hand off listening sockets: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int handoff_request(const char *path, int fds[HANDOFF_LISTENERS]) {
+    for (int i = 0; i < HANDOFF_LISTENERS; i++) fds[i] = -1;
+    int control = connect_unix(path);
+    if (control < 0) return -1; // Nobody to take over from
+    struct handoff_message message;
+    int received[HANDOFF_LISTENERS];
+    char control_buffer[CMSG_SPACE(sizeof(received))];
+    struct iovec iov = { .iov_base = &message, .iov_len = sizeof(message) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control_buffer,
+                          .msg_controllen = sizeof(control_buffer) };
+    ssize_t length;
+    do {
+        length = recvmsg(control, &msg, MSG_CMSG_CLOEXEC);
+    } while (length < 0 && errno == EINTR);
+    int count = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            if (count > HANDOFF_LISTENERS) count = HANDOFF_LISTENERS;
+            memcpy(received, CMSG_DATA(cmsg), count * sizeof(int));
+        }
+    }
+    if (length != (ssize_t)sizeof(message) || message.magic != HANDOFF_MAGIC) {
+        LOG_ERR("Invalid handoff from the running instance");
+        for (int i = 0; i < count; i++) close(received[i]);
+        close(control);
+        return -1;
+    }
+    for (int i = 0, next = 0; i < HANDOFF_LISTENERS && next < count; i++) {
+        if (message.present[i]) fds[i] = received[next++];
+    }
+    return control;
+}
+
+// Listener a socket from the service manager stands for, or -1 if it is none of ours
+static int activation_slot(int fd, const char *name, const char *stats_path) {
+    if (name && strcmp(name, "tcp") == 0) return HANDOFF_TCP;
+    if (name && strcmp(name, "unix") == 0) return HANDOFF_UNIX;
+    if (name && strcmp(name, "stats") == 0) return HANDOFF_STATS;
+    struct sockaddr_un addr; // Large enough for an IPv4 address as well
+    socklen_t length = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    if (getsockname(fd, (struct sockaddr *)&addr, &length) < 0) return -1;
+    if (addr.sun_family == AF_INET) return HANDOFF_TCP; // Clients are IPv4 only, see connection_info
+    if (addr.sun_family != AF_UNIX) return -1;
+    return stats_path && strcmp(addr.sun_path, stats_path) == 0 ? HANDOFF_STATS : HANDOFF_UNIX;
+}
+
+int handoff_activation(int fds[HANDOFF_LISTENERS], const char *stats_path) {
+    for (int i = 0; i < HANDOFF_LISTENERS; i++) fds[i] = -1;
+    const char *pid = getenv("LISTEN_PID"), *count = getenv("LISTEN_FDS");
+    if (!pid || !count || strtol(pid, NULL, 10) != (long)getpid()) return 0; // Meant for another process
+    int passed = atoi(count);
+    char *names = getenv("LISTEN_FDNAMES") ? strdup(getenv("LISTEN_FDNAMES")) : NULL;
+    char *next = names, *name;
+    int taken = 0;
+    for (int fd = LISTEN_FDS_START; fd < LISTEN_FDS_START + passed; fd++) {
+        name = next ? strsep(&next, ":") : NULL;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        int slot = activation_slot(fd, name, stats_path);
+        if (slot < 0 || fds[slot] >= 0) {
+            LOG_ERR("Ignoring socket %d passed by the service manager", fd);
+            close(fd);
+            continue;
+        }
+        fds[slot] = fd;
+        taken++;
+    }
+    free(names);
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+    return taken;
+}
+
+void handoff_wait(int control) {
+    char byte;
+    for (;;) {
+        ssize_t received = recv(control, &byte, 1, 0); // The previous instance never sends, only exits
+        if (received == 0 || (received < 0 && errno != EINTR)) break;
+    }
+    close(control);
+}
+
+static void *take_log(void *arg) {
+    (void)arg;
+    handoff_wait(take_control);
+    int result = take_function();
+    pthread_mutex_lock(&owner_mutex);
+    if (result == 0) atomic_store(&log_owned, true);
+    else {
+        take_failed = true;
+        exit_requested = 1; // Connections waiting for the log give up, the accept loop ends
+    }
+    pthread_cond_broadcast(&owner_cond);
+    pthread_mutex_unlock(&owner_mutex);
+    return NULL;
+}
+
+int handoff_take_log(int control, int (*take)(void)) {
+    take_control = control;
+    take_function = take;
+    atomic_store(&log_owned, false);
+    if (pthread_create(&take_thread, NULL, take_log, NULL) != 0) {
+        atomic_store(&log_owned, true);
+        return -1;
+    }
+    taking = true;
+    return 0;
+}
+
+bool handoff_log_wait(void) {
+    if (atomic_load(&log_owned)) return true;
+    pthread_mutex_lock(&owner_mutex);
+    while (!atomic_load(&log_owned) && !take_failed && !exit_requested) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += 1; // exit_requested is set by a signal handler, which cannot signal owner_cond
+        pthread_cond_timedwait(&owner_cond, &owner_mutex, &until);
+    }
+    pthread_mutex_unlock(&owner_mutex);
+    return atomic_load(&log_owned);
+}
+
+bool handoff_log_taken(void) {
+    if (taking) {
+        pthread_join(take_thread, NULL);
+        taking = false;
+    }
+    return atomic_load(&log_owned);
+}
@@ -0,0 +1,79 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+// handoff.h
+// Hot restart of the AESD socket server. A running server listens on AESD_HANDOFF_SOCKET; a new instance
+// started with -R connects to it and receives the listening sockets over SCM_RIGHTS, so the listeners
+// never close. The new instance accepts connections right away, while the old one stops accepting, drains
+// its connections for up to HANDOFF_DRAIN_MS, shuts down those still open and exits. Its exit closes the
+// handoff connection, which tells the new instance that the log is no longer written: until then the new
+// instance's connections and writers wait in handoff_log_wait(), with their data queued in the sockets.
+// The same listeners can also be opened by a service manager and passed at exec (socket activation, see
+// handoff_activation()); the service manager then keeps them across restarts itself.
+
+#include <stdbool.h>
+
+#define AESD_HANDOFF_SOCKET "/var/tmp/aesdsocket.handoff"
+#define HANDOFF_MAGIC 0x46484441u // "ADHF" in little endian
+#define LISTEN_FDS_START 3 // First descriptor passed by a service manager
+#define HANDOFF_DRAIN_MS 5000 // Time the old instance gives its connections to end after a handoff
+
+enum handoff_listener {
+    HANDOFF_TCP, // Port MY_PORT
+    HANDOFF_UNIX, // Local listener (-u)
+    HANDOFF_STATS, // Stats socket (-s)
+    HANDOFF_LISTENERS
+};
+
+// Function to create the handoff socket of the running instance
+// Returns: The listening socket, or -1 on failure.
+int handoff_listen(const char *path);
+
+// Function to pass the listening sockets to a new instance
+// Parameters:
+// - control: Accepted connection from the handoff socket.
+// - fds: Listening sockets indexed by enum handoff_listener, -1 for those not in use.
+// Returns: 0 on success, -1 on failure.
+// Note: The caller keeps control open until it has drained and released the log; exiting closes it.
+int handoff_send(int control, const int fds[HANDOFF_LISTENERS]);
+
+// Function to request the listening sockets from the running instance
+// Parameters:
+// - path: Handoff socket of the running instance.
+// - fds: Receives the listening sockets indexed by enum handoff_listener, -1 for those not passed.
+// Returns: The control connection to wait on with handoff_wait(), or -1 if no instance handed off.
+int handoff_request(const char *path, int fds[HANDOFF_LISTENERS]);
+
+// Function to take the listening sockets passed by the service manager (LISTEN_FDS/LISTEN_PID convention)
+// Parameters:
+// - fds: Receives the listening sockets indexed by enum handoff_listener, -1 for those not passed.
+// - stats_path: Path of the stats socket (-s), to tell it from the local listener if the sockets are not named.
+// Returns: The number of sockets taken, 0 if the process was not socket activated.
+// Note: Sockets named "tcp", "unix" or "stats" in LISTEN_FDNAMES go to that listener; others are assigned by
+// address family. The variables are unset so they do not leak into child processes.
+int handoff_activation(int fds[HANDOFF_LISTENERS], const char *stats_path);
+
+// Function to wait until the previous instance has exited
+// This function blocks until the control connection is closed by the previous instance, then closes it.
+void handoff_wait(int control);
+
+// Function to take the log over in the background
+// This function starts a thread that waits with handoff_wait() for the previous instance to release the log,
+// then calls take() and lets handoff_log_wait() return.
+// Parameters:
+// - control: Control connection returned by handoff_request().
+// - take: Opens the logs; returns 0 on success, or -1 to request the server's exit.
+// Returns: 0 on success, -1 if the thread cannot be started.
+int handoff_take_log(int control, int (*take)(void));
+
+// Function to wait until this instance owns the log
+// Called before anything writes or streams the log; returns at once unless a takeover is in progress.
+// Returns: true once the log is owned, false if the server exits first.
+bool handoff_log_wait(void);
+
+// Function to finish a takeover before the server exits
+// This function waits for the thread started by handoff_take_log(), which may still wait for the previous
+// instance.
+// Returns: true if the log is owned, false if the takeover failed and the log is not this instance's to clean.
+bool handoff_log_taken(void);
+
+#endif // HANDOFF_H
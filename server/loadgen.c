@@ -0,0 +1,296 @@
+// loadgen.c
+// Load generator and latency benchmark for aesdsocket.
+// Every worker thread keeps one session in flight: connect, send one record, read the replay to EOF and check
+// that it contains the record. Each session is split into three phases:
+// - connect: socket creation until connect() returns,
+// - append-ack: first byte sent until the first replay byte arrives, which the server only sends after the
+//   record has been appended and synced,
+// - replay: first replay byte until EOF.
+// Usage: loadgen [-H host] [-p port] [-u unix_path] [-c connections] [-n sessions_per_connection]
+//                [-s record_size] [-r sessions_per_second] [-b] [-j]
+// -b uses length-prefixed framing, -j prints a single JSON object for regression tracking.
+
+#define _GNU_SOURCE // memmem()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "bench/bench.h"
+
+#define LOG_ERR(fmt, ...) fprintf(stderr, "[ERROR]: " fmt "\n", ##__VA_ARGS__)
+
+enum phase { PHASE_CONNECT, PHASE_APPEND, PHASE_REPLAY, PHASE_TOTAL, PHASES };
+static const char *phase_names[PHASES] = { "connect", "append_ack", "replay", "total" };
+
+struct options {
+    const char *host;
+    int port;
+    const char *unix_path;
+    int connections;
+    long sessions;
+    size_t record_size;
+    double rate; // Sessions per second over all workers, 0 for closed loop
+    bool binary;
+    bool json;
+};
+
+struct worker {
+    pthread_t thread;
+    int id;
+    const struct options *options;
+    double *samples[PHASES]; // Latencies in microseconds, one per completed session
+    long completed;
+    long failed;
+    long mismatched; // Replays that did not contain the record
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+};
+
+static void sleep_until(double when) {
+    double delay = when - now_sec();
+    if (delay <= 0) return;
+    struct timespec ts = { .tv_sec = (time_t)delay, .tv_nsec = (long)((delay - (time_t)delay) * 1e9) };
+    nanosleep(&ts, NULL);
+}
+
+static int connect_server(const struct options *options) {
+    int fd;
+    if (options->unix_path) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        strncpy(addr.sun_path, options->unix_path, sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) return fd;
+    } else {
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(options->port) };
+        inet_pton(AF_INET, options->host, &addr.sin_addr);
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int one = 1;
+        if (fd >= 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) return fd;
+    }
+    if (fd >= 0) close(fd);
+    return -1;
+}
+
+static int send_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return 0;
+}
+
+// Build a unique newline terminated record: "w<worker>-s<session>-" padded with filler up to size bytes
+static size_t make_record(char *record, size_t size, int worker, long session) {
+    int n = snprintf(record, size, "w%d-s%ld-", worker, session);
+    size_t length = (size_t)n < size ? (size_t)n : size - 1;
+    for (; length < size - 1; length++) record[length] = 'a' + length % 26;
+    record[length++] = '\n';
+    return length;
+}
+
+static int run_session(struct worker *w, long session, char *record, char **replay, size_t *replay_capacity,
+                       double *phase) {
+    const struct options *options = w->options;
+    size_t length = make_record(record, options->record_size, w->id, session);
+
+    double start = now_sec();
+    int fd = connect_server(options);
+    if (fd < 0) return -1;
+    double connected = now_sec();
+
+    int ret = 0;
+    if (options->binary) {
+        uint32_t header = htonl((uint32_t)length), end = 0;
+        ret = send_all(fd, "\0LP1", 4) || send_all(fd, (const char *)&header, 4) || send_all(fd, record, length) ||
+              send_all(fd, (const char *)&end, 4);
+    } else {
+        ret = send_all(fd, record, length);
+    }
+    if (ret != 0) {
+        close(fd);
+        return -1;
+    }
+    w->bytes_sent += length;
+
+    double first_byte = 0;
+    size_t received = 0;
+    for (;;) {
+        if (received == *replay_capacity) {
+            size_t capacity = *replay_capacity ? *replay_capacity * 2 : 65536;
+            char *grown = realloc(*replay, capacity);
+            if (!grown) {
+                close(fd);
+                return -1;
+            }
+            *replay = grown;
+            *replay_capacity = capacity;
+        }
+        ssize_t got = recv(fd, *replay + received, *replay_capacity - received, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            close(fd);
+            return -1;
+        }
+        if (got == 0) break;
+        if (received == 0) first_byte = now_sec();
+        received += got;
+    }
+    double done = now_sec();
+    close(fd);
+    w->bytes_received += received;
+    if (received == 0) return -1;
+    if (!memmem(*replay, received, record, length)) w->mismatched++;
+
+    phase[PHASE_CONNECT] = (connected - start) * 1e6;
+    phase[PHASE_APPEND] = (first_byte - connected) * 1e6;
+    phase[PHASE_REPLAY] = (done - first_byte) * 1e6;
+    phase[PHASE_TOTAL] = (done - start) * 1e6;
+    return 0;
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = (struct worker *)arg;
+    const struct options *options = w->options;
+    char *record = malloc(options->record_size + 64);
+    char *replay = NULL;
+    size_t replay_capacity = 0;
+    if (!record) return NULL;
+    // Open loop pacing: every worker owns an equal share of the target rate, with staggered start times
+    double interval = options->rate > 0 ? options->connections / options->rate : 0;
+    double next = now_sec() + interval * w->id / options->connections;
+    for (long session = 0; session < options->sessions; session++) {
+        if (interval > 0) {
+            sleep_until(next);
+            next += interval;
+        }
+        double phase[PHASES];
+        if (run_session(w, session, record, &replay, &replay_capacity, phase) != 0) {
+            w->failed++;
+            continue;
+        }
+        for (int p = 0; p < PHASES; p++) w->samples[p][w->completed] = phase[p];
+        w->completed++;
+    }
+    free(record);
+    free(replay);
+    return NULL;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-H host] [-p port] [-u unix_path] [-c connections] [-n sessions_per_connection]\n"
+                    "       [-s record_size] [-r sessions_per_second] [-b] [-j]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    struct options options = {
+        .host = "127.0.0.1", .port = 9000, .connections = 4, .sessions = 250, .record_size = 64,
+    };
+    int opt;
+    while ((opt = getopt(argc, argv, "H:p:u:c:n:s:r:bj")) != -1) {
+        switch (opt) {
+        case 'H': options.host = optarg; break;
+        case 'p': options.port = atoi(optarg); break;
+        case 'u': options.unix_path = optarg; break;
+        case 'c': options.connections = atoi(optarg); break;
+        case 'n': options.sessions = atol(optarg); break;
+        case 's': options.record_size = strtoull(optarg, NULL, 0); break;
+        case 'r': options.rate = atof(optarg); break;
+        case 'b': options.binary = true; break;
+        case 'j': options.json = true; break;
+        default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (options.connections < 1 || options.sessions < 1 || options.record_size < 16) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct worker *workers = calloc(options.connections, sizeof(*workers));
+    if (!workers) return EXIT_FAILURE;
+    double begin = now_sec();
+    for (int i = 0; i < options.connections; i++) {
+        workers[i].id = i;
+        workers[i].options = &options;
+        for (int p = 0; p < PHASES; p++) {
+            workers[i].samples[p] = malloc(options.sessions * sizeof(double));
+            if (!workers[i].samples[p]) return EXIT_FAILURE;
+        }
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+            LOG_ERR("Failed to start worker %d", i);
+            return EXIT_FAILURE;
+        }
+    }
+    long completed = 0, failed = 0, mismatched = 0;
+    uint64_t sent = 0, received = 0;
+    for (int i = 0; i < options.connections; i++) {
+        pthread_join(workers[i].thread, NULL);
+        completed += workers[i].completed;
+        failed += workers[i].failed;
+        mismatched += workers[i].mismatched;
+        sent += workers[i].bytes_sent;
+        received += workers[i].bytes_received;
+    }
+    double elapsed = now_sec() - begin;
+
+    double *merged = malloc((completed ? completed : 1) * sizeof(double));
+    if (!merged) return EXIT_FAILURE;
+    double stats[PHASES][4]; // p50, p99, p999, max
+    for (int p = 0; p < PHASES; p++) {
+        long n = 0;
+        for (int i = 0; i < options.connections; i++) {
+            memcpy(merged + n, workers[i].samples[p], workers[i].completed * sizeof(double));
+            n += workers[i].completed;
+        }
+        qsort(merged, n, sizeof(double), cmp_double);
+        stats[p][0] = percentile(merged, n, 0.50);
+        stats[p][1] = percentile(merged, n, 0.99);
+        stats[p][2] = percentile(merged, n, 0.999);
+        stats[p][3] = n ? merged[n - 1] : 0;
+    }
+
+    if (options.json) {
+        printf("{\"transport\":\"%s\",\"framing\":\"%s\",\"connections\":%d,\"record_size\":%zu,"
+               "\"target_rate\":%.1f,\"elapsed_s\":%.6f,\"sessions\":%ld,\"failed\":%ld,\"mismatched\":%ld,"
+               "\"sessions_per_s\":%.1f,\"bytes_sent\":%llu,\"bytes_received\":%llu,\"latency_us\":{",
+               options.unix_path ? "unix" : "tcp", options.binary ? "length" : "newline", options.connections,
+               options.record_size, options.rate, elapsed, completed, failed, mismatched, completed / elapsed,
+               (unsigned long long)sent, (unsigned long long)received);
+        for (int p = 0; p < PHASES; p++) {
+            printf("%s\"%s\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}", p ? "," : "", phase_names[p],
+                   stats[p][0], stats[p][1], stats[p][2], stats[p][3]);
+        }
+        printf("}}\n");
+    } else {
+        printf("%ld sessions in %.3f s (%.1f sessions/s), %ld failed, %ld replay mismatches\n", completed, elapsed,
+               completed / elapsed, failed, mismatched);
+        printf("sent %.2f MB, received %.2f MB\n", sent / 1e6, received / 1e6);
+        printf("%-12s %12s %12s %12s %12s\n", "phase (us)", "p50", "p99", "p999", "max");
+        for (int p = 0; p < PHASES; p++) {
+            printf("%-12s %12.1f %12.1f %12.1f %12.1f\n", phase_names[p], stats[p][0], stats[p][1], stats[p][2],
+                   stats[p][3]);
+        }
+    }
+
+    free(merged);
+    for (int i = 0; i < options.connections; i++) {
+        for (int p = 0; p < PHASES; p++) free(workers[i].samples[p]);
+    }
+    free(workers);
+    return (failed || mismatched) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
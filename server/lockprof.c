@@ -0,0 +1,86 @@
+#include "lockprof.h"
+#include <errno.h>
+#include <string.h>
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct prof_mutex *registry = NULL;
+
+uint64_t prof_mutex_lock_at(struct prof_mutex *m, const char *site) {
+    uint64_t wait = 0;
+    if (pthread_mutex_trylock(&m->mutex) == EBUSY) {
+        uint64_t start = metrics_now();
+        pthread_mutex_lock(&m->mutex);
+        m->acquired_at = metrics_now();
+        wait = m->acquired_at - start;
+        m->contended++;
+        m->wait_total += wait;
+    } else {
+        m->acquired_at = metrics_now();
+    }
+    m->acquisitions++;
+    m->wait_buckets[metrics_bucket(wait)]++;
+    m->holder = site;
+    if (!m->registered) {
+        m->registered = 1;
+        pthread_mutex_lock(&registry_mutex);
+        m->next = registry;
+        registry = m;
+        pthread_mutex_unlock(&registry_mutex);
+    }
+    return wait;
+}
+
+uint64_t prof_mutex_unlock(struct prof_mutex *m) {
+    uint64_t hold = metrics_now() - m->acquired_at;
+    m->hold_total += hold;
+    m->hold_buckets[metrics_bucket(hold)]++;
+    if (hold > m->longest_hold) {
+        m->longest_hold = hold;
+        m->longest_holder = m->holder;
+    }
+    pthread_mutex_unlock(&m->mutex);
+    return hold;
+}
+
+// Upper bound of the bucket holding the q-th quantile, in nanoseconds
+static uint64_t quantile(const uint64_t *buckets, uint64_t count, double q) {
+    uint64_t rank = (uint64_t)(q * count);
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < METRIC_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen > rank) return metrics_bucket_limit(i);
+    }
+    return 0;
+}
+
+static uint64_t highest(const uint64_t *buckets) {
+    for (unsigned i = METRIC_BUCKETS; i-- > 0;) {
+        if (buckets[i]) return metrics_bucket_limit(i);
+    }
+    return 0;
+}
+
+void prof_mutex_report(FILE *out) {
+    static uint64_t wait[METRIC_BUCKETS], hold[METRIC_BUCKETS]; // Only used under registry_mutex
+    pthread_mutex_lock(&registry_mutex);
+    for (struct prof_mutex *m = registry; m; m = m->next) {
+        // Take a consistent copy; the mutex is released before printing
+        pthread_mutex_lock(&m->mutex);
+        uint64_t acquisitions = m->acquisitions, contended = m->contended;
+        uint64_t wait_total = m->wait_total, hold_total = m->hold_total, longest_hold = m->longest_hold;
+        const char *longest_holder = m->longest_holder;
+        memcpy(wait, m->wait_buckets, sizeof(wait));
+        memcpy(hold, m->hold_buckets, sizeof(hold));
+        pthread_mutex_unlock(&m->mutex);
+        fprintf(out, "lock %s: %llu acquisitions, %llu contended (%.1f%%)\n", m->name,
+                (unsigned long long)acquisitions, (unsigned long long)contended,
+                acquisitions ? 100.0 * contended / acquisitions : 0.0);
+        fprintf(out, "  wait: total %.3f ms, p50 < %.1f us, p99 < %.1f us, max < %.1f us\n", wait_total / 1e6,
+                quantile(wait, acquisitions, 0.5) / 1e3, quantile(wait, acquisitions, 0.99) / 1e3, highest(wait) / 1e3);
+        fprintf(out, "  hold: total %.3f ms, p50 < %.1f us, p99 < %.1f us, max %.1f us at %s\n", hold_total / 1e6,
+                quantile(hold, acquisitions, 0.5) / 1e3, quantile(hold, acquisitions, 0.99) / 1e3,
+                longest_hold / 1e3, longest_holder ? longest_holder : "-");
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    fflush(out);
+}
@@ -0,0 +1,57 @@
+#ifndef LOCKPROF_H
+#define LOCKPROF_H
+// lockprof.h
+// Contention profiler for the server's mutexes. A prof_mutex is a pthread mutex that counts acquisitions
+// and contended acquisitions, keeps wait and hold time histograms and remembers the call site that held
+// it longest. All statistics are updated while the mutex is held, so profiling adds no shared writes of
+// its own: an uncontended lock/unlock pair costs two clock reads on top of the mutex.
+// prof_mutex_report() prints every mutex that has been used; the server calls it on shutdown and on SIGUSR2.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "metrics.h"
+
+#define PROF_STRINGIFY_(x) #x
+#define PROF_STRINGIFY(x) PROF_STRINGIFY_(x)
+#define PROF_SITE __FILE__ ":" PROF_STRINGIFY(__LINE__) // Call site recorded by the lock macros
+
+struct prof_mutex {
+    pthread_mutex_t mutex;
+    const char *name; // Name used in the report
+    // Everything below is only written by the thread holding mutex
+    uint64_t acquisitions;
+    uint64_t contended; // Acquisitions that had to wait
+    uint64_t wait_total; // Nanoseconds
+    uint64_t hold_total; // Nanoseconds
+    uint64_t acquired_at; // metrics_now() of the current acquisition
+    const char *holder; // Call site of the current holder
+    const char *longest_holder; // Call site of the longest hold so far
+    uint64_t longest_hold; // Nanoseconds
+    uint64_t wait_buckets[METRIC_BUCKETS]; // Same log-linear layout as the metrics histograms
+    uint64_t hold_buckets[METRIC_BUCKETS];
+    struct prof_mutex *next; // Registry of used mutexes, linked on first acquisition
+    int registered;
+};
+
+#define PROF_MUTEX_INITIALIZER(mutex_name) { .mutex = PTHREAD_MUTEX_INITIALIZER, .name = (mutex_name) }
+
+// Function to lock a prof_mutex
+// Parameters:
+// - m: Mutex to lock.
+// - site: Call site, normally PROF_SITE through prof_mutex_lock().
+// Returns: Time spent waiting for the mutex in nanoseconds.
+uint64_t prof_mutex_lock_at(struct prof_mutex *m, const char *site);
+
+// Function to unlock a prof_mutex
+// Returns: Time the mutex was held in nanoseconds.
+uint64_t prof_mutex_unlock(struct prof_mutex *m);
+
+#define prof_mutex_lock(m) prof_mutex_lock_at((m), PROF_SITE)
+
+// Function to print the contention report of every prof_mutex used so far
+// For each mutex: acquisitions, share of contended acquisitions, wait and hold time (total, p50, p99, max)
+// and the call site that held it longest.
+void prof_mutex_report(FILE *out);
+
+#endif // LOCKPROF_H
@@ -0,0 +1,217 @@
+#include <syslog.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// <syslog.h> claims LOG_ERR and LOG_DEBUG for its priorities; keep them before log.h takes the names over
+static const int syslog_priority[] = { LOG_ERR, LOG_INFO, LOG_DEBUG };
+#undef LOG_ERR
+#undef LOG_DEBUG
+#include "log.h"
+
+enum log_sink { SINK_CONSOLE, SINK_STDERR, SINK_FILE, SINK_SYSLOG };
+
+struct log_slot {
+    _Atomic size_t sequence; // Vyukov sequence: position when free, position + 1 once the message is written
+    int level;
+    char text[LOG_SLOT_SIZE];
+};
+
+static const char *const level_prefix[] = { "[ERROR]: ", "[SYS]: ", "[DEBUG]: " };
+static const char *const level_name[] = { "error", "sys", "debug" };
+
+_Atomic int log_level = LOG_LEVEL_DEBUG;
+
+static struct log_slot ring[LOG_RING_SLOTS];
+static _Atomic size_t enqueue_position; // Shared by all producers
+static size_t dequeue_position; // Only used by the logger thread
+static _Atomic uint64_t dropped;
+static atomic_bool running = false;
+static atomic_uint writers; // Producers between checking running and publishing their slot
+static _Atomic uint32_t doorbell; // Futex word the logger thread sleeps on
+static atomic_int logger_waiting;
+static pthread_t logger_thread;
+static enum log_sink sink = SINK_CONSOLE;
+static FILE *sink_file = NULL;
+
+static int futex(_Atomic uint32_t *word, int op, uint32_t value, const struct timespec *timeout) {
+    return (int)syscall(SYS_futex, (uint32_t *)word, op | FUTEX_PRIVATE_FLAG, value, timeout, NULL, 0);
+}
+
+static void emit(int level, const char *text) {
+    switch (sink) {
+    case SINK_SYSLOG:
+        syslog(syslog_priority[level], "%s", text);
+        break;
+    case SINK_FILE:
+        fprintf(sink_file, "%s%s\n", level_prefix[level], text);
+        break;
+    case SINK_STDERR:
+        fprintf(stderr, "%s%s\n", level_prefix[level], text);
+        break;
+    default:
+        fprintf(level == LOG_LEVEL_ERROR ? stderr : stdout, "%s%s\n", level_prefix[level], text);
+        break;
+    }
+}
+
+static void flush_sink(void) {
+    if (sink == SINK_FILE) fflush(sink_file);
+    else if (sink != SINK_SYSLOG) fflush(sink == SINK_CONSOLE ? stdout : stderr);
+}
+
+void log_write(int level, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    atomic_fetch_add(&writers, 1); // Seen by log_stop() unless running is already false below
+    if (!atomic_load(&running)) {
+        atomic_fetch_sub(&writers, 1);
+        FILE *out = level == LOG_LEVEL_ERROR ? stderr : stdout;
+        fputs(level_prefix[level], out);
+        vfprintf(out, fmt, args);
+        fputc('\n', out);
+        va_end(args);
+        return;
+    }
+    size_t position = atomic_load_explicit(&enqueue_position, memory_order_relaxed);
+    struct log_slot *slot;
+    for (;;) {
+        slot = &ring[position & (LOG_RING_SLOTS - 1)];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_position, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) break;
+        } else if (difference < 0) { // Full: the logger has not emitted the message LOG_RING_SLOTS back yet
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            atomic_fetch_sub(&writers, 1);
+            va_end(args);
+            return;
+        } else {
+            position = atomic_load_explicit(&enqueue_position, memory_order_relaxed);
+        }
+    }
+    slot->level = level;
+    vsnprintf(slot->text, LOG_SLOT_SIZE, fmt, args);
+    va_end(args);
+    atomic_store_explicit(&slot->sequence, position + 1, memory_order_release); // Hands the slot to the logger
+    atomic_fetch_sub_explicit(&writers, 1, memory_order_release);
+    if (atomic_load(&logger_waiting)) { // Pairs with the seq_cst store in wait_for_messages()
+        atomic_fetch_add(&doorbell, 1);
+        futex(&doorbell, FUTEX_WAKE, 1, NULL);
+    }
+}
+
+static bool message_ready(void) {
+    struct log_slot *slot = &ring[dequeue_position & (LOG_RING_SLOTS - 1)];
+    return atomic_load_explicit(&slot->sequence, memory_order_acquire) == dequeue_position + 1;
+}
+
+// Emit every message that is completely written, in order
+static void drain(void) {
+    bool emitted = false;
+    while (message_ready()) {
+        struct log_slot *slot = &ring[dequeue_position & (LOG_RING_SLOTS - 1)];
+        emit(slot->level, slot->text);
+        atomic_store_explicit(&slot->sequence, dequeue_position + LOG_RING_SLOTS, memory_order_release);
+        dequeue_position++;
+        emitted = true;
+    }
+    static uint64_t reported = 0;
+    uint64_t lost = atomic_load_explicit(&dropped, memory_order_relaxed);
+    if (lost != reported) {
+        char text[64];
+        snprintf(text, sizeof(text), "%llu log messages dropped", (unsigned long long)(lost - reported));
+        emit(LOG_LEVEL_ERROR, text);
+        reported = lost;
+        emitted = true;
+    }
+    if (emitted) flush_sink(); // One flush per batch instead of one per message
+}
+
+static void wait_for_messages(void) {
+    atomic_store(&logger_waiting, 1);
+    uint32_t bell = atomic_load(&doorbell);
+    if (!message_ready() && atomic_load(&running)) {
+        struct timespec timeout = { .tv_sec = 0, .tv_nsec = 100000000L }; // Also notices a message still being written
+        futex(&doorbell, FUTEX_WAIT, bell, &timeout);
+    }
+    atomic_store(&logger_waiting, 0);
+}
+
+static void *logger_loop(void *arg) {
+    (void)arg;
+    for (;;) {
+        bool stopping = !atomic_load(&running); // Read before the final drain
+        drain();
+        if (stopping) break;
+        wait_for_messages();
+    }
+    return NULL;
+}
+
+int log_start(const char *name) {
+    if (atomic_load(&running)) return 0;
+    sink = SINK_CONSOLE;
+    if (name && strcmp(name, "syslog") == 0) {
+        openlog("aesdsocket", LOG_PID, LOG_USER);
+        sink = SINK_SYSLOG;
+    } else if (name && strcmp(name, "stderr") == 0) {
+        sink = SINK_STDERR;
+    } else if (name && strcmp(name, "console") != 0) {
+        sink_file = fopen(name, "a");
+        if (!sink_file) {
+            log_write(LOG_LEVEL_ERROR, "Failed to open log file %s: %s", name, strerror(errno));
+            return -1;
+        }
+        sink = SINK_FILE;
+    }
+    for (size_t i = 0; i < LOG_RING_SLOTS; i++) atomic_store(&ring[i].sequence, i);
+    atomic_store(&enqueue_position, 0);
+    dequeue_position = 0;
+    atomic_store(&running, true);
+    if (pthread_create(&logger_thread, NULL, logger_loop, NULL) != 0) {
+        atomic_store(&running, false);
+        if (sink_file) fclose(sink_file);
+        sink_file = NULL;
+        sink = SINK_CONSOLE;
+        return -1;
+    }
+    return 0;
+}
+
+void log_stop(void) {
+    if (!atomic_exchange(&running, false)) return;
+    atomic_fetch_add(&doorbell, 1);
+    futex(&doorbell, FUTEX_WAKE, 1, NULL);
+    pthread_join(logger_thread, NULL);
+    // Producers that saw running before the exchange may publish after the logger's final drain
+    while (atomic_load_explicit(&writers, memory_order_acquire) != 0) sched_yield();
+    drain();
+    if (sink == SINK_SYSLOG) closelog();
+    if (sink_file) fclose(sink_file);
+    sink_file = NULL;
+    sink = SINK_CONSOLE;
+}
+
+int log_set_level(const char *name) {
+    for (int level = LOG_LEVEL_ERROR; level <= LOG_LEVEL_DEBUG; level++) {
+        if (strcmp(name, level_name[level]) == 0) {
+            log_level = level;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+uint64_t log_dropped(void) {
+    return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
@@ -0,0 +1,58 @@
+#ifndef LOG_H
+#define LOG_H
+// log.h
+// Logging of the AESD socket server. The LOG_* macros format the message in the calling thread into a slot
+// of a lock-free ring; a background thread emits it to the console, a file or syslog. Callers never take
+// the stdio lock and never block on a slow sink: when the ring is full the message is dropped and counted.
+// Before log_start() (and after log_stop()) messages are written synchronously, like fprintf.
+// Messages above LOG_COMPILE_LEVEL are compiled out, messages above log_level are skipped at run time.
+
+#include <stdarg.h>
+#include <stdint.h>
+
+#define LOG_LEVEL_ERROR 0 // LOG_ERR
+#define LOG_LEVEL_SYS 1 // LOG_SYS
+#define LOG_LEVEL_DEBUG 2 // LOG_DEBUG
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_RING_SLOTS 512 // Messages that can be queued, must be a power of two
+#define LOG_SLOT_SIZE 256 // Longest message kept, longer messages are truncated
+
+extern _Atomic int log_level; // Run-time level, LOG_LEVEL_DEBUG (everything) unless changed with log_set_level()
+
+#define LOG_AT(level, fmt, ...) do { \
+        if ((level) <= LOG_COMPILE_LEVEL && (level) <= log_level) log_write((level), fmt, ##__VA_ARGS__); \
+    } while (0)
+
+#define LOG_ERR(fmt, ...) LOG_AT(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define LOG_SYS(fmt, ...) LOG_AT(LOG_LEVEL_SYS, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) LOG_AT(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
+// Function to queue a log message
+// This function formats the message into the ring, or writes it directly if the logger is not running.
+// Parameters:
+// - level: LOG_LEVEL_ERROR, LOG_LEVEL_SYS or LOG_LEVEL_DEBUG.
+// - fmt: printf format of the message, without the trailing newline.
+void log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Function to start the background logger
+// Parameters:
+// - sink: "console" (errors to stderr, the rest to stdout), "stderr", "syslog" or the path of a file
+//   to append to; NULL selects "console".
+// Returns: 0 on success, -1 on failure (messages then keep being written synchronously).
+int log_start(const char *sink);
+
+// Function to emit all queued messages and stop the background logger
+void log_stop(void);
+
+// Function to set the run-time level from its name ("error", "sys" or "debug")
+// Returns: 0 on success, -1 if the name is unknown.
+int log_set_level(const char *name);
+
+// Function to return the number of messages dropped because the ring was full
+uint64_t log_dropped(void);
+
+#endif // LOG_H
@@ -0,0 +1,98 @@
+#include "memacct.h"
+#include "socket.h"
+#include "metrics.h"
+
+_Atomic uint64_t memacct_budget = 0;
+
+static _Atomic uint64_t in_use; // Bytes reserved and charged over all threads
+static _Atomic uint64_t high_water; // Largest value in_use has reached
+static atomic_int overdraft = -1; // Socket of the connection allowed over the budget, -1 if none
+static atomic_int waiters; // Readers stalled in memacct_reserve(); releases only wake them if there are any
+static pthread_mutex_t wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wait_cond = PTHREAD_COND_INITIALIZER;
+
+// The gauges are per-thread deltas; the sum of the high water mark's deltas is its current value
+static void account(uint64_t used, int64_t bytes) {
+    metrics_gauge_add(METRIC_MEMORY_IN_FLIGHT_BYTES, bytes);
+    uint64_t high = atomic_load_explicit(&high_water, memory_order_relaxed);
+    while (used > high) {
+        if (atomic_compare_exchange_weak_explicit(&high_water, &high, used, memory_order_relaxed, memory_order_relaxed)) {
+            metrics_gauge_add(METRIC_MEMORY_HIGH_WATER_BYTES, (int64_t)(used - high));
+            break;
+        }
+    }
+}
+
+static void wake_waiters(void) {
+    if (atomic_load(&waiters) == 0) return;
+    pthread_mutex_lock(&wait_mutex);
+    pthread_cond_broadcast(&wait_cond);
+    pthread_mutex_unlock(&wait_mutex);
+}
+
+static bool try_reserve(size_t bytes, int sockfd) {
+    uint64_t used = atomic_load_explicit(&in_use, memory_order_relaxed);
+    uint64_t budget = memacct_budget; // Reloadable
+    do {
+        if (budget && used + bytes > budget && atomic_load(&overdraft) != sockfd) {
+            int none = -1;
+            if (!atomic_compare_exchange_strong(&overdraft, &none, sockfd)) return false; // Held by another
+        }
+    } while (!atomic_compare_exchange_weak(&in_use, &used, used + bytes));
+    account(used + bytes, (int64_t)bytes);
+    return true;
+}
+
+int memacct_reserve(size_t bytes, int sockfd) {
+    if (try_reserve(bytes, sockfd)) return 0;
+    metrics_add(METRIC_MEMORY_STALLS, 1);
+    uint64_t start = metrics_now();
+    struct pollfd connection = { .fd = sockfd, .events = 0 }; // Only POLLHUP/POLLERR
+    int result = 0;
+    pthread_mutex_lock(&wait_mutex);
+    atomic_fetch_add(&waiters, 1); // Before the retry, so a release in between broadcasts
+    while (!try_reserve(bytes, sockfd)) {
+        if (exit_requested || poll(&connection, 1, 0) > 0) {
+            result = -1;
+            break;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += MEMACCT_WAIT_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&wait_cond, &wait_mutex, &deadline);
+    }
+    atomic_fetch_sub(&waiters, 1);
+    pthread_mutex_unlock(&wait_mutex);
+    metrics_observe(METRIC_MEMORY_WAIT, metrics_now() - start);
+    return result;
+}
+
+bool memacct_over_budget(void) {
+    uint64_t budget = memacct_budget;
+    return budget && atomic_load_explicit(&in_use, memory_order_relaxed) > budget;
+}
+
+void memacct_yield(int sockfd) {
+    int owner = sockfd;
+    if (atomic_compare_exchange_strong(&overdraft, &owner, -1)) wake_waiters();
+}
+
+void memacct_unreserve(size_t bytes, int sockfd) {
+    memacct_release(bytes);
+    memacct_yield(sockfd);
+}
+
+void memacct_charge(size_t bytes) {
+    account(atomic_fetch_add(&in_use, bytes) + bytes, (int64_t)bytes);
+}
+
+void memacct_release(size_t bytes) {
+    if (bytes == 0) return;
+    atomic_fetch_sub(&in_use, bytes);
+    metrics_gauge_add(METRIC_MEMORY_IN_FLIGHT_BYTES, -(int64_t)bytes);
+    wake_waiters();
+}
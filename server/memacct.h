@@ -0,0 +1,44 @@
+#ifndef MEMACCT_H
+#define MEMACCT_H
+// memacct.h
+// Global accounting of the memory held by in-flight data: the receive buffers of all connections
+// (packet->data) and the buffers of replays and replication streams. With a budget (-M bytes), a connection
+// that would push the total over it stops reading from its socket until other connections have released
+// enough, so TCP flow control pushes back on the senders instead of the board running out of memory.
+// A replay reserves its buffers before it takes the mutex of its namespace; the buffers of replication
+// streams are charged without waiting.
+// Connections that each hold part of a record could all end up waiting for each other, so one connection at
+// a time holds the overdraft: it may exceed the budget until its record is complete. The total therefore
+// stays below the budget plus one record.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define MEMACCT_WAIT_MS 100 // A stalled reader rechecks its socket and exit_requested this often
+
+extern _Atomic uint64_t memacct_budget; // Bytes of in-flight buffers admitted, 0 disables admission control (-M)
+
+// Function to reserve receive buffer memory for a connection, waiting while the budget is exhausted
+// Parameters:
+// - bytes: Bytes to add to the connection's reservation.
+// - sockfd: The connection; the wait ends when it is shut down (e.g. by its deadline).
+// Returns: 0 once reserved, -1 if the connection was shut down or the server is exiting.
+int memacct_reserve(size_t bytes, int sockfd);
+
+// Function to tell whether more memory is in use than the budget allows, e.g. through the overdraft
+bool memacct_over_budget(void);
+
+// Function to give up the overdraft once the connection's record is complete; its reservation stays
+void memacct_yield(int sockfd);
+
+// Function to return the reservation of a connection, which must not be closed yet
+void memacct_unreserve(size_t bytes, int sockfd);
+
+// Function to charge memory that is used regardless of the budget, e.g. a replay buffer
+void memacct_charge(size_t bytes);
+
+// Function to return memory charged with memacct_charge()
+void memacct_release(size_t bytes);
+
+#endif // MEMACCT_H
@@ -0,0 +1,170 @@
+#include "metrics.h"
+#include "socket.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+__thread struct metrics_shard *metrics_shard_local = NULL;
+
+static pthread_mutex_t shards_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct metrics_shard *_Atomic shards = NULL; // Head of the list of all shards
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+
+static const struct {
+    const char *name;
+    const char *help;
+} counter_info[METRIC_COUNTERS] = {
+    [METRIC_CONNECTIONS_ACCEPTED] = { "aesd_connections_accepted_total", "Client connections accepted." },
+    [METRIC_BYTES_RECEIVED] = { "aesd_received_bytes_total", "Bytes received from clients." },
+    [METRIC_BYTES_SENT] = { "aesd_sent_bytes_total", "Bytes sent to clients." },
+    [METRIC_RECORDS_APPENDED] = { "aesd_records_appended_total", "Records appended to the log." },
+    [METRIC_REPLAYS] = { "aesd_replays_total", "Log replays sent to clients." },
+    [METRIC_CONNECTIONS_EVICTED] = { "aesd_connections_evicted_total", "Connections evicted by a deadline." },
+    [METRIC_CONNECTIONS_REJECTED] = { "aesd_connections_rejected_total", "Connections over the per-address cap." },
+    [METRIC_RECORDS_THROTTLED] = { "aesd_records_throttled_total", "Records delayed by the per-address rate limits." },
+    [METRIC_REPLICATION_SENT_BYTES] = { "aesd_replication_sent_bytes_total", "Bytes streamed to followers." },
+    [METRIC_REPLICATION_APPLIED_BYTES] = { "aesd_replication_applied_bytes_total", "Bytes applied to the replica." },
+    [METRIC_SEGMENT_RAW_BYTES] = { "aesd_segment_raw_bytes_total", "Bytes of log segments compressed." },
+    [METRIC_SEGMENT_STORED_BYTES] = { "aesd_segment_stored_bytes_total", "Bytes of compressed log segments written." },
+    [METRIC_MEMORY_STALLS] = { "aesd_memory_stalls_total", "Reads held back by the in-flight memory budget." },
+    [METRIC_CONFIG_RELOADS] = { "aesd_config_reloads_total", "Configuration file reloads applied." },
+    [METRIC_DEDUP_RECORDS] = { "aesd_dedup_records_total", "Repeated records stored as back-references." },
+    [METRIC_DEDUP_SAVED_BYTES] = { "aesd_dedup_saved_bytes_total", "Log bytes saved by back-references." },
+}, gauge_info[METRIC_GAUGES] = {
+    [METRIC_CONNECTIONS_ACTIVE] = { "aesd_connections_active", "Client connections being served." },
+    [METRIC_STARTUP_READY_US] = { "aesd_startup_ready_microseconds", "Time from start to accepting connections." },
+    [METRIC_STARTUP_FIRST_ACCEPT_US] = { "aesd_startup_first_accept_microseconds", "Time from start to the first connection." },
+    [METRIC_REPLICATION_FOLLOWERS] = { "aesd_replication_followers", "Followers streaming the log." },
+    [METRIC_REPLICATION_LAG_BYTES] = { "aesd_replication_lag_bytes", "Bytes of the primary's log not yet replicated." },
+    [METRIC_MEMORY_IN_FLIGHT_BYTES] = { "aesd_memory_in_flight_bytes", "Bytes held by receive and send buffers." },
+    [METRIC_MEMORY_HIGH_WATER_BYTES] = { "aesd_memory_high_water_bytes", "Most bytes held by receive and send buffers." },
+}, histogram_info[METRIC_HISTOGRAMS] = {
+    [METRIC_FILE_MUTEX_WAIT] = { "aesd_file_mutex_wait_seconds", "Time spent waiting for a namespace log mutex." },
+    [METRIC_FILE_MUTEX_HOLD] = { "aesd_file_mutex_hold_seconds", "Time a namespace log mutex was held." },
+    [METRIC_FSYNC] = { "aesd_fsync_seconds", "Latency of fsync on the log." },
+    [METRIC_REPLAY] = { "aesd_replay_seconds", "Latency of a log replay." },
+    [METRIC_REPLICATION_DELAY] = { "aesd_replication_delay_seconds", "Time from commit on the primary to apply on the follower." },
+    [METRIC_MEMORY_WAIT] = { "aesd_memory_wait_seconds", "Time connections waited for the in-flight memory budget." },
+};
+
+// Hand the shard back when its thread exits; its counts stay in the totals
+static void release_shard(void *arg) {
+    struct metrics_shard *shard = (struct metrics_shard *)arg;
+    atomic_store_explicit(&shard->in_use, 0, memory_order_release);
+}
+
+static void create_shard_key(void) {
+    pthread_key_create(&shard_key, release_shard);
+}
+
+struct metrics_shard *metrics_attach(void) {
+    static struct metrics_shard fallback; // Used if allocation fails, shared by every such thread
+    pthread_once(&shard_key_once, create_shard_key);
+    struct metrics_shard *shard = NULL;
+    pthread_mutex_lock(&shards_mutex);
+    for (struct metrics_shard *s = atomic_load(&shards); s; s = s->next) {
+        if (!atomic_load_explicit(&s->in_use, memory_order_acquire)) {
+            shard = s;
+            break;
+        }
+    }
+    if (!shard) {
+        shard = (struct metrics_shard *)calloc(1, sizeof(*shard));
+        if (shard) {
+            shard->next = atomic_load(&shards);
+            atomic_store(&shards, shard);
+        }
+    }
+    if (shard) atomic_store(&shard->in_use, 1);
+    pthread_mutex_unlock(&shards_mutex);
+    if (!shard) return &fallback;
+    pthread_setspecific(shard_key, shard);
+    metrics_shard_local = shard;
+    return shard;
+}
+
+int metrics_fsync(int fd) {
+    uint64_t start = metrics_now();
+    int result = fsync(fd);
+    metrics_observe(METRIC_FSYNC, metrics_now() - start);
+    TRACE_SPAN("fsync", start, fd);
+    return result;
+}
+
+uint64_t metrics_bucket_limit(unsigned bucket) {
+    if (bucket < METRIC_SUB_BUCKETS) return bucket + 1;
+    unsigned exp = bucket / METRIC_SUB_BUCKETS + METRIC_SUB_BITS - 1;
+    uint64_t sub = bucket % METRIC_SUB_BUCKETS;
+    return ((METRIC_SUB_BUCKETS + sub + 1) << (exp - METRIC_SUB_BITS));
+}
+
+static void render_histogram(FILE *out, enum metric_histogram histogram) {
+    static uint64_t buckets[METRIC_BUCKETS]; // Only used under shards_mutex
+    uint64_t sum = 0;
+    memset(buckets, 0, sizeof(buckets));
+    for (struct metrics_shard *s = atomic_load(&shards); s; s = s->next) {
+        struct metrics_histogram *h = &s->histograms[histogram];
+        for (unsigned i = 0; i < METRIC_BUCKETS; i++) buckets[i] += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        sum += atomic_load_explicit(&h->sum, memory_order_relaxed);
+    }
+    const char *name = histogram_info[histogram].name;
+    fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, histogram_info[histogram].help, name);
+    // Export the powers of two from 1 us up; the finer sub-buckets only serve to keep the error bounded
+    uint64_t count = 0;
+    for (unsigned i = 0; i < METRIC_BUCKETS; i++) {
+        count += buckets[i];
+        uint64_t limit = metrics_bucket_limit(i);
+        if (limit >= 1024 && (limit & (limit - 1)) == 0 && i < METRIC_BUCKETS - 1) {
+            fprintf(out, "%s_bucket{le=\"%.9g\"} %llu\n", name, limit / 1e9, (unsigned long long)count);
+        }
+    }
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)count);
+    fprintf(out, "%s_sum %.9f\n%s_count %llu\n", name, sum / 1e9, name, (unsigned long long)count);
+}
+
+void metrics_render(FILE *out) {
+    pthread_mutex_lock(&shards_mutex);
+    for (int c = 0; c < METRIC_COUNTERS; c++) {
+        uint64_t total = 0;
+        for (struct metrics_shard *s = atomic_load(&shards); s; s = s->next) {
+            total += atomic_load_explicit(&s->counters[c], memory_order_relaxed);
+        }
+        fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counter_info[c].name, counter_info[c].help,
+                counter_info[c].name, counter_info[c].name, (unsigned long long)total);
+    }
+    for (int g = 0; g < METRIC_GAUGES; g++) {
+        int64_t total = 0;
+        for (struct metrics_shard *s = atomic_load(&shards); s; s = s->next) {
+            total += atomic_load_explicit(&s->gauges[g], memory_order_relaxed);
+        }
+        fprintf(out, "# HELP %s %s\n# TYPE %s gauge\n%s %lld\n", gauge_info[g].name, gauge_info[g].help,
+                gauge_info[g].name, gauge_info[g].name, (long long)total);
+    }
+    fprintf(out, "# HELP aesd_log_dropped_total Log messages dropped because the log ring was full.\n"
+                 "# TYPE aesd_log_dropped_total counter\naesd_log_dropped_total %llu\n", (unsigned long long)log_dropped());
+    for (int h = 0; h < METRIC_HISTOGRAMS; h++) render_histogram(out, h);
+    pthread_mutex_unlock(&shards_mutex);
+}
+
+void metrics_serve(int sockfd) {
+    char *text = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&text, &length);
+    if (!out) {
+        LOG_ERR("Failed to render metrics: %s", strerror(errno));
+        close(sockfd);
+        return;
+    }
+    metrics_render(out);
+    fclose(out);
+    struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 }; // A stalled reader must not hold up the listener
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (send_all(sockfd, text, length) < 0) {
+        LOG_ERR("Failed to send metrics: %s", strerror(errno));
+    }
+    free(text);
+    close(sockfd);
+}
@@ -0,0 +1,136 @@
+#ifndef METRICS_H
+#define METRICS_H
+// metrics.h
+// Runtime metrics of the AESD socket server: counters, gauges and latency histograms.
+// Every thread updates its own shard with plain relaxed loads and stores (no locked instructions and no
+// shared cache lines), so recording an event costs a few nanoseconds. Readers add up all shards when the
+// metrics are rendered in the Prometheus text exposition format, e.g. for the stats socket (-s path).
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <time.h>
+
+enum metric_counter {
+    METRIC_CONNECTIONS_ACCEPTED, // Client connections accepted on any listener
+    METRIC_BYTES_RECEIVED, // Bytes received from clients
+    METRIC_BYTES_SENT, // Bytes sent to clients
+    METRIC_RECORDS_APPENDED, // Records appended to the active log
+    METRIC_REPLAYS, // Log replays sent to clients
+    METRIC_CONNECTIONS_EVICTED, // Connections shut down by their idle or request deadline
+    METRIC_CONNECTIONS_REJECTED, // Connections refused by the per-address connection cap
+    METRIC_RECORDS_THROTTLED, // Records held back by the per-address rate limits
+    METRIC_REPLICATION_SENT_BYTES, // Bytes streamed to followers, frames included
+    METRIC_REPLICATION_APPLIED_BYTES, // Payload bytes a follower added to its replica
+    METRIC_SEGMENT_RAW_BYTES, // Bytes of sealed log segments compressed in the background
+    METRIC_SEGMENT_STORED_BYTES, // Bytes the compressed segments take on disk
+    METRIC_MEMORY_STALLS, // Reads held back because the in-flight memory budget was exhausted
+    METRIC_CONFIG_RELOADS, // Configuration files reloaded on SIGHUP, rejected ones excluded
+    METRIC_DEDUP_RECORDS, // Repeated records written as back-references (-e)
+    METRIC_DEDUP_SAVED_BYTES, // Bytes of the log the back-references saved
+    METRIC_COUNTERS
+};
+
+enum metric_gauge {
+    METRIC_CONNECTIONS_ACTIVE, // Connections with a running data processing thread
+    METRIC_STARTUP_READY_US, // Microseconds from the start of main() to the accept loop
+    METRIC_STARTUP_FIRST_ACCEPT_US, // Microseconds from the start of main() to the first accepted connection
+    METRIC_REPLICATION_FOLLOWERS, // Followers connected to a primary
+    METRIC_REPLICATION_LAG_BYTES, // Bytes of the primary's log a follower has yet to receive
+    METRIC_MEMORY_IN_FLIGHT_BYTES, // Receive and send buffers accounted by memacct
+    METRIC_MEMORY_HIGH_WATER_BYTES, // Largest value of METRIC_MEMORY_IN_FLIGHT_BYTES so far
+    METRIC_GAUGES
+};
+
+enum metric_histogram {
+    METRIC_FILE_MUTEX_WAIT, // Time spent waiting for the mutex of a namespace log (file_mutex for the default one)
+    METRIC_FILE_MUTEX_HOLD, // Time the mutex of a namespace log was held
+    METRIC_FSYNC, // Latency of fsync() on the log
+    METRIC_REPLAY, // Latency of a whole replay
+    METRIC_REPLICATION_DELAY, // Time from a commit on the primary until a caught-up follower applied it
+    METRIC_MEMORY_WAIT, // Time a connection stalled waiting for the in-flight memory budget
+    METRIC_HISTOGRAMS
+};
+
+// Log-linear buckets in nanoseconds: 8 linear sub-buckets per power of two (at most 12.5% error)
+// up to 2^METRIC_MAX_EXP ns (about 9 minutes); larger values land in the last bucket.
+#define METRIC_SUB_BITS 3
+#define METRIC_SUB_BUCKETS (1 << METRIC_SUB_BITS)
+#define METRIC_MAX_EXP 39
+#define METRIC_BUCKETS ((METRIC_MAX_EXP - METRIC_SUB_BITS + 2) * METRIC_SUB_BUCKETS)
+
+struct metrics_histogram {
+    _Atomic uint64_t buckets[METRIC_BUCKETS];
+    _Atomic uint64_t sum; // Sum of all observed values in nanoseconds
+};
+
+struct metrics_shard {
+    _Atomic uint64_t counters[METRIC_COUNTERS];
+    _Atomic int64_t gauges[METRIC_GAUGES]; // Per-thread deltas, only the sum over all shards is meaningful
+    struct metrics_histogram histograms[METRIC_HISTOGRAMS];
+    struct metrics_shard *next; // All shards ever created, never freed
+    _Atomic int in_use; // Owned by a live thread; free shards are handed to new threads
+};
+
+extern __thread struct metrics_shard *metrics_shard_local;
+
+// Function to return the calling thread's shard, creating it on first use
+struct metrics_shard *metrics_attach(void);
+
+static inline struct metrics_shard *metrics_local(void) {
+    struct metrics_shard *shard = metrics_shard_local;
+    return __builtin_expect(shard != NULL, 1) ? shard : metrics_attach();
+}
+
+// Only the owning thread writes a shard, so a load and a store replace an atomic read-modify-write
+static inline void metrics_bump(_Atomic uint64_t *value, uint64_t n) {
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline void metrics_add(enum metric_counter counter, uint64_t n) {
+    metrics_bump(&metrics_local()->counters[counter], n);
+}
+
+static inline void metrics_gauge_add(enum metric_gauge gauge, int64_t n) {
+    _Atomic int64_t *value = &metrics_local()->gauges[gauge];
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline unsigned metrics_bucket(uint64_t ns) {
+    if (ns < METRIC_SUB_BUCKETS) return (unsigned)ns;
+    if (ns >> METRIC_MAX_EXP) return METRIC_BUCKETS - 1;
+    unsigned exp = 63 - (unsigned)__builtin_clzll(ns);
+    return (exp - METRIC_SUB_BITS + 1) * METRIC_SUB_BUCKETS + (unsigned)((ns >> (exp - METRIC_SUB_BITS)) & (METRIC_SUB_BUCKETS - 1));
+}
+
+// Function to return the upper bound (exclusive) of a histogram bucket in nanoseconds
+uint64_t metrics_bucket_limit(unsigned bucket);
+
+static inline void metrics_observe(enum metric_histogram histogram, uint64_t ns) {
+    struct metrics_histogram *h = &metrics_local()->histograms[histogram];
+    metrics_bump(&h->buckets[metrics_bucket(ns)], 1);
+    metrics_bump(&h->sum, ns);
+}
+
+// Function to read the monotonic clock in nanoseconds, for use with metrics_observe()
+static inline uint64_t metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Function to fsync a file and record the latency in METRIC_FSYNC
+// Returns: The result of fsync().
+int metrics_fsync(int fd);
+
+// Function to write all metrics in the Prometheus text exposition format (version 0.0.4)
+// This function adds up the shards of all threads; values may be a few events apart from each other.
+// Parameters:
+// - out: Stream to write to.
+void metrics_render(FILE *out);
+
+// Function to answer a client of the stats socket
+// This function sends the rendered metrics to sockfd and closes it.
+void metrics_serve(int sockfd);
+
+#endif // METRICS_H
@@ -0,0 +1,131 @@
+#include "namespace.h"
+#include "socket.h"
+#include "segment.h"
+#include <glob.h>
+
+extern struct record_log record_log;
+
+struct log_shard default_shard = { .name = "", .mutex = &file_mutex, .path = AESD_SOCKET_FILE, .log = &record_log };
+struct log_shard *local_shard = &default_shard;
+unsigned namespace_limit = 0;
+const char *persist_path = AESD_PERSIST_FILE;
+// AESD_SOCKET_FILE without AESD_DATA_SUFFIX
+static char data_stem[PATH_MAX - NAMESPACE_SUFFIX_MAX] = "/var/tmp/aesdsocketdata";
+static char persist_path_buffer[PATH_MAX];
+
+// Named namespaces; readers scan the published prefix of the array without locking
+static struct log_shard *shards[NAMESPACE_MAX];
+static _Atomic size_t shard_count;
+static unsigned routed_count; // Namespaces created by namespace_route(), under create_mutex
+static pthread_mutex_t create_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int namespace_set_data_file(const char *path) {
+    size_t length = strlen(path), suffix = strlen(AESD_DATA_SUFFIX);
+    if (length > suffix && strcmp(path + length - suffix, AESD_DATA_SUFFIX) == 0) length -= suffix;
+    if (length >= sizeof(data_stem)) { // Every name after the stem fits in PATH_MAX
+        LOG_ERR("Data file path %s is too long", path);
+        return -1;
+    }
+    snprintf(data_stem, sizeof(data_stem), "%.*s", (int)length, path);
+    snprintf(persist_path_buffer, sizeof(persist_path_buffer), "%s" AESD_PERSIST_SUFFIX, data_stem);
+    default_shard.path = path;
+    persist_path = persist_path_buffer;
+    return 0;
+}
+
+static bool valid_name(const char *name, size_t length) {
+    if (length == 0 || length > NAMESPACE_NAME_MAX) return false;
+    for (size_t i = 0; i < length; i++) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static struct log_shard *find(const char *name, size_t length, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (strncmp(shards[i]->name, name, length) == 0 && shards[i]->name[length] == '\0') return shards[i];
+    }
+    return NULL;
+}
+
+// Find or create a namespace; routed namespaces count towards namespace_limit
+static struct log_shard *lookup(const char *name, size_t length, bool routed) {
+    struct log_shard *shard = find(name, length, atomic_load_explicit(&shard_count, memory_order_acquire));
+    if (shard) return shard;
+    pthread_mutex_lock(&create_mutex);
+    size_t count = atomic_load_explicit(&shard_count, memory_order_relaxed);
+    shard = find(name, length, count); // Created by another thread meanwhile
+    if (shard || count == NAMESPACE_MAX || (routed && routed_count >= namespace_limit)) {
+        pthread_mutex_unlock(&create_mutex);
+        return shard;
+    }
+    shard = (struct log_shard *)calloc(1, sizeof(*shard));
+    if (!shard) {
+        pthread_mutex_unlock(&create_mutex);
+        return NULL;
+    }
+    memcpy(shard->name, name, length);
+    snprintf(shard->lock_name, sizeof(shard->lock_name), "log@%s", shard->name);
+    snprintf(shard->own_path, sizeof(shard->own_path),
+             persistent_log ? AESD_NAMESPACE_PERSIST_FILE : AESD_NAMESPACE_FILE, data_stem, shard->name);
+    pthread_mutex_init(&shard->own_mutex.mutex, NULL);
+    shard->own_mutex.name = shard->lock_name;
+    shard->mutex = &shard->own_mutex;
+    shard->path = shard->own_path;
+    shard->own_log.fd = -1;
+    shard->log = &shard->own_log;
+    if (persistent_log && record_log_open(&shard->own_log, shard->own_path, 1) != 0) {
+        pthread_mutex_destroy(&shard->own_mutex.mutex);
+        free(shard);
+        pthread_mutex_unlock(&create_mutex);
+        return NULL;
+    }
+    shards[count] = shard;
+    if (routed) routed_count++;
+    atomic_store_explicit(&shard_count, count + 1, memory_order_release); // Publish after initialization
+    pthread_mutex_unlock(&create_mutex);
+    LOG_SYS("Created namespace %s", shard->name);
+    return shard;
+}
+
+struct log_shard *namespace_open(const char *name, size_t length) {
+    if (!valid_name(name, length)) {
+        LOG_ERR("Invalid namespace name %.*s", (int)length, name);
+        return NULL;
+    }
+    return lookup(name, length, false);
+}
+
+struct log_shard *namespace_route(struct log_shard *fallback, const char *data, size_t length, size_t *prefix) {
+    *prefix = 0;
+    if (namespace_limit == 0 || length < 3 || data[0] != '@') return fallback;
+    const char *end = memchr(data + 1, ' ', length - 1 < NAMESPACE_NAME_MAX + 1 ? length - 1 : NAMESPACE_NAME_MAX + 1);
+    if (!end || !valid_name(data + 1, end - data - 1)) return fallback;
+    struct log_shard *shard = lookup(data + 1, end - data - 1, true);
+    if (!shard) return fallback; // Over the limit: the record keeps its prefix
+    *prefix = end - data + 1;
+    return shard;
+}
+
+void namespace_purge(void) {
+    char pattern[PATH_MAX];
+    snprintf(pattern, sizeof(pattern), AESD_NAMESPACE_GLOB, data_stem);
+    glob_t found;
+    if (glob(pattern, 0, NULL, &found) != 0) return;
+    for (size_t i = 0; i < found.gl_pathc; i++) unlink(found.gl_pathv[i]);
+    globfree(&found);
+}
+
+void namespace_close(bool remove) {
+    size_t count = atomic_load_explicit(&shard_count, memory_order_acquire);
+    for (size_t i = 0; i < count; i++) {
+        if (persistent_log) record_log_close(&shards[i]->own_log);
+        else if (remove) {
+            unlink(shards[i]->own_path);
+            segment_remove(shards[i]->own_path);
+        }
+    }
+}
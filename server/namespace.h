@@ -0,0 +1,85 @@
+#ifndef NAMESPACE_H
+#define NAMESPACE_H
+// namespace.h
+// Log namespaces of the AESD socket server. Every namespace is a shard with its own log file, its own mutex
+// and therefore its own writes and fsyncs, so producers of unrelated streams do not contend, and a replay
+// streams only the shard of the client's namespace.
+// A record is routed by a "@name " prefix (enabled with -N, which also caps the number of namespaces), which
+// is stripped before the record is stored. Records without a prefix go to the namespace of their listener:
+// the default namespace for TCP clients, the one given with -n for local clients and the shared memory ring.
+// The default namespace is the log the server always had (AESD_SOCKET_FILE or AESD_PERSIST_FILE by default).
+// Every log is named after the data file (-D): with the stem of its name, the name without AESD_DATA_SUFFIX,
+// the record log is <stem>.rec and a named namespace logs to <stem>.<name>.txt or <stem>.<name>.rec, so
+// instances with different data files share no file.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include "lockprof.h"
+#include "record_log.h"
+
+#define NAMESPACE_NAME_MAX 32 // Longest namespace name; names use [A-Za-z0-9_-]
+#define NAMESPACE_MAX 256 // Upper bound of the number of named namespaces
+#define AESD_DATA_SUFFIX ".txt" // Stripped from the data file to name the other logs
+#define AESD_PERSIST_SUFFIX ".rec" // Record log of the default namespace, after the stem
+#define AESD_NAMESPACE_FILE "%s.%s.txt" // Text log of a named namespace, from the stem and the name
+#define AESD_NAMESPACE_PERSIST_FILE "%s.%s.rec" // Record log of a named namespace (-p)
+#define AESD_NAMESPACE_GLOB "%s.*.txt*" // Text logs and their segments removed on startup
+#define NAMESPACE_SUFFIX_MAX (NAMESPACE_NAME_MAX + 6) // Longest name of a log after the stem, ".<name>.txt"
+
+struct log_shard {
+    char name[NAMESPACE_NAME_MAX + 1]; // Empty for the default namespace
+    struct prof_mutex *mutex; // Serializes every access to the log of this namespace
+    const char *path; // Text log
+    struct record_log *log; // Record log used in persistent mode
+    // Storage of a named namespace; the default one points to file_mutex, AESD_SOCKET_FILE and record_log
+    struct prof_mutex own_mutex;
+    struct record_log own_log;
+    char own_path[PATH_MAX];
+    char lock_name[NAMESPACE_NAME_MAX + 8]; // Name of own_mutex in the lock report
+    // Segments of the text log (see segment.h), under mutex
+    unsigned segments; // Sealed segments, numbered from 1
+    uint64_t tail_bytes; // Size of the active file
+    bool segments_scanned; // Set once segments and tail_bytes describe the files on disk
+};
+
+extern struct log_shard default_shard; // Namespace of records without a prefix from TCP clients
+extern struct log_shard *local_shard; // Namespace of records without a prefix from local producers (-n)
+extern unsigned namespace_limit; // Named namespaces created from record prefixes, 0 disables routing (-N)
+extern const char *persist_path; // Record log of the default namespace, AESD_PERSIST_FILE unless -D moves it (-p)
+
+// Function to name every log after the data file
+// Parameters:
+// - path: Text log of the default namespace; the other logs take the stem of its name.
+// Returns: 0 on success, -1 (logged) if the derived names do not fit in PATH_MAX.
+// Note: Called once at startup, before any log is opened.
+int namespace_set_data_file(const char *path);
+
+// Function to find a namespace, creating it if needed
+// Parameters:
+// - name: Namespace name, not necessarily NUL terminated.
+// - length: Length of the name.
+// Returns: The namespace, or NULL if the name is invalid or the namespace cannot be created.
+// Note: Namespaces live until the process exits.
+struct log_shard *namespace_open(const char *name, size_t length);
+
+// Function to route a record by its namespace prefix
+// Parameters:
+// - fallback: Namespace of the record if it has no valid prefix.
+// - data: Record to route.
+// - length: Length of the record.
+// - prefix: Receives the length of the prefix to strip, 0 if the record has none.
+// Returns: The namespace to store the record in.
+// Note: A prefix naming a new namespace beyond namespace_limit is left in place and the record goes to fallback.
+struct log_shard *namespace_route(struct log_shard *fallback, const char *data, size_t length, size_t *prefix);
+
+// Function to remove the text logs of named namespaces left behind by a previous run
+void namespace_purge(void);
+
+// Function to close the logs of all named namespaces
+// Parameters:
+// - remove: Also delete the text logs and their segments, as the server does with AESD_SOCKET_FILE.
+void namespace_close(bool remove);
+
+#endif // NAMESPACE_H
@@ -0,0 +1,191 @@
+#include "newline_scan.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+struct scan_impl {
+    const char *name;
+    size_t (*all)(const char *buf, size_t length, size_t *positions, size_t max_positions);
+    const char *(*first)(const char *buf, size_t length);
+};
+
+#define NEWLINES 0x0a0a0a0a0a0a0a0aull
+#define LOW7 0x7f7f7f7f7f7f7f7full
+
+// Exact zero-byte detector: the high bit of a byte is set iff that byte of x is zero
+static inline uint64_t zero_bytes(uint64_t x) {
+    return ~(((x & LOW7) + LOW7) | x | LOW7);
+}
+
+// Byte-at-a-time scan of buf[start..length), used for the tails of the vector loops
+static size_t tail_all(const char *buf, size_t start, size_t length, size_t *positions, size_t found,
+                       size_t max_positions) {
+    for (size_t i = start; i < length && found < max_positions; i++) {
+        if (buf[i] == '\n') positions[found++] = i;
+    }
+    return found;
+}
+
+static size_t generic_all(const char *buf, size_t length, size_t *positions, size_t max_positions) {
+    size_t found = 0;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, buf + i, sizeof(word));
+        if (zero_bytes(word ^ NEWLINES)) {
+            found = tail_all(buf, i, i + 8, positions, found, max_positions);
+            if (found == max_positions) return found;
+        }
+    }
+    return tail_all(buf, i, length, positions, found, max_positions);
+}
+
+static const char *generic_first(const char *buf, size_t length) {
+    size_t position;
+    return generic_all(buf, length, &position, 1) ? buf + position : NULL;
+}
+
+#if defined(__x86_64__)
+static size_t sse2_all(const char *buf, size_t length, size_t *positions, size_t max_positions) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t found = 0;
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(buf + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+        while (mask) {
+            if (found == max_positions) return found;
+            positions[found++] = i + (size_t)__builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return tail_all(buf, i, length, positions, found, max_positions);
+}
+
+static const char *sse2_first(const char *buf, size_t length) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(buf + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+        if (mask) return buf + i + __builtin_ctz(mask);
+    }
+    size_t position;
+    return tail_all(buf, i, length, &position, 0, 1) ? buf + position : NULL;
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_all(const char *buf, size_t length, size_t *positions, size_t max_positions) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t found = 0;
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        // Two vectors per iteration: one 64-bit mask per cache line
+        __m256i lo = _mm256_loadu_si256((const __m256i *)(buf + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(buf + i + 32));
+        uint64_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, newline)) |
+                        ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, newline)) << 32);
+        while (mask) {
+            if (found == max_positions) return found;
+            positions[found++] = i + (size_t)__builtin_ctzll(mask);
+            mask &= mask - 1;
+        }
+    }
+    for (; i + 32 <= length; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(buf + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline));
+        while (mask) {
+            if (found == max_positions) return found;
+            positions[found++] = i + (size_t)__builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return tail_all(buf, i, length, positions, found, max_positions);
+}
+
+__attribute__((target("avx2")))
+static const char *avx2_first(const char *buf, size_t length) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(buf + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline));
+        if (mask) return buf + i + __builtin_ctz(mask);
+    }
+    size_t position;
+    return tail_all(buf, i, length, &position, 0, 1) ? buf + position : NULL;
+}
+#endif
+
+static const struct scan_impl scan_impls[] = {
+#if defined(__x86_64__)
+    { "avx2", avx2_all, avx2_first },
+    { "sse2", sse2_all, sse2_first },
+#endif
+    { "generic", generic_all, generic_first },
+};
+
+static const struct scan_impl *active_impl;
+static pthread_once_t scan_once = PTHREAD_ONCE_INIT;
+
+static bool impl_supported(const struct scan_impl *impl) {
+#if defined(__x86_64__)
+    if (strcmp(impl->name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+#endif
+    (void)impl;
+    return true;
+}
+
+static int select_impl(const char *name) {
+    for (size_t i = 0; i < sizeof(scan_impls) / sizeof(scan_impls[0]); i++) {
+        if (strcmp(scan_impls[i].name, name) == 0 && impl_supported(&scan_impls[i])) {
+            active_impl = &scan_impls[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void autodetect(void) {
+    for (size_t i = 0; i < sizeof(scan_impls) / sizeof(scan_impls[0]); i++) {
+        if (impl_supported(&scan_impls[i])) {
+            active_impl = &scan_impls[i];
+            return;
+        }
+    }
+}
+
+static void scan_init(void) {
+    const char *forced = getenv("AESD_SCAN_IMPL");
+    if (forced && select_impl(forced) == 0) return;
+    autodetect();
+}
+
+int scan_select(const char *name) {
+    pthread_once(&scan_once, scan_init);
+    if (!name) {
+        autodetect();
+        return 0;
+    }
+    return select_impl(name);
+}
+
+size_t scan_newlines(const char *buf, size_t length, size_t *positions, size_t max_positions) {
+    pthread_once(&scan_once, scan_init);
+    return active_impl->all(buf, length, positions, max_positions);
+}
+
+const char *scan_first_newline(const char *buf, size_t length) {
+    pthread_once(&scan_once, scan_init);
+    return active_impl->first(buf, length);
+}
+
+const char *scan_impl_name(void) {
+    pthread_once(&scan_once, scan_init);
+    return active_impl->name;
+}
@@ -0,0 +1,33 @@
+#ifndef NEWLINE_SCAN_H
+#define NEWLINE_SCAN_H
+// newline_scan.h
+// Vectorized delimiter scanning shared by the socket framer and the log tools.
+// The implementation is picked once at runtime: AVX2 or SSE2 on x86-64, a portable word-at-a-time
+// version everywhere else. Unlike strchr() the scanners work on raw bytes and do not stop at NUL.
+
+#include <stddef.h>
+
+// Function to find every newline in a block
+// This function stores the offsets of up to max_positions newlines of buf[0..length) in positions.
+// Parameters:
+// - buf: Pointer to the block to scan.
+// - length: Number of bytes in the block.
+// - positions: Array receiving the offsets of the newlines, in ascending order.
+// - max_positions: Capacity of positions.
+// Returns: Number of offsets stored. If it equals max_positions, rescan after the last offset for more.
+size_t scan_newlines(const char *buf, size_t length, size_t *positions, size_t max_positions);
+
+// Function to find the first newline in a block
+// Returns: Pointer to the first newline in buf[0..length), or NULL if there is none.
+const char *scan_first_newline(const char *buf, size_t length);
+
+// Function to select the scanner implementation
+// This function forces "generic", "sse2" or "avx2" (if the CPU supports it); NULL restores autodetection.
+// The AESD_SCAN_IMPL environment variable has the same effect at startup.
+// Returns: 0 on success, -1 if the implementation is unknown or not supported.
+int scan_select(const char *name);
+
+// Function to return the name of the active scanner implementation
+const char *scan_impl_name(void);
+
+#endif // NEWLINE_SCAN_H
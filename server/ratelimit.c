@@ -0,0 +1,162 @@
+#include "ratelimit.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+struct client_limit {
+    uint32_t addr; // IPv4 address in network byte order
+    unsigned connections; // Open connections
+    double record_tokens;
+    double byte_tokens;
+    uint64_t refilled_ns; // When the buckets were last refilled
+    struct client_limit *next; // Hash chain
+};
+
+struct stripe {
+    pthread_mutex_t mutex;
+    struct client_limit *buckets[RATELIMIT_BUCKETS_PER_STRIPE];
+} __attribute__((aligned(64))); // One lock per cache line
+
+struct ratelimit_config ratelimit_config = { 0, 0, 0 };
+// Limits in effect, published together by ratelimit_publish() under a sequence lock: connection threads
+// retry a read that overlapped a reload, so they never see a mix of old and new limits
+static atomic_uint published_sequence; // Odd while a reload writes the limits
+static _Atomic double published_records;
+static _Atomic double published_bytes;
+static atomic_uint published_connections;
+static struct stripe stripes[RATELIMIT_STRIPES];
+static pthread_once_t stripes_once = PTHREAD_ONCE_INIT;
+
+static void init_stripes(void) {
+    for (int i = 0; i < RATELIMIT_STRIPES; i++) pthread_mutex_init(&stripes[i].mutex, NULL);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void ratelimit_publish(void) {
+    unsigned sequence = atomic_load_explicit(&published_sequence, memory_order_relaxed);
+    atomic_store_explicit(&published_sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release); // The odd sequence is visible before any limit changes
+    atomic_store_explicit(&published_records, ratelimit_config.records_per_second, memory_order_relaxed);
+    atomic_store_explicit(&published_bytes, ratelimit_config.bytes_per_second, memory_order_relaxed);
+    atomic_store_explicit(&published_connections, ratelimit_config.max_connections, memory_order_relaxed);
+    atomic_store_explicit(&published_sequence, sequence + 2, memory_order_release);
+}
+
+// Function to read the published limits, consistent with each other
+static void limits(struct ratelimit_config *config) {
+    unsigned sequence;
+    do {
+        while ((sequence = atomic_load_explicit(&published_sequence, memory_order_acquire)) & 1) {
+            // A reload is writing the limits, it stores three values
+        }
+        config->records_per_second = atomic_load_explicit(&published_records, memory_order_relaxed);
+        config->bytes_per_second = atomic_load_explicit(&published_bytes, memory_order_relaxed);
+        config->max_connections = atomic_load_explicit(&published_connections, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire); // The limits are read before the sequence is checked again
+    } while (atomic_load_explicit(&published_sequence, memory_order_relaxed) != sequence);
+}
+
+bool ratelimit_enabled(void) {
+    struct ratelimit_config config;
+    limits(&config);
+    return config.records_per_second > 0 || config.bytes_per_second > 0 || config.max_connections > 0;
+}
+
+static void refill(struct client_limit *client, uint64_t now, const struct ratelimit_config *config) {
+    double elapsed = (now - client->refilled_ns) / 1e9;
+    client->refilled_ns = now;
+    double records = config->records_per_second, bytes = config->bytes_per_second;
+    client->record_tokens += elapsed * records;
+    if (client->record_tokens > records * RATELIMIT_BURST_SECONDS) client->record_tokens = records * RATELIMIT_BURST_SECONDS;
+    client->byte_tokens += elapsed * bytes;
+    if (client->byte_tokens > bytes * RATELIMIT_BURST_SECONDS) client->byte_tokens = bytes * RATELIMIT_BURST_SECONDS;
+}
+
+// Find (or create) the entry of addr with its stripe locked; returns NULL if it cannot be allocated
+static struct client_limit *lookup(uint32_t addr, struct stripe **locked, uint64_t now,
+                                   const struct ratelimit_config *config) {
+    pthread_once(&stripes_once, init_stripes);
+    uint32_t hash = addr * 2654435761u; // Fibonacci hashing spreads neighbouring addresses
+    struct stripe *stripe = &stripes[hash >> 26];
+    struct client_limit **chain = &stripe->buckets[(hash >> 20) & (RATELIMIT_BUCKETS_PER_STRIPE - 1)];
+    pthread_mutex_lock(&stripe->mutex);
+    *locked = stripe;
+    struct client_limit *found = NULL;
+    for (struct client_limit **link = chain; *link;) {
+        struct client_limit *client = *link;
+        if (client->addr == addr) {
+            found = client;
+            link = &client->next;
+        } else if (client->connections == 0 && now - client->refilled_ns > RATELIMIT_IDLE_MS * 1000000ull) {
+            *link = client->next; // Quiet for long enough that its buckets are full again: forget it
+            free(client);
+        } else {
+            link = &client->next;
+        }
+    }
+    if (found) {
+        refill(found, now, config);
+        return found;
+    }
+    found = (struct client_limit *)calloc(1, sizeof(*found));
+    if (!found) return NULL;
+    found->addr = addr;
+    found->record_tokens = config->records_per_second * RATELIMIT_BURST_SECONDS;
+    found->byte_tokens = config->bytes_per_second * RATELIMIT_BURST_SECONDS;
+    found->refilled_ns = now;
+    found->next = *chain;
+    *chain = found;
+    return found;
+}
+
+bool ratelimit_connection_open(struct in_addr addr) {
+    struct ratelimit_config config;
+    limits(&config);
+    struct stripe *stripe;
+    struct client_limit *client = lookup(addr.s_addr, &stripe, now_ns(), &config);
+    bool admitted = true;
+    if (client) {
+        if (config.max_connections && client->connections >= config.max_connections) admitted = false;
+        else client->connections++;
+    }
+    pthread_mutex_unlock(&stripe->mutex);
+    return admitted; // Fail open if the entry cannot be allocated
+}
+
+void ratelimit_connection_close(struct in_addr addr) {
+    struct ratelimit_config config;
+    limits(&config);
+    struct stripe *stripe;
+    struct client_limit *client = lookup(addr.s_addr, &stripe, now_ns(), &config);
+    if (client && client->connections > 0) client->connections--;
+    pthread_mutex_unlock(&stripe->mutex);
+}
+
+uint64_t ratelimit_record(struct in_addr addr, size_t length) {
+    struct ratelimit_config config;
+    limits(&config);
+    if (config.records_per_second <= 0 && config.bytes_per_second <= 0) return 0;
+    struct stripe *stripe;
+    uint64_t now = now_ns();
+    struct client_limit *client = lookup(addr.s_addr, &stripe, now, &config);
+    double wait = 0;
+    if (client) {
+        if (config.records_per_second > 0) {
+            client->record_tokens -= 1;
+            if (client->record_tokens < 0) wait = -client->record_tokens / config.records_per_second;
+        }
+        if (config.bytes_per_second > 0) {
+            client->byte_tokens -= (double)length;
+            double byte_wait = client->byte_tokens < 0 ? -client->byte_tokens / config.bytes_per_second : 0;
+            if (byte_wait > wait) wait = byte_wait;
+        }
+    }
+    pthread_mutex_unlock(&stripe->mutex);
+    return (uint64_t)(wait * 1e9);
+}
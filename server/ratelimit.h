@@ -0,0 +1,50 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+// ratelimit.h
+// Per-client-IP admission control: a cap on concurrent connections per address, checked at accept time,
+// and token buckets on records/s and bytes/s, charged when a record has been framed. A client over its rate
+// is not dropped; its connection is made to wait until the bucket refills, so TCP flow control pushes back
+// on that client alone while the others keep their share of file_mutex and the disk.
+// The state lives in a lock-striped chained hash table; entries of clients without connections that have
+// been quiet for RATELIMIT_IDLE_MS are recycled as the table is walked.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+
+#define RATELIMIT_STRIPES 64 // Independent locks
+#define RATELIMIT_BUCKETS_PER_STRIPE 64 // Hash chains per lock, 4096 in total
+#define RATELIMIT_IDLE_MS 60000 // Entries unused for this long are freed
+#define RATELIMIT_BURST_SECONDS 1 // Bucket depth, in seconds of the configured rate
+
+struct ratelimit_config {
+    double records_per_second; // 0 disables the record rate
+    double bytes_per_second; // 0 disables the byte rate
+    unsigned max_connections; // Concurrent connections per address, 0 disables the cap
+};
+
+extern struct ratelimit_config ratelimit_config; // Settings being configured, in effect once published
+
+// Function to put ratelimit_config in effect; the limits change together for the connection threads
+// Called by the configuration thread only.
+void ratelimit_publish(void);
+
+// Function to tell whether any limit is configured; when none is, the other functions are not needed
+bool ratelimit_enabled(void);
+
+// Function to admit a new connection from addr
+// Returns: true if the connection is admitted (and counted), false if addr is at its connection cap.
+bool ratelimit_connection_open(struct in_addr addr);
+
+// Function to release a connection admitted by ratelimit_connection_open()
+void ratelimit_connection_close(struct in_addr addr);
+
+// Function to charge a framed record to addr's token buckets
+// Buckets may go into debt, so a record larger than the burst is still accepted eventually.
+// Parameters:
+// - addr: Source address of the record.
+// - length: Record length in bytes.
+// Returns: Nanoseconds the caller should wait before storing the record, 0 if it is within the rate.
+uint64_t ratelimit_record(struct in_addr addr, size_t length);
+
+#endif // RATELIMIT_H
@@ -0,0 +1,576 @@
+#include "record_log.h"
+#include "socket.h"
+#include "metrics.h"
+#include "trace.h"
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define APPEND_BATCH 256 // Records per writev(), three iovecs each, which stays below IOV_MAX
+
+bool record_log_dedup = false;
+
+struct dedup_entry {
+    uint64_t offset; // Offset of the data record holding the payload
+    uint32_t hash; // CRC32C of the payload, unused by the replay cache
+    uint32_t length; // Payload length, 0 while the entry is empty
+    char *payload; // RECORD_LOG_DEDUP_MAX_RECORD bytes, allocated on first use
+};
+
+struct record_dedup {
+    struct dedup_entry slots[RECORD_LOG_DEDUP_SLOTS]; // Indexed by the low bits of the hash
+};
+
+static uint32_t crc32c_table[8][256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78u : crc >> 1; // Reflected Castagnoli polynomial
+        }
+        crc32c_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            crc32c_table[t][i] = (crc32c_table[t - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[t - 1][i] & 0xff];
+        }
+    }
+}
+
+// Slicing-by-8 software implementation, used when no CRC instruction is available
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t length) {
+    while (length && ((uintptr_t)p & 7)) {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+        length--;
+    }
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        word ^= crc;
+        crc = crc32c_table[7][word & 0xff] ^ crc32c_table[6][(word >> 8) & 0xff] ^
+              crc32c_table[5][(word >> 16) & 0xff] ^ crc32c_table[4][(word >> 24) & 0xff] ^
+              crc32c_table[3][(word >> 32) & 0xff] ^ crc32c_table[2][(word >> 40) & 0xff] ^
+              crc32c_table[1][(word >> 48) & 0xff] ^ crc32c_table[0][word >> 56];
+        p += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t length) {
+    uint64_t crc64 = crc;
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        length -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (length--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t length) {
+    crc = ~crc;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        return ~crc32c_hw(crc, data, length);
+    }
+#endif
+    pthread_once(&crc32c_once, crc32c_init_table);
+    return ~crc32c_sw(crc, data, length);
+}
+
+static size_t record_size(uint32_t length) {
+    return sizeof(struct record_header) + ((length + RECORD_LOG_ALIGN - 1) & ~(size_t)(RECORD_LOG_ALIGN - 1));
+}
+
+static uint32_t record_crc(const struct record_header *header, const void *payload) {
+    uint32_t crc = crc32c(0, &header->length, sizeof(header->length) + sizeof(header->flags));
+    return crc32c(crc, payload, header->length);
+}
+
+// Check whether a valid record starts at offset; on success *size holds its size on disk
+static bool record_valid_at(const unsigned char *base, size_t file_size, size_t offset, size_t *size) {
+    struct record_header header;
+    if (offset + sizeof(header) > file_size) return false;
+    memcpy(&header, base + offset, sizeof(header));
+    if (header.magic != RECORD_LOG_MAGIC || header.length > RECORD_LOG_MAX_PAYLOAD) return false;
+    size_t total = record_size(header.length);
+    if (total > file_size - offset) return false;
+    if (record_crc(&header, base + offset + sizeof(header)) != header.crc) return false;
+    *size = total;
+    return true;
+}
+
+struct scan_task {
+    const unsigned char *base; // Read-only mapping of the whole log
+    size_t file_size; // Size of the mapping
+    size_t start; // First offset of the slice
+    size_t stop; // Offset one past the slice
+    bool anchored; // True if start is known to be a record boundary
+    uint64_t *offsets; // Records found in the slice
+    size_t count;
+    size_t capacity;
+    size_t next; // Offset where the scan stopped: first boundary >= stop, or the invalid record
+    bool broken; // True if the scan hit an invalid record before reaching stop
+    int error; // Non-zero if the scan ran out of memory
+};
+
+// Make room in an offset index for `needed` entries in total
+static int reserve_offsets(uint64_t **offsets, size_t *capacity, size_t needed) {
+    if (needed <= *capacity) return 0;
+    size_t new_capacity = *capacity ? *capacity : 1024;
+    while (new_capacity < needed) new_capacity *= 2;
+    uint64_t *grown = realloc(*offsets, new_capacity * sizeof(**offsets));
+    if (!grown) return -1;
+    *offsets = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static int push_offset(uint64_t **offsets, size_t *count, size_t *capacity, uint64_t offset) {
+    if (reserve_offsets(offsets, capacity, *count + 1) != 0) return -1;
+    (*offsets)[(*count)++] = offset;
+    return 0;
+}
+
+static void *scan_slice(void *arg) {
+    struct scan_task *task = (struct scan_task *)arg;
+    size_t offset = task->start;
+    size_t size = 0;
+    if (!task->anchored) {
+        // Resynchronize on the first aligned offset that holds a valid record; the CRC makes false hits unlikely
+        // and the stitching in record_log_open() discards them anyway.
+        while (offset < task->stop && !record_valid_at(task->base, task->file_size, offset, &size)) {
+            offset += RECORD_LOG_ALIGN;
+        }
+    }
+    while (offset < task->stop) {
+        if (!record_valid_at(task->base, task->file_size, offset, &size)) {
+            task->broken = true;
+            break;
+        }
+        if (push_offset(&task->offsets, &task->count, &task->capacity, offset) != 0) {
+            task->error = ENOMEM;
+            break;
+        }
+        offset += size;
+    }
+    task->next = offset;
+    return NULL;
+}
+
+// Position of offset in a sorted task index, or SIZE_MAX if it is not a record the task found
+static size_t find_offset(const struct scan_task *task, uint64_t offset) {
+    size_t lo = 0, hi = task->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (task->offsets[mid] < offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return (lo < task->count && task->offsets[lo] == offset) ? lo : SIZE_MAX;
+}
+
+static int recover(struct record_log *log, const unsigned char *base, size_t file_size, int threads) {
+    size_t slices = file_size / RECORD_LOG_MIN_SEGMENT;
+    if (slices > (size_t)threads) slices = threads;
+    if (slices < 1) slices = 1;
+
+    struct scan_task *tasks = calloc(slices, sizeof(*tasks));
+    pthread_t *tids = calloc(slices, sizeof(*tids));
+    bool *started = calloc(slices, sizeof(*started));
+    if (!tasks || !tids || !started) {
+        free(tasks);
+        free(tids);
+        free(started);
+        LOG_ERR("Failed to allocate recovery tasks: %s", strerror(ENOMEM));
+        return -1;
+    }
+    size_t slice_size = (file_size / slices) & ~(size_t)(RECORD_LOG_ALIGN - 1);
+    for (size_t i = 0; i < slices; i++) {
+        tasks[i].base = base;
+        tasks[i].file_size = file_size;
+        tasks[i].start = i * slice_size;
+        tasks[i].stop = (i == slices - 1) ? file_size : (i + 1) * slice_size;
+        tasks[i].anchored = (i == 0);
+    }
+    // Slice 0 runs on the calling thread, the others in parallel
+    for (size_t i = 1; i < slices; i++) {
+        started[i] = pthread_create(&tids[i], NULL, scan_slice, &tasks[i]) == 0;
+        if (!started[i]) scan_slice(&tasks[i]);
+    }
+    scan_slice(&tasks[0]);
+    for (size_t i = 1; i < slices; i++) {
+        if (started[i]) pthread_join(tids[i], NULL);
+    }
+
+    // Stitch the slices together: the authoritative chain of records starts at offset 0 and every slice must
+    // continue where the previous one stopped. A slice that synchronized elsewhere is rescanned from there.
+    int ret = 0;
+    size_t position = 0;
+    for (size_t i = 0; i < slices && ret == 0; i++) {
+        struct scan_task *task = &tasks[i];
+        if (task->error) {
+            LOG_ERR("Failed to index record log %s: %s", log->path, strerror(task->error));
+            ret = -1;
+            break;
+        }
+        if (position >= task->stop) continue; // A large record covers this whole slice
+        size_t first = find_offset(task, position);
+        if (first == SIZE_MAX) {
+            free(task->offsets);
+            task->offsets = NULL;
+            task->count = task->capacity = 0;
+            task->start = position;
+            task->anchored = true;
+            task->broken = false;
+            scan_slice(task);
+            first = 0;
+            if (task->error) {
+                LOG_ERR("Failed to index record log %s: %s", log->path, strerror(task->error));
+                ret = -1;
+                break;
+            }
+        }
+        for (size_t k = first; k < task->count; k++) {
+            log->payload_bytes += ((const struct record_header *)(base + task->offsets[k]))->length;
+            if (push_offset(&log->offsets, &log->count, &log->capacity, task->offsets[k]) != 0) {
+                LOG_ERR("Failed to index record log %s: %s", log->path, strerror(ENOMEM));
+                ret = -1;
+                break;
+            }
+        }
+        position = task->next;
+        if (task->broken) break;
+    }
+    log->end = (off_t)position;
+
+    for (size_t i = 0; i < slices; i++) free(tasks[i].offsets);
+    free(tasks);
+    free(tids);
+    free(started);
+    return ret;
+}
+
+static void free_entries(struct dedup_entry *entries, size_t count) {
+    for (size_t i = 0; i < count; i++) free(entries[i].payload);
+}
+
+// Forget the window, e.g. because records it points to were truncated away
+static void dedup_forget(struct record_dedup *dedup) {
+    for (size_t i = 0; i < RECORD_LOG_DEDUP_SLOTS; i++) dedup->slots[i].length = 0;
+}
+
+// Remember a payload written at offset, replacing the entry's previous payload
+static void dedup_remember(struct dedup_entry *entry, uint32_t hash, const void *data, size_t length, uint64_t offset) {
+    if (!entry->payload && !(entry->payload = malloc(RECORD_LOG_DEDUP_MAX_RECORD))) return; // Just not remembered
+    memcpy(entry->payload, data, length);
+    entry->offset = offset;
+    entry->hash = hash;
+    entry->length = (uint32_t)length;
+}
+
+int record_log_open(struct record_log *log, const char *path, int threads) {
+    memset(log, 0, sizeof(*log));
+    log->fd = -1;
+    log->path = strdup(path);
+    if (!log->path) {
+        LOG_ERR("Failed to allocate memory for record log path: %s", strerror(errno));
+        return -1;
+    }
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (threads > RECORD_LOG_MAX_THREADS) threads = RECORD_LOG_MAX_THREADS;
+
+    struct timespec begin, done;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    log->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log->fd < 0) {
+        LOG_ERR("Failed to open record log %s: %s", path, strerror(errno));
+        record_log_close(log);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(log->fd, &st) < 0) {
+        LOG_ERR("Failed to stat record log %s: %s", path, strerror(errno));
+        record_log_close(log);
+        return -1;
+    }
+    size_t file_size = (size_t)st.st_size;
+    if (file_size > 0) {
+        unsigned char *base = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, log->fd, 0);
+        if (base == MAP_FAILED) {
+            LOG_ERR("Failed to map record log %s: %s", path, strerror(errno));
+            record_log_close(log);
+            return -1;
+        }
+        // Separate calls: the advice values are not flags, or'ed together they would only ask for WILLNEED
+        madvise(base, file_size, MADV_SEQUENTIAL); // Each thread scans its slice front to back
+        madvise(base, file_size, MADV_WILLNEED); // Start reading ahead of all of them
+        int ret = recover(log, base, file_size, threads);
+        munmap(base, file_size);
+        if (ret != 0) {
+            record_log_close(log);
+            return -1;
+        }
+    }
+    if ((size_t)log->end < file_size) {
+        LOG_SYS("Truncating %zu bytes of torn or corrupt records from %s", file_size - (size_t)log->end, path);
+        if (ftruncate(log->fd, log->end) < 0 || fsync(log->fd) < 0) {
+            LOG_ERR("Failed to truncate record log %s: %s", path, strerror(errno));
+            record_log_close(log);
+            return -1;
+        }
+    }
+
+    if (record_log_dedup && !(log->dedup = calloc(1, sizeof(*log->dedup)))) {
+        LOG_ERR("Failed to allocate the deduplication window of %s, storing every record", path);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &done);
+    double elapsed_ms = (done.tv_sec - begin.tv_sec) * 1e3 + (done.tv_nsec - begin.tv_nsec) / 1e6;
+    LOG_SYS("Recovered %zu records (%llu bytes) from %s in %.3f ms using up to %d threads", log->count,
+            (unsigned long long)log->payload_bytes, path, elapsed_ms, threads);
+    return 0;
+}
+
+int record_log_append(struct record_log *log, const char *data, size_t length) {
+    struct iovec record = { .iov_base = (void *)data, .iov_len = length };
+    return record_log_append_batch(log, &record, 1);
+}
+
+int record_log_append_batch(struct record_log *log, const struct iovec *records, size_t count) {
+    static const char padding[RECORD_LOG_ALIGN] = {0};
+    struct record_header headers[APPEND_BATCH];
+    struct iovec iov[3 * APPEND_BATCH];
+    uint64_t targets[APPEND_BATCH]; // Payloads of the back-references
+    for (size_t i = 0; i < count; i++) {
+        if (records[i].iov_len > RECORD_LOG_MAX_PAYLOAD) {
+            LOG_ERR("Record of %zu bytes exceeds the maximum record size", records[i].iov_len);
+            return -1;
+        }
+    }
+    for (size_t done = 0; done < count;) {
+        size_t n = count - done < APPEND_BATCH ? count - done : APPEND_BATCH;
+        size_t total = 0, repeats = 0, saved = 0;
+        // Index the records before they are written: a stored record must never be missing from replays
+        if (reserve_offsets(&log->offsets, &log->capacity, log->count + n) != 0) {
+            LOG_ERR("Failed to grow record index of %s: %s", log->path, strerror(ENOMEM));
+            return -1;
+        }
+        for (size_t i = 0; i < n; i++) {
+            struct iovec record = records[done + i];
+            struct record_header *header = &headers[i];
+            header->flags = RECORD_LOG_DATA;
+            // A payload no longer than a back-reference is cheaper to store again
+            if (log->dedup && record.iov_len > sizeof(targets[i]) && record.iov_len <= RECORD_LOG_DEDUP_MAX_RECORD) {
+                uint32_t hash = crc32c(0, record.iov_base, record.iov_len);
+                struct dedup_entry *entry = &log->dedup->slots[hash & (RECORD_LOG_DEDUP_SLOTS - 1)];
+                if (entry->length == record.iov_len && entry->hash == hash &&
+                    memcmp(entry->payload, record.iov_base, record.iov_len) == 0) {
+                    targets[i] = entry->offset;
+                    saved += record_size((uint32_t)record.iov_len) - record_size(sizeof(targets[i]));
+                    repeats++;
+                    record = (struct iovec){ .iov_base = &targets[i], .iov_len = sizeof(targets[i]) };
+                    header->flags = RECORD_LOG_BACKREF;
+                } else {
+                    dedup_remember(entry, hash, record.iov_base, record.iov_len, (uint64_t)log->end + total);
+                }
+            }
+            header->magic = RECORD_LOG_MAGIC;
+            header->length = (uint32_t)record.iov_len;
+            header->crc = record_crc(header, record.iov_base);
+            size_t size = record_size(header->length);
+            iov[3 * i] = (struct iovec){ .iov_base = header, .iov_len = sizeof(*header) };
+            iov[3 * i + 1] = record;
+            iov[3 * i + 2] = (struct iovec){ .iov_base = (void *)padding, .iov_len = size - sizeof(*header) - record.iov_len };
+            total += size;
+        }
+        TRACE_BEGIN(write_span);
+        ssize_t written = writev(log->fd, iov, (int)(3 * n));
+        TRACE_END(write_span, "write", written);
+        if (written != (ssize_t)total) {
+            LOG_ERR("Failed to append record to %s: %s", log->path, written < 0 ? strerror(errno) : "short write");
+            if (ftruncate(log->fd, log->end) < 0) { // Never leave a torn record behind
+                LOG_ERR("Failed to truncate torn record in %s: %s", log->path, strerror(errno));
+            }
+            if (log->dedup) dedup_forget(log->dedup); // It may point at records that were just truncated
+            return -1;
+        }
+        if (repeats > 0) {
+            metrics_add(METRIC_DEDUP_RECORDS, repeats);
+            metrics_add(METRIC_DEDUP_SAVED_BYTES, saved);
+        }
+        for (size_t i = 0; i < n; i++) {
+            log->offsets[log->count++] = (uint64_t)log->end; // Reserved above
+            log->end += record_size(headers[i].length);
+            log->payload_bytes += headers[i].length;
+        }
+        done += n;
+    }
+    if (fsync_policy == FSYNC_ALWAYS && metrics_fsync(log->fd) < 0) { // One sync covers the whole batch
+        LOG_ERR("Failed to sync file %s: %s", log->path, strerror(errno));
+    }
+    return 0;
+}
+
+ssize_t record_log_read_referenced(int fd, uint64_t offset, char *payload) {
+    struct record_header header;
+    if (pread(fd, &header, sizeof(header), (off_t)offset) != (ssize_t)sizeof(header) ||
+        header.magic != RECORD_LOG_MAGIC || header.flags != RECORD_LOG_DATA || header.length > RECORD_LOG_DEDUP_MAX_RECORD) {
+        return -1;
+    }
+    if (pread(fd, payload, header.length, (off_t)(offset + sizeof(header))) != (ssize_t)header.length ||
+        record_crc(&header, payload) != header.crc) {
+        return -1;
+    }
+    return header.length;
+}
+
+// Payload of the data record a back-reference of a replay names, from the replay's cache or else from the log
+static const char *replay_referenced(struct record_log *log, struct dedup_entry *cache, uint64_t offset, uint32_t *length) {
+    struct dedup_entry *entry = &cache[(offset / RECORD_LOG_ALIGN) % RECORD_LOG_REPLAY_CACHE];
+    if (entry->length == 0 || entry->offset != offset) {
+        if (!entry->payload && !(entry->payload = malloc(RECORD_LOG_DEDUP_MAX_RECORD))) return NULL;
+        ssize_t got = record_log_read_referenced(log->fd, offset, entry->payload);
+        entry->length = got > 0 ? (uint32_t)got : 0;
+        entry->offset = offset;
+        if (got <= 0) return NULL; // Repeats are never empty
+    }
+    *length = entry->length;
+    return entry->payload;
+}
+
+// Payload of the data record at offset if the record lies in the part of the log a replay has in chunk
+// Parameters:
+// - chunk: Bytes of the log starting at offset base.
+// - limit: Bytes of chunk that may be used.
+static const char *chunk_referenced(const char *chunk, uint64_t base, size_t limit, uint64_t offset, uint32_t *length) {
+    struct record_header header;
+    if (offset < base || offset - base + sizeof(header) > limit) return NULL;
+    memcpy(&header, chunk + (offset - base), sizeof(header));
+    if (header.flags != RECORD_LOG_DATA || offset - base + sizeof(header) + header.length > limit) return NULL;
+    *length = header.length;
+    return chunk + (offset - base) + sizeof(header);
+}
+
+ssize_t record_log_replay(struct record_log *log, int sockfd) {
+    char *chunk = malloc(RECORD_LOG_REPLAY_CHUNK);
+    char *out = malloc(RECORD_LOG_REPLAY_CHUNK); // Payloads gathered from chunk and the cache, sent in one go
+    struct dedup_entry *cache = NULL; // Allocated at the first back-reference
+    if (!chunk || !out) {
+        LOG_ERR("Failed to allocate replay buffer: %s", strerror(errno));
+        free(chunk);
+        free(out);
+        return -1;
+    }
+    ssize_t sent = 0;
+    size_t pending = 0; // Bytes gathered in out
+    size_t i = 0;
+    while (i < log->count && sent >= 0) {
+        off_t base = (off_t)log->offsets[i];
+        size_t want = (size_t)(log->end - base) < RECORD_LOG_REPLAY_CHUNK ? (size_t)(log->end - base) : RECORD_LOG_REPLAY_CHUNK;
+        ssize_t got = pread(log->fd, chunk, want, base);
+        if (got < (ssize_t)sizeof(struct record_header)) {
+            LOG_ERR("Failed to read record log %s: %s", log->path, got < 0 ? strerror(errno) : "short read");
+            sent = -1;
+            break;
+        }
+        // Gather the payloads of all records fully contained in the chunk
+        size_t first = i;
+        while (i < log->count && log->offsets[i] - (uint64_t)base + sizeof(struct record_header) <= (size_t)got) {
+            size_t at = (size_t)(log->offsets[i] - (uint64_t)base);
+            struct record_header header;
+            memcpy(&header, chunk + at, sizeof(header));
+            if (at + sizeof(header) + header.length > (size_t)got) break;
+            const char *payload = chunk + at + sizeof(header);
+            uint32_t length = header.length;
+            if (header.flags == RECORD_LOG_BACKREF) {
+                uint64_t target;
+                const char *reference = payload;
+                payload = NULL;
+                if (header.length == sizeof(target)) {
+                    memcpy(&target, reference, sizeof(target));
+                    // Repeats usually name a record of the same chunk, otherwise the cache or the file has it
+                    payload = chunk_referenced(chunk, (uint64_t)base, at, target, &length);
+                    if (!payload && !cache) cache = (struct dedup_entry *)calloc(RECORD_LOG_REPLAY_CACHE, sizeof(*cache));
+                    if (!payload && cache) payload = replay_referenced(log, cache, target, &length);
+                }
+                if (!payload) {
+                    LOG_ERR("Failed to expand the back-reference at offset %llu of %s", (unsigned long long)log->offsets[i], log->path);
+                    sent = -1;
+                    break;
+                }
+            }
+            if (pending + length > RECORD_LOG_REPLAY_CHUNK) {
+                if (send_all(sockfd, out, pending) < 0) {
+                    sent = -1;
+                    break;
+                }
+                sent += pending;
+                pending = 0;
+            }
+            memcpy(out + pending, payload, length);
+            pending += length;
+            i++;
+        }
+        if (sent < 0 || i > first) continue;
+        // The next record is larger than the chunk: stream its payload straight from the file
+        if (pending > 0 && send_all(sockfd, out, pending) < 0) {
+            sent = -1;
+            break;
+        }
+        sent += pending;
+        pending = 0;
+        struct record_header header;
+        memcpy(&header, chunk, sizeof(header));
+        off_t at = base + sizeof(header);
+        size_t left = header.length;
+        while (left > 0) {
+            size_t piece = left < RECORD_LOG_REPLAY_CHUNK ? left : RECORD_LOG_REPLAY_CHUNK;
+            got = pread(log->fd, chunk, piece, at);
+            if (got <= 0 || send_all(sockfd, chunk, (size_t)got) < 0) {
+                sent = -1;
+                break;
+            }
+            at += got;
+            left -= got;
+            sent += got;
+        }
+        i++;
+    }
+    if (sent >= 0 && pending > 0) sent = send_all(sockfd, out, pending) < 0 ? -1 : sent + (ssize_t)pending;
+    if (cache) free_entries(cache, RECORD_LOG_REPLAY_CACHE);
+    free(cache);
+    free(out);
+    free(chunk);
+    return sent;
+}
+
+void record_log_close(struct record_log *log) {
+    if (log->fd >= 0) close(log->fd);
+    if (log->dedup) free_entries(log->dedup->slots, RECORD_LOG_DEDUP_SLOTS);
+    free(log->dedup);
+    free(log->offsets);
+    free(log->path);
+    memset(log, 0, sizeof(*log));
+    log->fd = -1;
+}
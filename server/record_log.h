@@ -0,0 +1,113 @@
+#ifndef RECORD_LOG_H
+#define RECORD_LOG_H
+// record_log.h
+// Crash-consistent record log used by the persistent mode (-p) of the AESD socket server.
+// Every record on disk is a fixed header (magic, payload length, flags, CRC32C) followed by the payload,
+// padded to RECORD_LOG_ALIGN bytes. On startup the log is scanned in parallel, every record is validated
+// against its CRC, and a torn or corrupt tail left behind by a power loss is truncated away.
+// With deduplication (-e) every log remembers its last RECORD_LOG_DEDUP_SLOTS distinct short payloads in a
+// table indexed by their CRC32C. A byte-identical repeat is written as a RECORD_LOG_BACKREF record holding the
+// offset of the data record it repeats; replays and the replication stream expand it again, so readers see
+// the exact byte stream that was received. Back-references always point at an earlier data record, so
+// truncating a torn tail never leaves one dangling.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define AESD_PERSIST_FILE "/var/tmp/aesdsocketdata.rec"
+#define RECORD_LOG_MAGIC 0x44534541u // "AESD" in little endian
+#define RECORD_LOG_ALIGN 8
+#define RECORD_LOG_MAX_PAYLOAD (64u * 1024u * 1024u) // Upper bound used to reject garbage lengths
+#define RECORD_LOG_MAX_THREADS 16 // Upper bound on recovery threads
+#define RECORD_LOG_REPLAY_CHUNK (256 * 1024) // Bytes read from the log per pread during replay
+#define RECORD_LOG_MIN_SEGMENT (8u * 1024u * 1024u) // Smallest slice of the log handed to one recovery thread
+
+#define RECORD_LOG_DEDUP_SLOTS 1024 // Distinct recent payloads remembered per log
+#define RECORD_LOG_DEDUP_MAX_RECORD 1024 // Longer payloads are always stored in full
+#define RECORD_LOG_REPLAY_CACHE 64 // Referenced payloads a replay keeps in memory
+#define RECORD_LOG_REPLAY_BUFFER (2 * RECORD_LOG_REPLAY_CHUNK + RECORD_LOG_REPLAY_CACHE * RECORD_LOG_DEDUP_MAX_RECORD)
+
+#define RECORD_LOG_DATA 0u // Plain data record
+#define RECORD_LOG_BACKREF 1u // Repeat of an earlier data record; the payload is its offset (uint64_t)
+
+struct record_header {
+    uint32_t magic; // RECORD_LOG_MAGIC
+    uint32_t length; // Payload length in bytes, excluding header and padding
+    uint32_t flags; // Record type (RECORD_LOG_DATA or RECORD_LOG_BACKREF)
+    uint32_t crc; // CRC32C over length, flags and payload
+};
+
+struct record_log {
+    int fd; // File descriptor of the log, opened for appending
+    char *path; // Path of the log file
+    off_t end; // Offset one past the last valid record
+    uint64_t *offsets; // In-memory index: file offset of every record
+    size_t count; // Number of records in the index
+    size_t capacity; // Allocated entries in offsets
+    uint64_t payload_bytes; // Sum of all payload lengths as stored, back-references count 8 bytes
+    struct record_dedup *dedup; // Window of recent distinct payloads, NULL unless deduplicating
+};
+
+extern bool record_log_dedup; // Logs opened from now on write repeats as back-references (-e)
+
+// Function to open a record log and recover it
+// This function opens (or creates) the log at the given path, validates every record using up to
+// `threads` scanning threads, truncates any torn tail and rebuilds the in-memory offset index.
+// Parameters:
+// - log: Pointer to the record_log structure to initialize.
+// - path: Path of the log file.
+// - threads: Maximum number of recovery threads, 0 selects the number of online CPUs.
+// Returns: 0 on success, -1 on failure.
+// Note: The time spent recovering the log is reported with LOG_SYS.
+int record_log_open(struct record_log *log, const char *path, int threads);
+
+// Function to append a record to the log
+// This function frames the payload with a header, writes it with a single write() and syncs it to disk.
+// A repeat of a payload in the deduplication window is written as a back-reference instead.
+// A partially written record is truncated away so that the log never contains a torn record.
+// Parameters:
+// - log: Pointer to an open record log.
+// - data: Pointer to the payload.
+// - length: Payload length in bytes.
+// Returns: 0 on success, -1 on failure.
+// Note: The caller must serialize appends and replays (file_mutex).
+int record_log_append(struct record_log *log, const char *data, size_t length);
+
+// Function to append several records with a single sync
+// This function frames every record and writes them with as few writev() calls as possible, then syncs once.
+// Parameters:
+// - log: Pointer to an open record log.
+// - records: Array of payloads, one record each.
+// - count: Number of records.
+// Returns: 0 on success, -1 on failure. Records written before a failure stay in the log.
+// Note: The caller must serialize appends and replays (file_mutex).
+int record_log_append_batch(struct record_log *log, const struct iovec *records, size_t count);
+
+// Function to send every payload in the log to a socket
+// This function walks the in-memory index and streams the payloads, without headers, to sockfd, expanding
+// back-references. It uses at most RECORD_LOG_REPLAY_BUFFER bytes of buffers.
+// Parameters:
+// - log: Pointer to an open record log.
+// - sockfd: Socket to send the payloads to.
+// Returns: Number of payload bytes sent, or -1 on failure.
+ssize_t record_log_replay(struct record_log *log, int sockfd);
+
+// Function to read the payload of the data record at offset, as a back-reference names it
+// Parameters:
+// - fd: The log file.
+// - offset: Offset of the record.
+// - payload: Receives the payload, at least RECORD_LOG_DEDUP_MAX_RECORD bytes.
+// Returns: Payload length, or -1 if no valid data record of at most RECORD_LOG_DEDUP_MAX_RECORD bytes is there.
+ssize_t record_log_read_referenced(int fd, uint64_t offset, char *payload);
+
+// Function to close a record log and free its index
+void record_log_close(struct record_log *log);
+
+// Function to compute the CRC32C (Castagnoli) of a buffer
+// Uses the SSE4.2 crc32 instruction when the CPU supports it and a table driven implementation otherwise.
+uint32_t crc32c(uint32_t crc, const void *data, size_t length);
+
+#endif // RECORD_LOG_H
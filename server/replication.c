@@ -0,0 +1,280 @@
+#include "replication.h"
+#include "socket.h"
+#include "record_log.h"
+#include "metrics.h"
+#include "memacct.h"
+#include "handoff.h"
+
+extern struct record_log record_log;
+
+bool read_only = false;
+
+// End of the default namespace's log that senders may stream, published under file_mutex
+static _Atomic uint64_t committed_end;
+static _Atomic uint64_t committed_ns;
+static bool replicating = false; // Set once the replication socket exists; commits are free until then
+static atomic_int followers; // Connected followers; commits only wake senders if there are any
+static pthread_mutex_t commit_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t commit_cond = PTHREAD_COND_INITIALIZER;
+
+// Follower side
+static pthread_t follow_thread;
+static bool following = false;
+static const char *follow_path;
+static int follow_fd = -1; // Connection to the primary, shut down to stop the follower
+
+static int unix_address(const char *path, struct sockaddr_un *addr) {
+    if (strlen(path) >= sizeof(addr->sun_path)) return -1;
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strncpy(addr->sun_path, path, sizeof(addr->sun_path) - 1);
+    return 0;
+}
+
+int replication_listen(const char *path) {
+    struct sockaddr_un addr;
+    if (unix_address(path, &addr) != 0) {
+        LOG_ERR("Replication socket path %s is too long", path);
+        return -1;
+    }
+    int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) return -1;
+    unlink(path); // Left behind by a previous run
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sockfd, listen_backlog) < 0) {
+        LOG_ERR("Failed to set up replication socket %s: %s", path, strerror(errno));
+        close(sockfd);
+        return -1;
+    }
+    // The log may already hold records, e.g. after a takeover or in persistent mode
+    struct stat st;
+    uint64_t end = persistent_log ? (uint64_t)record_log.end : stat(default_shard.path, &st) == 0 ? (uint64_t)st.st_size : 0;
+    atomic_store(&committed_end, end);
+    atomic_store(&committed_ns, metrics_now());
+    replicating = true;
+    return sockfd;
+}
+
+void replication_commit(size_t length) {
+    if (!replicating) return;
+    uint64_t end = persistent_log ? (uint64_t)record_log.end : atomic_load_explicit(&committed_end, memory_order_relaxed) + length;
+    atomic_store_explicit(&committed_ns, metrics_now(), memory_order_relaxed);
+    atomic_store_explicit(&committed_end, end, memory_order_release);
+    if (atomic_load_explicit(&followers, memory_order_relaxed) > 0) {
+        pthread_mutex_lock(&commit_mutex);
+        pthread_cond_broadcast(&commit_cond);
+        pthread_mutex_unlock(&commit_mutex);
+    }
+}
+
+// Wait until the log grows past position or the heartbeat is due; returns the committed end
+static uint64_t wait_for_commit(uint64_t position) {
+    pthread_mutex_lock(&commit_mutex);
+    uint64_t end = atomic_load_explicit(&committed_end, memory_order_acquire);
+    if (end == position && !exit_requested) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += REPLICATION_HEARTBEAT_MS / 1000;
+        pthread_cond_timedwait(&commit_cond, &commit_mutex, &deadline);
+        end = atomic_load_explicit(&committed_end, memory_order_acquire);
+    }
+    pthread_mutex_unlock(&commit_mutex);
+    return end;
+}
+
+static int send_frame(int sockfd, const char *payload, uint32_t length, uint64_t position, uint64_t end) {
+    struct replication_frame frame = { .magic = REPLICATION_MAGIC, .length = length, .position = position,
+                                       .committed = end, .commit_ns = atomic_load(&committed_ns) };
+    if (send_all(sockfd, (const char *)&frame, sizeof(frame)) < 0) return -1;
+    if (length > 0 && send_all(sockfd, payload, length) < 0) return -1;
+    metrics_add(METRIC_REPLICATION_SENT_BYTES, sizeof(frame) + length);
+    return 0;
+}
+
+// Read exactly length bytes at offset; the range is committed, so a short read means the log was replaced
+static int read_at(int fd, void *buffer, size_t length, uint64_t offset) {
+    char *p = (char *)buffer;
+    while (length > 0) {
+        ssize_t n = pread(fd, p, length, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        offset += n;
+        length -= n;
+    }
+    return 0;
+}
+
+// Stream the committed range [position, end) of the log; returns the new position, or -1 on failure
+static int64_t stream_range(int sockfd, int fd, char *buffer, uint64_t position, uint64_t end) {
+    while (position < end && !exit_requested) {
+        if (!persistent_log) {
+            size_t length = end - position < REPLICATION_CHUNK ? end - position : REPLICATION_CHUNK;
+            if (read_at(fd, buffer, length, position) < 0) return -1;
+            position += length;
+            if (send_frame(sockfd, buffer, length, position, end) < 0) return -1;
+            continue;
+        }
+        // Record log: send the payloads, one record at a time in chunks of at most REPLICATION_CHUNK
+        struct record_header header;
+        if (read_at(fd, &header, sizeof(header), position) < 0 || header.magic != RECORD_LOG_MAGIC) return -1;
+        uint64_t next = position + sizeof(header) + ((header.length + RECORD_LOG_ALIGN - 1) & ~(uint64_t)(RECORD_LOG_ALIGN - 1));
+        uint64_t payload = position + sizeof(header);
+        if (header.flags == RECORD_LOG_BACKREF) {
+            // A deduplicated repeat: send the payload of the data record it names, followers get plain bytes
+            uint64_t target;
+            if (header.length != sizeof(target) || read_at(fd, &target, sizeof(target), payload) < 0 ||
+                read_at(fd, &header, sizeof(header), target) < 0 || header.magic != RECORD_LOG_MAGIC ||
+                header.flags != RECORD_LOG_DATA) {
+                return -1;
+            }
+            payload = target + sizeof(header);
+        }
+        uint32_t sent = 0;
+        do {
+            uint32_t length = header.length - sent < REPLICATION_CHUNK ? header.length - sent : REPLICATION_CHUNK;
+            if (length > 0 && read_at(fd, buffer, length, payload + sent) < 0) return -1;
+            sent += length;
+            if (send_frame(sockfd, buffer, length, sent == header.length ? next : position, end) < 0) return -1;
+        } while (sent < header.length);
+        position = next;
+    }
+    return (int64_t)position;
+}
+
+static void *serve_follower(void *arg) {
+    int sockfd = (int)(intptr_t)arg;
+    if (!handoff_log_wait()) { // Nothing is committed before the previous instance releases the log
+        atomic_fetch_sub(&followers, 1);
+        close(sockfd); // Exiting
+        return NULL;
+    }
+    char *buffer = (char *)malloc(REPLICATION_CHUNK);
+    int fd = open(persistent_log ? persist_path : default_shard.path, O_RDONLY | O_CLOEXEC | O_CREAT, 0644);
+    if (!buffer || fd < 0) {
+        LOG_ERR("Failed to set up replication to a follower: %s", strerror(errno));
+    } else {
+        metrics_gauge_add(METRIC_REPLICATION_FOLLOWERS, 1);
+        memacct_charge(REPLICATION_CHUNK);
+        LOG_SYS("Follower connected, streaming the log");
+        uint64_t position = 0;
+        while (!exit_requested) {
+            uint64_t end = wait_for_commit(position);
+            if (end == position) {
+                if (send_frame(sockfd, NULL, 0, position, end) < 0) break; // Heartbeat
+                continue;
+            }
+            int64_t streamed = stream_range(sockfd, fd, buffer, position, end);
+            if (streamed < 0) break;
+            position = (uint64_t)streamed;
+        }
+        LOG_SYS("Follower disconnected");
+        metrics_gauge_add(METRIC_REPLICATION_FOLLOWERS, -1);
+        memacct_release(REPLICATION_CHUNK);
+    }
+    atomic_fetch_sub(&followers, 1);
+    if (fd >= 0) close(fd);
+    free(buffer);
+    close(sockfd);
+    return NULL;
+}
+
+void replication_serve(int sockfd) {
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    atomic_fetch_add(&followers, 1);
+    if (pthread_create(&thread, &attr, serve_follower, (void *)(intptr_t)sockfd) != 0) {
+        LOG_ERR("Failed to start replication thread");
+        atomic_fetch_sub(&followers, 1);
+        close(sockfd);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+// Apply one connection's worth of the stream to the replica; returns when the stream breaks
+static void apply_stream(int sockfd, char *buffer) {
+    lock_file();
+    int fd = open(default_shard.path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644); // Start over
+    unlock_file();
+    if (fd < 0) {
+        LOG_ERR("Failed to open replica %s: %s", default_shard.path, strerror(errno));
+        return;
+    }
+    int64_t lag = 0; // Exported lag, adjusted by differences since gauges are deltas
+    struct replication_frame frame;
+    while (!exit_requested && recv_all(sockfd, &frame, sizeof(frame)) == 0) {
+        if (frame.magic != REPLICATION_MAGIC || frame.length > REPLICATION_CHUNK) {
+            LOG_ERR("Invalid replication frame, resynchronizing");
+            break;
+        }
+        if (frame.length > 0) {
+            if (recv_all(sockfd, buffer, frame.length) < 0) break;
+            lock_file(); // Replays of the replica see whole frames
+            ssize_t written = write(fd, buffer, frame.length);
+            if (written == (ssize_t)frame.length && fsync_policy == FSYNC_ALWAYS) metrics_fsync(fd);
+            unlock_file();
+            if (written != (ssize_t)frame.length) {
+                LOG_ERR("Failed to write replica %s: %s", default_shard.path, strerror(errno));
+                break;
+            }
+            metrics_add(METRIC_REPLICATION_APPLIED_BYTES, frame.length);
+        }
+        int64_t behind = frame.committed > frame.position ? (int64_t)(frame.committed - frame.position) : 0;
+        metrics_gauge_add(METRIC_REPLICATION_LAG_BYTES, behind - lag);
+        lag = behind;
+        if (frame.length > 0 && behind == 0) {
+            uint64_t now = metrics_now();
+            metrics_observe(METRIC_REPLICATION_DELAY, now > frame.commit_ns ? now - frame.commit_ns : 0);
+        }
+    }
+    metrics_gauge_add(METRIC_REPLICATION_LAG_BYTES, -lag);
+    close(fd);
+}
+
+static void *follow(void *arg) {
+    (void)arg;
+    char *buffer = (char *)malloc(REPLICATION_CHUNK);
+    struct sockaddr_un addr;
+    if (!buffer || unix_address(follow_path, &addr) != 0) {
+        LOG_ERR("Failed to set up the follower of %s", follow_path);
+        free(buffer);
+        return NULL;
+    }
+    memacct_charge(REPLICATION_CHUNK);
+    bool reported = false;
+    while (!exit_requested) {
+        int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (sockfd >= 0 && connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            LOG_SYS("Following the primary at %s", follow_path);
+            reported = false;
+            __atomic_store_n(&follow_fd, sockfd, __ATOMIC_RELEASE);
+            apply_stream(sockfd, buffer);
+            __atomic_store_n(&follow_fd, -1, __ATOMIC_RELEASE);
+            LOG_SYS("Lost the primary at %s", follow_path);
+        } else if (!reported) {
+            LOG_ERR("Failed to connect to the primary at %s: %s, retrying", follow_path, strerror(errno));
+            reported = true;
+        }
+        if (sockfd >= 0) close(sockfd);
+        for (int i = 0; i < 10 && !exit_requested; i++) usleep(100000); // Retry after a second
+    }
+    memacct_release(REPLICATION_CHUNK);
+    free(buffer);
+    return NULL;
+}
+
+int replication_follow_start(const char *path) {
+    follow_path = path;
+    if (pthread_create(&follow_thread, NULL, follow, NULL) != 0) return -1;
+    following = true;
+    return 0;
+}
+
+void replication_follow_stop(void) {
+    if (!following) return;
+    int sockfd = __atomic_load_n(&follow_fd, __ATOMIC_ACQUIRE);
+    if (sockfd >= 0) shutdown(sockfd, SHUT_RDWR); // Wakes the follower thread from recv()
+    pthread_join(follow_thread, NULL);
+    following = false;
+}
@@ -0,0 +1,52 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+// replication.h
+// Log replication to read-only followers. A primary started with -x path serves a replication stream on that
+// AF_UNIX socket: every follower gets its own sender thread that tails the default namespace's log from the
+// beginning and streams the committed payload bytes in frames. Appends only publish the new end of the log
+// and wake the senders, so a slow follower delays nobody but itself.
+// A follower (-X path, usually with its own port -P) keeps a copy of the stream in its data file (-D, by
+// default AESD_REPLICA_FILE) and serves replays from it; records sent by its clients are not stored. It
+// reconnects and starts over from an empty copy whenever the stream breaks. The follower exports its lag behind the primary in its metrics.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define AESD_REPLICA_FILE "/var/tmp/aesdsocketreplica.txt" // Copy of the primary's log kept by a follower
+#define REPLICATION_MAGIC 0x4c504552u // "REPL" in little endian
+#define REPLICATION_CHUNK (64 * 1024) // Largest payload of a frame
+#define REPLICATION_HEARTBEAT_MS 1000 // An idle sender reports the committed end this often
+
+struct replication_frame {
+    uint32_t magic; // REPLICATION_MAGIC
+    uint32_t length; // Payload bytes following the frame, 0 for a heartbeat
+    uint64_t position; // Offset in the primary's log up to which the follower is after this frame
+    uint64_t committed; // End of the primary's log when the frame was sent
+    uint64_t commit_ns; // metrics_now() on the primary when committed was published
+};
+
+extern bool read_only; // True on a follower: client records are not stored
+
+// Function to create the replication socket of a primary
+// Returns: The listening socket, or -1 on failure.
+int replication_listen(const char *path);
+
+// Function to start streaming the log to a follower that connected to the replication socket
+// The connection is served by a detached thread and closed when the follower goes away or the server exits.
+void replication_serve(int sockfd);
+
+// Function to publish records appended to the default namespace
+// Parameters:
+// - length: Payload bytes appended; in persistent mode the record log's end is published instead.
+// Note: The caller must hold file_mutex.
+void replication_commit(size_t length);
+
+// Function to start following a primary
+// Returns: 0 on success, -1 if the follower thread cannot be started.
+int replication_follow_start(const char *path);
+
+// Function to stop following and wait for the follower thread
+void replication_follow_stop(void);
+
+#endif // REPLICATION_H
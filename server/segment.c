@@ -0,0 +1,291 @@
+#include "segment.h"
+#include "socket.h"
+#include "metrics.h"
+#include <glob.h>
+
+uint64_t segment_size = 0;
+const struct codec *segment_codec = &lz_codec;
+
+// Sealed segments waiting for the compression thread
+struct segment_job {
+    struct log_shard *shard;
+    unsigned number;
+    struct segment_job *next;
+};
+
+static struct segment_job *queue_head;
+static struct segment_job **queue_tail = &queue_head;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t compress_thread;
+static bool compressing = false; // The compression thread is running
+static atomic_bool stopping;
+
+// Function to name a segment file of a log
+// Returns: 0 on success, -1 (logged) if the name does not fit in SEGMENT_PATH_MAX.
+static int segment_path(char *buffer, const char *path, unsigned number, const char *suffix) {
+    int length = snprintf(buffer, SEGMENT_PATH_MAX, "%s.%u%s", path, number, suffix);
+    if (length < 0 || length >= SEGMENT_PATH_MAX) {
+        LOG_ERR("Segment names of %s are too long", path);
+        return -1;
+    }
+    return 0;
+}
+
+static void enqueue(struct log_shard *shard, unsigned number) {
+    if (!compressing) return; // Stays uncompressed
+    struct segment_job *job = (struct segment_job *)malloc(sizeof(*job));
+    if (!job) return;
+    *job = (struct segment_job){ shard, number, NULL };
+    pthread_mutex_lock(&queue_mutex);
+    *queue_tail = job;
+    queue_tail = &job->next;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+// Find the segments left behind by a previous instance, e.g. before a hot restart
+static void scan(struct log_shard *shard) {
+    char raw[SEGMENT_PATH_MAX], packed[SEGMENT_PATH_MAX];
+    unsigned number = 0;
+    for (;;) {
+        if (segment_path(raw, shard->path, number + 1, "") != 0) break;
+        if (segment_path(packed, shard->path, number + 1, ".z") != 0) break;
+        bool has_raw = access(raw, F_OK) == 0, has_packed = access(packed, F_OK) == 0;
+        if (!has_raw && !has_packed) break;
+        number++;
+        if (has_raw && has_packed) unlink(raw); // Compressed, but the copy was not removed yet
+        else if (has_raw) enqueue(shard, number);
+    }
+    struct stat st;
+    shard->segments = number;
+    shard->tail_bytes = stat(shard->path, &st) == 0 ? (uint64_t)st.st_size : 0;
+    shard->segments_scanned = true;
+}
+
+void segment_append(struct log_shard *shard, size_t length) {
+    if (segment_size == 0) return;
+    if (!shard->segments_scanned) scan(shard); // The size on disk already includes this append
+    else shard->tail_bytes += length;
+    if (shard->tail_bytes < segment_size) return;
+    char sealed[SEGMENT_PATH_MAX];
+    if (segment_path(sealed, shard->path, shard->segments + 1, "") != 0) return; // The active file keeps growing
+    if (rename(shard->path, sealed) != 0) {
+        LOG_ERR("Failed to seal log segment %s: %s", sealed, strerror(errno));
+        return;
+    }
+    shard->segments++;
+    shard->tail_bytes = 0; // The next append creates a new active file
+    enqueue(shard, shard->segments);
+}
+
+static int read_full(int fd, char *buffer, size_t length) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t n = read(fd, buffer + total, length - total);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        total += n;
+    }
+    return (int)total;
+}
+
+static int write_full(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+ssize_t segment_compress(const struct codec *codec, const char *src, const char *dst) {
+    int in = open(src, O_RDONLY | O_CLOEXEC);
+    int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    size_t capacity = codec->bound(SEGMENT_BLOCK);
+    char *raw = (char *)malloc(SEGMENT_BLOCK);
+    char *packed = (char *)malloc(sizeof(struct segment_block) + capacity);
+    ssize_t stored = -1;
+    if (in >= 0 && out >= 0 && raw && packed) {
+        struct segment_header header = { SEGMENT_MAGIC, codec->id, SEGMENT_BLOCK, 0 };
+        stored = write_full(out, (const char *)&header, sizeof(header)) == 0 ? (ssize_t)sizeof(header) : -1;
+        int length = 0;
+        while (stored >= 0 && !atomic_load(&stopping) && (length = read_full(in, raw, SEGMENT_BLOCK)) > 0) {
+            struct segment_block block = { (uint32_t)length, (uint32_t)length };
+            char *payload = packed + sizeof(block);
+            ssize_t n = codec->compress(raw, length, payload, capacity);
+            if (n > 0 && n < length) block.stored_length = (uint32_t)n;
+            else memcpy(payload, raw, length); // Incompressible, keep the block as it is
+            memcpy(packed, &block, sizeof(block));
+            if (write_full(out, packed, sizeof(block) + block.stored_length) < 0) stored = -1;
+            else stored += sizeof(block) + block.stored_length;
+            if (length < SEGMENT_BLOCK) break;
+        }
+        if (atomic_load(&stopping) || length < 0) stored = -1;
+        // The segment replaces the uncompressed copy, so it must be on disk before that one goes away
+        if (stored >= 0 && fsync(out) < 0) stored = -1;
+    }
+    if (stored < 0 && !atomic_load(&stopping)) LOG_ERR("Failed to compress %s: %s", src, strerror(errno));
+    free(packed);
+    free(raw);
+    if (out >= 0) close(out);
+    if (in >= 0) close(in);
+    return stored;
+}
+
+ssize_t segment_send(const char *path, int sockfd) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERR("Failed to open segment %s: %s", path, strerror(errno));
+        return -1;
+    }
+    struct segment_header header;
+    const struct codec *codec = NULL;
+    if (read_full(fd, (char *)&header, sizeof(header)) != (int)sizeof(header) || header.magic != SEGMENT_MAGIC ||
+        header.block_size > SEGMENT_BLOCK || !(codec = codec_by_id(header.codec))) {
+        LOG_ERR("Invalid segment %s", path);
+        close(fd);
+        return -1;
+    }
+    size_t capacity = codec->bound(SEGMENT_BLOCK);
+    char *packed = (char *)malloc(capacity);
+    char *raw = (char *)malloc(SEGMENT_BLOCK);
+    ssize_t sent = packed && raw ? 0 : -1;
+    struct segment_block block;
+    int got = 0;
+    while (sent >= 0 && (got = read_full(fd, (char *)&block, sizeof(block))) == (int)sizeof(block)) {
+        if (block.raw_length > SEGMENT_BLOCK || block.stored_length > capacity ||
+            read_full(fd, packed, block.stored_length) != (int)block.stored_length) {
+            LOG_ERR("Truncated or corrupt segment %s", path);
+            sent = -1;
+            break;
+        }
+        const char *data = packed;
+        if (block.stored_length != block.raw_length) {
+            if (codec->decompress(packed, block.stored_length, raw, SEGMENT_BLOCK) != (ssize_t)block.raw_length) {
+                LOG_ERR("Corrupt block in segment %s", path);
+                sent = -1;
+                break;
+            }
+            data = raw;
+        }
+        if (send_all(sockfd, data, block.raw_length) < 0) sent = -1;
+        else sent += block.raw_length;
+    }
+    if (sent >= 0 && got != 0) {
+        LOG_ERR("Truncated segment %s", path);
+        sent = -1;
+    }
+    free(raw);
+    free(packed);
+    close(fd);
+    return sent;
+}
+
+ssize_t segment_replay(struct log_shard *shard, int sockfd) {
+    if (!shard->segments_scanned) scan(shard);
+    ssize_t total = 0;
+    char path[SEGMENT_PATH_MAX];
+    for (unsigned number = 1; number <= shard->segments; number++) {
+        if (segment_path(path, shard->path, number, ".z") != 0) return -1;
+        ssize_t sent;
+        if (access(path, F_OK) == 0) {
+            sent = segment_send(path, sockfd);
+        } else {
+            segment_path(path, shard->path, number, ""); // Not compressed yet, and shorter
+            sent = send_file(path, sockfd);
+        }
+        if (sent < 0) return -1;
+        total += sent;
+    }
+    if (shard->tail_bytes == 0 && access(shard->path, F_OK) != 0) return total; // Just sealed
+    ssize_t sent = send_file(shard->path, sockfd);
+    return sent < 0 ? -1 : total + sent;
+}
+
+static void compress_segment(struct log_shard *shard, unsigned number) {
+    char raw[SEGMENT_PATH_MAX], packed[SEGMENT_PATH_MAX], partial[SEGMENT_PATH_MAX];
+    if (segment_path(raw, shard->path, number, "") != 0 || segment_path(packed, shard->path, number, ".z") != 0 ||
+        segment_path(partial, shard->path, number, ".z.tmp") != 0) {
+        return; // Stays uncompressed
+    }
+    struct stat st;
+    uint64_t raw_bytes = stat(raw, &st) == 0 ? (uint64_t)st.st_size : 0;
+    ssize_t stored = segment_compress(segment_codec, raw, partial);
+    if (stored < 0) {
+        unlink(partial);
+        return;
+    }
+    lock_shard(shard); // Replays see either the uncompressed or the compressed segment
+    bool replaced = rename(partial, packed) == 0 && unlink(raw) == 0;
+    unlock_shard(shard);
+    if (!replaced) {
+        LOG_ERR("Failed to replace segment %s: %s", raw, strerror(errno));
+        return;
+    }
+    metrics_add(METRIC_SEGMENT_RAW_BYTES, raw_bytes);
+    metrics_add(METRIC_SEGMENT_STORED_BYTES, stored);
+    LOG_DEBUG("Compressed %s from %llu to %lld bytes", raw, (unsigned long long)raw_bytes, (long long)stored);
+}
+
+static void *compress_segments(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&queue_mutex);
+    while (!atomic_load(&stopping)) {
+        struct segment_job *job = queue_head;
+        if (!job) {
+            pthread_cond_wait(&queue_cond, &queue_mutex);
+            continue;
+        }
+        queue_head = job->next;
+        if (!queue_head) queue_tail = &queue_head;
+        pthread_mutex_unlock(&queue_mutex);
+        compress_segment(job->shard, job->number);
+        free(job);
+        pthread_mutex_lock(&queue_mutex);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+    return NULL;
+}
+
+int segment_start(void) {
+    if (segment_size == 0 || !segment_codec) return 0;
+    atomic_store(&stopping, false);
+    if (pthread_create(&compress_thread, NULL, compress_segments, NULL) != 0) return -1;
+    compressing = true;
+    return 0;
+}
+
+void segment_stop(void) {
+    if (!compressing) return;
+    pthread_mutex_lock(&queue_mutex);
+    atomic_store(&stopping, true);
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+    pthread_join(compress_thread, NULL);
+    compressing = false;
+    while (queue_head) { // Left for the next run, which finds them uncompressed
+        struct segment_job *job = queue_head;
+        queue_head = job->next;
+        free(job);
+    }
+    queue_tail = &queue_head;
+}
+
+void segment_remove(const char *path) {
+    char pattern[SEGMENT_PATH_MAX];
+    int length = snprintf(pattern, sizeof(pattern), "%s.*", path);
+    if (length < 0 || (size_t)length >= sizeof(pattern)) return; // No segment of it can exist
+    glob_t found;
+    if (glob(pattern, 0, NULL, &found) != 0) return;
+    for (size_t i = 0; i < found.gl_pathc; i++) {
+        // Only ".<n>", ".<n>.z" and ".<n>.z.tmp": other logs named after the same stem also match the pattern
+        const char *suffix = found.gl_pathv[i] + length - 1, *end = suffix;
+        while (*end >= '0' && *end <= '9') end++;
+        if (end > suffix && (!*end || strcmp(end, ".z") == 0 || strcmp(end, ".z.tmp") == 0)) unlink(found.gl_pathv[i]);
+    }
+    globfree(&found);
+}
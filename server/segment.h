@@ -0,0 +1,70 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+// segment.h
+// Log segments of the text logs. With -z size the active file of a namespace (its hot tail) is sealed once it
+// reaches size bytes: it is renamed to "<log>.<n>" and a fresh file is started. A background thread then
+// compresses every sealed segment block by block with the codec chosen with -Z (see codec.h) into
+// "<log>.<n>.z" and removes the uncompressed copy. Replays stream the segments in order, decompressing one
+// block at a time, followed by the active file, so clients receive the same bytes as without segments.
+// The record log of the persistent mode (-p) is never segmented.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <sys/types.h>
+#include "codec.h"
+#include "namespace.h"
+
+#define SEGMENT_MAGIC 0x5a445341u // "ASDZ" in little endian
+#define SEGMENT_BLOCK (64 * 1024) // Uncompressed bytes per block
+#define SEGMENT_PATH_MAX PATH_MAX
+#define SEGMENT_SUFFIX_MAX 18 // Longest suffix of a segment file, ".<unsigned>.z.tmp", and its NUL
+#define SEGMENT_REPLAY_BUFFER (2 * SEGMENT_BLOCK + SEND_FILE_CHUNK) // Upper bound of the buffers of a replay
+
+struct segment_header {
+    uint32_t magic; // SEGMENT_MAGIC
+    uint32_t codec; // Id of the codec that compressed the blocks
+    uint32_t block_size; // SEGMENT_BLOCK when the segment was written
+    uint32_t reserved;
+};
+
+struct segment_block {
+    uint32_t raw_length; // Bytes of the block once decompressed
+    uint32_t stored_length; // Bytes following on disk; equal to raw_length if the block did not compress
+};
+
+extern uint64_t segment_size; // Seal the active file at this size, 0 disables segments (-z bytes)
+extern const struct codec *segment_codec; // Codec of sealed segments, NULL keeps them uncompressed (-Z)
+
+// Function to start the thread that compresses sealed segments
+// Returns: 0 on success, -1 if the thread cannot be started; segments then stay uncompressed.
+int segment_start(void);
+
+// Function to stop the compression thread
+// A segment being compressed is abandoned and compressed again by the next run.
+void segment_stop(void);
+
+// Function to account for an append to a namespace's text log, sealing the active file when it is full
+// Parameters:
+// - shard: The namespace that was appended to.
+// - length: Bytes appended.
+// Note: The caller must hold the namespace's mutex. Does nothing unless segment_size is set.
+void segment_append(struct log_shard *shard, size_t length);
+
+// Function to replay the sealed segments and the active file of a namespace's text log
+// Returns: Number of bytes sent, or -1 on failure.
+// Note: The caller must hold the namespace's mutex.
+ssize_t segment_replay(struct log_shard *shard, int sockfd);
+
+// Function to compress a file into a compressed segment
+// Returns: Bytes written to dst, or -1 on failure (dst is then incomplete and should be removed).
+ssize_t segment_compress(const struct codec *codec, const char *src, const char *dst);
+
+// Function to stream a compressed segment to a socket, decompressing it block by block
+// Returns: Number of decompressed bytes sent, or -1 on failure.
+ssize_t segment_send(const char *path, int sockfd);
+
+// Function to remove every segment of a text log, compressed or not
+void segment_remove(const char *path);
+
+#endif // SEGMENT_H
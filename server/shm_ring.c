@@ -0,0 +1,221 @@
+#include "shm_ring.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define SHM_RING_HEADER_SIZE 4096 // Header page preceding the data area
+#define SPINS_BEFORE_YIELD 64
+
+static size_t record_size(size_t length) {
+    return (sizeof(uint32_t) + length + SHM_RING_ALIGN - 1) & ~(size_t)(SHM_RING_ALIGN - 1);
+}
+
+static int futex(_Atomic uint32_t *word, int op, uint32_t value, const struct timespec *timeout) {
+    // Not FUTEX_PRIVATE_FLAG: the word is shared between processes
+    return (int)syscall(SYS_futex, (uint32_t *)word, op, value, timeout, NULL, 0);
+}
+
+static int map_ring(struct shm_ring *ring, const char *name, int fd, size_t map_size) {
+    void *base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return -1;
+    ring->header = (struct shm_ring_header *)base;
+    ring->data = (unsigned char *)base + SHM_RING_HEADER_SIZE;
+    ring->map_size = map_size;
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+    return 0;
+}
+
+int shm_ring_create(struct shm_ring *ring, const char *name, size_t capacity) {
+    memset(ring, 0, sizeof(*ring));
+    if (capacity < 4096 || (capacity & (capacity - 1)) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    shm_unlink(name); // Producers still attached to an old ring keep their own mapping
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0660);
+    if (fd < 0) return -1;
+    size_t map_size = SHM_RING_HEADER_SIZE + capacity;
+    if (ftruncate(fd, (off_t)map_size) < 0) {
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    if (map_ring(ring, name, fd, map_size) < 0) {
+        shm_unlink(name);
+        return -1;
+    }
+    struct shm_ring_header *header = ring->header;
+    header->version = SHM_RING_VERSION;
+    header->capacity = capacity;
+    atomic_store(&header->head, 0);
+    atomic_store(&header->tail, 0);
+    atomic_store(&header->producer_lock, 0);
+    atomic_store(&header->doorbell, 0);
+    atomic_store(&header->consumer_waiting, 0);
+    atomic_store(&header->records, 0);
+    atomic_thread_fence(memory_order_release);
+    header->magic = SHM_RING_MAGIC; // Producers refuse the ring until this is set
+    return 0;
+}
+
+int shm_ring_attach(struct shm_ring *ring, const char *name) {
+    memset(ring, 0, sizeof(*ring));
+    int fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size <= SHM_RING_HEADER_SIZE) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    if (map_ring(ring, name, fd, (size_t)st.st_size) < 0) return -1;
+    atomic_thread_fence(memory_order_acquire);
+    if (ring->header->magic != SHM_RING_MAGIC || ring->header->version != SHM_RING_VERSION ||
+        ring->header->capacity != ring->map_size - SHM_RING_HEADER_SIZE) {
+        shm_ring_detach(ring);
+        errno = EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+static void producer_lock(struct shm_ring_header *header) {
+    unsigned spins = 0;
+    uint32_t expected = 0;
+    while (!atomic_compare_exchange_weak_explicit(&header->producer_lock, &expected, 1, memory_order_acquire,
+                                                  memory_order_relaxed)) {
+        expected = 0;
+        if (++spins % SPINS_BEFORE_YIELD == 0) sched_yield();
+    }
+}
+
+static void producer_unlock(struct shm_ring_header *header) {
+    atomic_store_explicit(&header->producer_lock, 0, memory_order_release);
+}
+
+static void ring_doorbell(struct shm_ring_header *header) {
+    // Pairs with the seq_cst store of consumer_waiting in shm_ring_wait(): either the server sees the new
+    // head before sleeping or we see it waiting here.
+    if (atomic_load(&header->consumer_waiting)) {
+        atomic_fetch_add(&header->doorbell, 1);
+        futex(&header->doorbell, FUTEX_WAKE, 1, NULL);
+    }
+}
+
+static int ring_write(struct shm_ring *ring, const void *data, size_t length, bool block) {
+    struct shm_ring_header *header = ring->header;
+    uint64_t capacity = header->capacity;
+    size_t total = record_size(length);
+    if (total > capacity || length >= SHM_RING_WRAP) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    producer_lock(header);
+    unsigned spins = 0;
+    for (;;) {
+        uint64_t head = atomic_load_explicit(&header->head, memory_order_relaxed);
+        uint64_t tail = atomic_load_explicit(&header->tail, memory_order_acquire);
+        uint64_t space = capacity - (head - tail);
+        size_t position = head & (capacity - 1);
+        size_t contiguous = capacity - position;
+        if (total > contiguous && space >= contiguous) {
+            // Not enough room before the end of the buffer: mark the rest as unused and start over at 0
+            uint32_t wrap = SHM_RING_WRAP;
+            memcpy(ring->data + position, &wrap, sizeof(wrap));
+            atomic_store(&header->head, head + contiguous);
+            continue;
+        }
+        if (total <= contiguous && space >= total) {
+            uint32_t length32 = (uint32_t)length;
+            memcpy(ring->data + position, &length32, sizeof(length32));
+            memcpy(ring->data + position + sizeof(length32), data, length);
+            atomic_store(&header->head, head + total); // Publishes the record
+            producer_unlock(header);
+            ring_doorbell(header);
+            return 0;
+        }
+        if (!block) {
+            producer_unlock(header);
+            errno = EAGAIN;
+            return -1;
+        }
+        ring_doorbell(header); // Make sure the server is draining while we wait for space
+        if (++spins % SPINS_BEFORE_YIELD == 0) sched_yield();
+    }
+}
+
+int shm_ring_write(struct shm_ring *ring, const void *data, size_t length) {
+    return ring_write(ring, data, length, true);
+}
+
+int shm_ring_try_write(struct shm_ring *ring, const void *data, size_t length) {
+    return ring_write(ring, data, length, false);
+}
+
+size_t shm_ring_peek(struct shm_ring *ring, struct iovec *records, size_t max_records, uint64_t *bytes) {
+    struct shm_ring_header *header = ring->header;
+    uint64_t capacity = ring->map_size - SHM_RING_HEADER_SIZE; // Our own copy, not the shared field
+    uint64_t tail = atomic_load_explicit(&header->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&header->head, memory_order_acquire);
+    uint64_t position = tail;
+    size_t count = 0;
+    while (position < head && count < max_records) {
+        size_t offset = position & (capacity - 1);
+        uint32_t length;
+        memcpy(&length, ring->data + offset, sizeof(length));
+        if (length == SHM_RING_WRAP) {
+            position += capacity - offset;
+            continue;
+        }
+        size_t total = record_size(length);
+        if (total > capacity - offset || position + total > head) {
+            // Producers are separate processes: never trust a length read from shared memory
+            position = head;
+            break;
+        }
+        records[count].iov_base = ring->data + offset + sizeof(length);
+        records[count].iov_len = length;
+        count++;
+        position += total;
+    }
+    *bytes = position - tail;
+    return count;
+}
+
+void shm_ring_release(struct shm_ring *ring, uint64_t bytes, size_t records) {
+    struct shm_ring_header *header = ring->header;
+    atomic_fetch_add_explicit(&header->records, records, memory_order_relaxed);
+    atomic_store_explicit(&header->tail, atomic_load_explicit(&header->tail, memory_order_relaxed) + bytes,
+                          memory_order_release);
+}
+
+void shm_ring_wait(struct shm_ring *ring, int timeout_ms) {
+    struct shm_ring_header *header = ring->header;
+    atomic_store(&header->consumer_waiting, 1);
+    uint32_t bell = atomic_load(&header->doorbell);
+    if (atomic_load(&header->head) == atomic_load_explicit(&header->tail, memory_order_relaxed)) {
+        struct timespec timeout = { .tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000L };
+        futex(&header->doorbell, FUTEX_WAIT, bell, &timeout);
+    }
+    atomic_store(&header->consumer_waiting, 0);
+}
+
+void shm_ring_detach(struct shm_ring *ring) {
+    if (ring->header) munmap(ring->header, ring->map_size);
+    ring->header = NULL;
+    ring->data = NULL;
+}
+
+void shm_ring_destroy(struct shm_ring *ring) {
+    shm_ring_detach(ring);
+    if (ring->name[0]) shm_unlink(ring->name);
+}
@@ -0,0 +1,88 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+// shm_ring.h
+// Shared-memory ingest channel for co-located producers, built into libaesdshm.a.
+// The ring lives in /dev/shm and is created by aesdsocket (-m name). Producers map it and copy records
+// straight into it; the server drains whole batches and appends them to the same log as the socket clients.
+// A futex word in the ring is the doorbell: producers only make a syscall when the server is asleep.
+//
+// Producer usage:
+//     struct shm_ring ring;
+//     if (shm_ring_attach(&ring, "/aesdsocket") == 0) {
+//         shm_ring_write(&ring, "hello\n", 6);
+//         shm_ring_detach(&ring);
+//     }
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+
+#define SHM_RING_DEFAULT_NAME "/aesdsocket"
+#define SHM_RING_DEFAULT_SIZE (4u * 1024u * 1024u) // Data bytes in the ring, must be a power of two
+#define SHM_RING_MAGIC 0x474e5253u // "SRNG"
+#define SHM_RING_VERSION 1u
+#define SHM_RING_ALIGN 8 // Records start on 8-byte boundaries
+#define SHM_RING_WRAP UINT32_MAX // Length marking the unused end of the buffer before wrapping
+
+struct shm_ring_header {
+    uint32_t magic; // SHM_RING_MAGIC, written last when the ring is ready
+    uint32_t version; // SHM_RING_VERSION
+    uint64_t capacity; // Size of the data area in bytes
+    _Alignas(64) _Atomic uint64_t head; // Bytes published by producers
+    _Atomic uint32_t producer_lock; // Serializes producers that share the ring
+    _Alignas(64) _Atomic uint64_t tail; // Bytes consumed by the server
+    _Atomic uint32_t doorbell; // Futex word, bumped to wake the server
+    _Atomic uint32_t consumer_waiting; // Set while the server sleeps on the doorbell
+    _Atomic uint64_t records; // Records consumed, for monitoring
+};
+
+struct shm_ring {
+    struct shm_ring_header *header; // Shared header at the start of the mapping
+    unsigned char *data; // Data area following the header
+    size_t map_size; // Total size of the mapping
+    char name[64]; // Shared memory object name
+};
+
+// Function to create the ring (server side)
+// This function creates or replaces the shared memory object name with a data area of capacity bytes.
+// Returns: 0 on success, -1 on failure.
+int shm_ring_create(struct shm_ring *ring, const char *name, size_t capacity);
+
+// Function to attach to an existing ring (producer side, or a server taking over from a previous instance)
+// Returns: 0 on success, -1 if the ring does not exist or is not compatible.
+int shm_ring_attach(struct shm_ring *ring, const char *name);
+
+// Function to append one record to the ring, waiting for space if the ring is full
+// Returns: 0 on success, -1 if the record can never fit in the ring (errno is EMSGSIZE).
+int shm_ring_write(struct shm_ring *ring, const void *data, size_t length);
+
+// Function to append one record without waiting
+// Returns: 0 on success, -1 with errno EAGAIN if the ring is full or EMSGSIZE if the record can never fit.
+int shm_ring_try_write(struct shm_ring *ring, const void *data, size_t length);
+
+// Function to collect the next batch of records (server side)
+// This function fills records with up to max_records iovecs pointing into the shared data area, without copying.
+// The records stay valid until shm_ring_release() is called with the returned number of bytes.
+// Parameters:
+// - ring: Pointer to the ring.
+// - records: Array receiving the payload locations.
+// - max_records: Capacity of records.
+// - bytes: Receives the number of ring bytes covered by the batch, to be passed to shm_ring_release().
+// Returns: Number of records in the batch, 0 if the ring is empty.
+size_t shm_ring_peek(struct shm_ring *ring, struct iovec *records, size_t max_records, uint64_t *bytes);
+
+// Function to hand consumed bytes back to the producers (server side)
+void shm_ring_release(struct shm_ring *ring, uint64_t bytes, size_t records);
+
+// Function to sleep until producers ring the doorbell or timeout_ms elapses (server side)
+void shm_ring_wait(struct shm_ring *ring, int timeout_ms);
+
+// Function to unmap the ring (both sides)
+void shm_ring_detach(struct shm_ring *ring);
+
+// Function to unmap and remove the ring (server side)
+void shm_ring_destroy(struct shm_ring *ring);
+
+#endif // SHM_RING_H
@@ -1,10 +1,44 @@
 #include "socket.h"
+#include "record_log.h"
+#include "newline_scan.h"
+#include "shm_ring.h"
+#include "metrics.h"
+#include "trace.h"
+#include "handoff.h"
+#include "replication.h"
+#include "segment.h"
+#include "memacct.h"
+#include "capture.h"
+#include "config.h"
+#include "lockprof.h"
+#include "ratelimit.h"
+#include <sys/uio.h>
+
+#define WRITEV_BATCH 1024 // IOV_MAX on Linux
 
 sig_atomic_t exit_requested = 0; // Flag to indicate if exit is requested
-pthread_mutex_t file_mutex = PTHREAD_MUTEX_INITIALIZER;
+sig_atomic_t lock_report_requested = 0; // Flag to print the lock report, set on SIGUSR2
+struct prof_mutex file_mutex = PROF_MUTEX_INITIALIZER("file_mutex");
 struct thread_list_head thread_list = SLIST_HEAD_INITIALIZER(thread_list);
+static pthread_mutex_t closing_mutex = PTHREAD_MUTEX_INITIALIZER; // Orders a connection's close() and finished
 int global_server_socket_fd = -1; // Global variable to hold the server socket file descriptor
+int global_unix_socket_fd = -1; // Listening AF_UNIX socket, -1 unless enabled with -u
+int global_stats_socket_fd = -1; // Listening stats socket, -1 unless enabled with -s
+int global_replication_socket_fd = -1; // Listening replication socket of a primary, -1 unless enabled with -x
+int global_handoff_socket_fd = -1; // Listening handoff socket for hot restarts, -1 if it could not be created
+bool handed_off = false; // True once the listeners belong to a new instance
+int daemon_ready_fd = -1;
+uint64_t startup_ns = 0; // metrics_now() at the start of main(), for the startup gauges
+static int handoff_control_fd = -1; // Kept open until exit, which tells the new instance the log is free
 time_t current_time = 0; // Variable to hold the current time for logging
+bool persistent_log = false; // True if records are kept in the crash-consistent record log
+struct record_log record_log = { .fd = -1 }; // Record log used in persistent mode
+_Atomic enum fsync_policy fsync_policy = FSYNC_ALWAYS; // Sync every append unless told otherwise (-f never)
+_Atomic uint64_t idle_timeout_ms = 30000; // Clients silent for 30 s are evicted
+_Atomic uint64_t request_timeout_ms = 300000; // A request gets 5 minutes to arrive, its replay is not counted
+int listen_backlog = BACKLOG;
+_Atomic size_t recv_buffer_size = BUFFER_SIZE;
+_Atomic unsigned timestamp_interval_s = 10;
 
 void free_connection_info(struct connection_info *info) {
     if (info) free(info);
@@ -45,6 +79,7 @@ void setup_signal_handlers() {
 }
 
 void write_to_file(const char *filename, const char *data, size_t length) {
+    TRACE_BEGIN(write_span);
     FILE *file = fopen(filename, "a");
     if (!file) {
         LOG_ERR("Failed to open file %s for writing: %s", filename, strerror(errno));
@@ -59,14 +94,56 @@ void write_to_file(const char *filename, const char *data, size_t length) {
     if (ferror(file)) {
         LOG_ERR("Error writing to file %s: %s", filename, strerror(errno));
     }
-    if (fsync(fileno(file)) < 0) {
+    TRACE_END(write_span, "write", length);
+    if (fsync_policy == FSYNC_ALWAYS && metrics_fsync(fileno(file)) < 0) {
         LOG_ERR("Failed to sync file %s: %s", filename, strerror(errno));
     }
     fclose(file); // Close the file after writing
     //sync(); // Ensure all data is flushed to disk
 }
 
+void write_records_to_file(const char *filename, const struct iovec *records, size_t count) {
+    TRACE_BEGIN(write_span);
+    int fd = open(filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERR("Failed to open file %s for writing: %s", filename, strerror(errno));
+        return; // Return if file opening fails
+    }
+    struct iovec iov[WRITEV_BATCH];
+    size_t next = 0; // Next record to queue
+    while (next < count) {
+        int n = 0;
+        while (next < count && n < WRITEV_BATCH) iov[n++] = records[next++];
+        struct iovec *pending = iov;
+        while (n > 0) {
+            ssize_t written = writev(fd, pending, n);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                LOG_ERR("Failed to write all data to file %s: %s", filename, strerror(errno));
+                close(fd);
+                return;
+            }
+            // Skip what was written and retry the rest of a partial write
+            while (n > 0 && (size_t)written >= pending->iov_len) {
+                written -= pending->iov_len;
+                pending++;
+                n--;
+            }
+            if (n > 0) {
+                pending->iov_base = (char *)pending->iov_base + written;
+                pending->iov_len -= written;
+            }
+        }
+    }
+    TRACE_END(write_span, "write", count);
+    if (fsync_policy == FSYNC_ALWAYS && metrics_fsync(fd) < 0) { // One sync for the whole batch
+        LOG_ERR("Failed to sync file %s: %s", filename, strerror(errno));
+    }
+    close(fd);
+}
+
 size_t read_from_file(const char *filename, char *buffer, size_t buffer_size) {
+    TRACE_BEGIN(read_span);
     FILE *file = fopen(filename, "r");
     if (!file) {
         LOG_ERR("Failed to open file %s for reading: %s", filename, strerror(errno));
@@ -75,50 +152,338 @@ size_t read_from_file(const char *filename, char *buffer, size_t buffer_size) {
     size_t bytes_read = fread(buffer, sizeof(char), buffer_size - 1, file);
     buffer[bytes_read] = '\0'; // Null-terminate the buffer
     fclose(file); // Close the file after reading
+    TRACE_END(read_span, "read", bytes_read);
     return bytes_read; // Return the number of bytes read
 }   
 
+int send_all(int sockfd, const char *data, size_t length) {
+    while (length > 0) {
+        TRACE_BEGIN(send_span);
+        ssize_t sent = send(sockfd, data, length, MSG_NOSIGNAL);
+        TRACE_END(send_span, "send", sent);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return 0;
+}
+
+void lock_shard_at(struct log_shard *shard, const char *site) {
+    TRACE_BEGIN(wait_span);
+    uint64_t wait = prof_mutex_lock_at(shard->mutex, site);
+    TRACE_END(wait_span, "lock_wait", wait);
+    metrics_observe(METRIC_FILE_MUTEX_WAIT, wait);
+}
+
+void unlock_shard(struct log_shard *shard) {
+    TRACE_SPAN("lock_hold", shard->mutex->acquired_at, 0);
+    metrics_observe(METRIC_FILE_MUTEX_HOLD, prof_mutex_unlock(shard->mutex));
+}
+
+void log_lock_report(void) {
+    char *report = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&report, &length);
+    if (!out) return;
+    prof_mutex_report(out);
+    fclose(out);
+    for (char *save = NULL, *line = strtok_r(report, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        LOG_SYS("%s", line); // One message per line so the report fits the log slots
+    }
+    free(report);
+}
+
+int recv_all(int sockfd, void *data, size_t length) {
+    char *p = (char *)data;
+    while (length > 0) {
+        TRACE_BEGIN(recv_span);
+        ssize_t received = recv(sockfd, p, length, MSG_WAITALL);
+        TRACE_END(recv_span, "recv", received);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return -1;
+        metrics_add(METRIC_BYTES_RECEIVED, received);
+        p += received;
+        length -= received;
+    }
+    return 0;
+}
+
+void store_record(struct log_shard *shard, const char *data, size_t length) {
+    if (read_only) return; // A follower only holds the primary's records
+    metrics_add(METRIC_RECORDS_APPENDED, 1);
+    if (persistent_log) {
+        record_log_append(shard->log, data, length);
+    } else {
+        write_to_file(shard->path, data, length);
+        segment_append(shard, length);
+    }
+    if (shard == &default_shard) replication_commit(length);
+}
+
+void store_records(struct log_shard *shard, const struct iovec *records, size_t count) {
+    if (read_only) return;
+    metrics_add(METRIC_RECORDS_APPENDED, count);
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++) length += records[i].iov_len;
+    if (persistent_log) {
+        record_log_append_batch(shard->log, records, count);
+    } else {
+        write_records_to_file(shard->path, records, count);
+        segment_append(shard, length);
+    }
+    if (shard == &default_shard) replication_commit(length);
+}
+
+ssize_t send_file(const char *filename, int sockfd) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERR("Failed to open file %s for reading: %s", filename, strerror(errno));
+        return -1;
+    }
+    char chunk[SEND_FILE_CHUNK]; // Stream the file so replays are not truncated at BUFFER_SIZE
+    ssize_t total = 0;
+    ssize_t bytes_read;
+    for (;;) {
+        TRACE_BEGIN(read_span);
+        bytes_read = read(fd, chunk, sizeof(chunk));
+        TRACE_END(read_span, "read", bytes_read);
+        if (bytes_read <= 0) break;
+        if (send_all(sockfd, chunk, bytes_read) < 0) {
+            total = -1;
+            break;
+        }
+        total += bytes_read;
+    }
+    if (bytes_read < 0) {
+        LOG_ERR("Failed to read file %s: %s", filename, strerror(errno));
+        total = -1;
+    }
+    close(fd);
+    return total;
+}
+
+ssize_t replay_records(struct log_shard *shard, int sockfd) {
+    uint64_t start = metrics_now();
+    TRACE_BEGIN(replay_span);
+    ssize_t sent = persistent_log ? record_log_replay(shard->log, sockfd)
+                   : segment_size ? segment_replay(shard, sockfd) // Sealed segments, then the active file
+                   : send_file(shard->path, sockfd);
+    metrics_observe(METRIC_REPLAY, metrics_now() - start);
+    TRACE_END(replay_span, "replay", sent);
+    metrics_add(METRIC_REPLAYS, 1);
+    if (sent > 0) metrics_add(METRIC_BYTES_SENT, sent);
+    return sent;
+}
+
 void *timestamp(void *arg) {
     (void)arg;
     char timestamp_str[BUFFER_SIZE]; // Buffer to hold the timestamp
+    handoff_log_wait(); // False only once exit is requested
     while (!exit_requested) {
-        usleep(10000000); // Sleep for 1 second to avoid busy waiting
+        sleep(timestamp_interval_s); // Read on every round, so a reload applies from the next timestamp on
         current_time = time(NULL); // Get the current time
         strftime(timestamp_str, sizeof(timestamp_str), "timestamp:%Y-%m-%d %H:%M:%S\n", localtime(&current_time)); // Format the current time
-        pthread_mutex_lock(&file_mutex); // Lock the mutex for thread safety
-        write_to_file(AESD_SOCKET_FILE, timestamp_str, strlen(timestamp_str)); // Write the formatted time to the file
-        pthread_mutex_unlock(&file_mutex); // Unlock the mutex after writing
+        lock_file(); // Lock the mutex for thread safety
+        store_record(&default_shard, timestamp_str, strlen(timestamp_str)); // Write the formatted time to the log
+        unlock_file(); // Unlock the mutex after writing
         //LOG_SYS("Timestamp written to file %s", AESD_SOCKET_FILE);
     }
     pthread_exit(NULL); // Exit the thread when exit is requested
 }
 
+// Hold back a record until the client is within its rate (see ratelimit.h)
+// The wait ends early if the connection is shut down by its deadline or the server exits.
+static void throttle(struct socket_processing *sp, size_t length) {
+    uint64_t wait = ratelimit_record(sp->connection_info->_addr.sin_addr, length);
+    if (!wait) return;
+    metrics_add(METRIC_RECORDS_THROTTLED, 1);
+    uint64_t until = metrics_now() + wait;
+    struct pollfd connection = { .fd = sp->connection_info->_sockfd, .events = 0 }; // Only POLLHUP/POLLERR
+    for (uint64_t now = metrics_now(); now < until && !exit_requested; now = metrics_now()) {
+        uint64_t remaining_ms = (until - now + 999999) / 1000000;
+        if (poll(&connection, 1, remaining_ms > 1000 ? 1000 : (int)remaining_ms) > 0) break;
+    }
+    atomic_store_explicit(&sp->last_activity_ms, timer_now_ms(), memory_order_relaxed); // Waiting is not idling
+}
+
+// Free the receive buffer of a connection and return its reservation (see memacct.h)
+static void release_packet(struct socket_processing *sp) {
+    memacct_unreserve(sp->packet->reserved, sp->connection_info->_sockfd);
+    sp->packet->reserved = 0;
+    free(sp->packet->data);
+    sp->packet->data = NULL;
+    sp->packet->length = 0;
+}
+
+// Stream the log of the connection's namespace back to the client
+// The replay buffers are reserved before the mutex is taken: waiting for memory while holding it could stall
+// the connections that would release some.
+static void replay_to_client(struct socket_processing *sp) {
+    int sockfd = sp->connection_info->_sockfd;
+    size_t buffers = persistent_log ? RECORD_LOG_REPLAY_BUFFER : segment_size ? SEGMENT_REPLAY_BUFFER : SEND_FILE_CHUNK;
+    atomic_store(&sp->replaying, true);
+    if (memacct_reserve(buffers, sockfd) < 0) return; // Shut down while waiting
+    lock_shard(sp->shard); // Lock the mutex for thread safety
+    if (replay_records(sp->shard, sockfd) < 0) {
+        LOG_ERR("Failed to send response to client %s:%d: %s", sp->connection_info->_ip, ntohs(sp->connection_info->_addr.sin_port), strerror(errno));
+    }
+    unlock_shard(sp->shard); // Unlock the mutex after sending the response
+    memacct_unreserve(buffers, sockfd);
+}
+
+// Check whether the client opened the connection with BINARY_PREAMBLE
+// Text clients never start with a NUL byte, so newline clients only pay for a one byte peek and
+// the bytes stay queued in the socket for the newline framer.
+static bool binary_framing_requested(int sockfd) {
+    char preamble[BINARY_PREAMBLE_LEN];
+    if (recv(sockfd, preamble, 1, MSG_PEEK) != 1 || preamble[0] != '\0') return false;
+    if (recv(sockfd, preamble, BINARY_PREAMBLE_LEN, MSG_PEEK | MSG_WAITALL) != BINARY_PREAMBLE_LEN) return false;
+    if (memcmp(preamble, BINARY_PREAMBLE, BINARY_PREAMBLE_LEN) != 0) return false;
+    return recv_all(sockfd, preamble, BINARY_PREAMBLE_LEN) == 0; // Consume the preamble
+}
+
+// Handle a connection that uses length-prefixed framing
+// Every record is a 32-bit length in network byte order followed by the payload, which is received straight
+// into a buffer of the right size and appended without any delimiter scan. A zero length record ends the
+// session and requests the replay, which is the same raw byte stream newline clients get.
+static void binary_processing(struct socket_processing *sp) {
+    int sockfd = sp->connection_info->_sockfd;
+    size_t capacity = 0;
+    while (!exit_requested) {
+        uint32_t header;
+        if (recv_all(sockfd, &header, sizeof(header)) < 0) break; // Closed without requesting a replay
+        capture_data(sp->capture_id, &header, sizeof(header));
+        uint32_t length = ntohl(header);
+        if (length == 0) {
+            release_packet(sp); // Nothing left to store, free the record buffer before reserving the replay's
+            replay_to_client(sp);
+            break;
+        }
+        if (length > BINARY_MAX_RECORD) {
+            LOG_ERR("Record of %u bytes from client %s exceeds the limit of %d bytes", length, sp->connection_info->_ip, BINARY_MAX_RECORD);
+            break;
+        }
+        if (length > capacity) {
+            // Leave the payload in the socket until the in-flight budget has room for it
+            if (memacct_reserve(length - capacity, sockfd) < 0) break;
+            sp->packet->reserved += length - capacity;
+            char *data = (char *)realloc(sp->packet->data, length);
+            if (!data) {
+                LOG_ERR("Failed to allocate memory for data: %s", strerror(errno));
+                break;
+            }
+            sp->packet->data = data;
+            capacity = length;
+        }
+        if (recv_all(sockfd, sp->packet->data, length) < 0) break; // Torn record, drop it
+        capture_data(sp->capture_id, sp->packet->data, length);
+        atomic_store_explicit(&sp->last_activity_ms, timer_now_ms(), memory_order_relaxed);
+        sp->packet->length = length;
+        throttle(sp, length);
+        size_t prefix;
+        struct log_shard *shard = namespace_route(sp->listener_shard, sp->packet->data, length, &prefix);
+        lock_shard(shard); // Lock the mutex for thread safety
+        store_record(shard, sp->packet->data + prefix, length - prefix); // Write data to the log
+        unlock_shard(shard); // Unlock the mutex after writing
+        sp->shard = shard; // The replay sends back the namespace of the last record
+        if (memacct_over_budget()) {
+            release_packet(sp); // Do not keep a buffer beyond the budget between records
+            capacity = 0;
+        }
+        memacct_yield(sockfd); // The record is complete, let another connection over the budget
+    }
+    sp->connection_active = false;
+}
+
+void *shm_ingest(void *arg) {
+    struct shm_ring *ring = (struct shm_ring *)arg;
+    struct iovec records[SHM_INGEST_BATCH];
+    // An adopted ring is still read by the previous instance until it releases the log
+    if (!handoff_log_wait()) pthread_exit(NULL);
+    for (;;) {
+        if (exit_requested && handed_off) break; // The new instance adopts the ring and ingests the rest
+        uint64_t bytes = 0;
+        size_t count = shm_ring_peek(ring, records, SHM_INGEST_BATCH, &bytes);
+        if (bytes == 0) {
+            // Stop only once the ring is empty: the caller destroys it, and with it the unread records
+            if (exit_requested) break;
+            shm_ring_wait(ring, 100); // Sleep on the doorbell, waking up regularly to check exit_requested
+            continue;
+        }
+        // Append straight from shared memory, one lock and one sync per run of records of the same namespace
+        for (size_t first = 0, next; first < count; first = next) {
+            size_t prefix;
+            struct log_shard *shard = namespace_route(local_shard, records[first].iov_base, records[first].iov_len, &prefix);
+            records[first].iov_base = (char *)records[first].iov_base + prefix;
+            records[first].iov_len -= prefix;
+            for (next = first + 1; next < count; next++) {
+                if (namespace_route(local_shard, records[next].iov_base, records[next].iov_len, &prefix) != shard) break;
+                records[next].iov_base = (char *)records[next].iov_base + prefix;
+                records[next].iov_len -= prefix;
+            }
+            lock_shard(shard); // Lock the mutex for thread safety
+            store_records(shard, records + first, next - first);
+            unlock_shard(shard); // Unlock the mutex after writing
+        }
+        shm_ring_release(ring, bytes, count); // Producers may now reuse the space
+    }
+    pthread_exit(NULL); // Exit the thread when exit is requested and the ring is drained
+}
+
 void *data_processing(void* socket_processing) {
     struct socket_processing *sp = (struct socket_processing *)socket_processing;
     if (!sp || !sp->connection_info || !sp->packet) {
         LOG_ERR("Invalid socket processing structure");
         return NULL; // Return if the structure is invalid
     }
+    // During a takeover the client's data waits in the socket until the previous instance releases the log
+    bool owned = handoff_log_wait();
+    atomic_store_explicit(&sp->last_activity_ms, timer_now_ms(), memory_order_relaxed); // Waiting is not idling
+    if (!sp->listener_shard) { // Local client: local_shard is set up with the log
+        sp->listener_shard = sp->shard = local_shard;
+        sp->packet->mutex = local_shard->mutex;
+    }
 
-    char buffer[BUFFER_SIZE] = {0}; // Buffer to hold received data
+    if (owned && binary_framing_requested(sp->connection_info->_sockfd)) {
+        capture_data(sp->capture_id, BINARY_PREAMBLE, BINARY_PREAMBLE_LEN);
+        binary_processing(sp);
+    }
+
+    size_t buffer_size = recv_buffer_size; // Fixed for the connection, a reload may change the setting
+    char *buffer = (char *)malloc(buffer_size); // Buffer to hold received data
     ssize_t bytes_received;
-    char response[BUFFER_SIZE]; // Buffer to hold the response
-    while (!exit_requested && sp->connection_active) {
-        bytes_received = recv(sp->connection_info->_sockfd, buffer, sizeof(buffer) - 1, 0);
+    if (!buffer) LOG_ERR("Failed to allocate memory for the receive buffer: %s", strerror(errno));
+    while (buffer && !exit_requested && sp->connection_active) {
+        // Reserve room for the next read first; while the budget is exhausted the data stays in the socket
+        size_t needed = sp->packet->length + buffer_size;
+        if (needed > sp->packet->reserved) {
+            if (memacct_reserve(needed - sp->packet->reserved, sp->connection_info->_sockfd) < 0) break;
+            sp->packet->reserved = needed;
+        }
+        TRACE_BEGIN(recv_span);
+        bytes_received = recv(sp->connection_info->_sockfd, buffer, buffer_size - 1, 0);
+        TRACE_END(recv_span, "recv", bytes_received);
         if (bytes_received < 0) {
             LOG_ERR("Failed to receive data: %s", strerror(errno));
             //pthread_exit(NULL); // Exit the thread if receiving data fails
             //sp->connection_active = false; // Set connection_active flag to false
             break; // Return if receiving data fails
         } 
+        if (bytes_received == 0) {
+            break; // Client closed the connection before completing a packet
+        }
+        metrics_add(METRIC_BYTES_RECEIVED, bytes_received);
+        capture_data(sp->capture_id, buffer, bytes_received); // With the segmentation it arrived in
+        atomic_store_explicit(&sp->last_activity_ms, timer_now_ms(), memory_order_relaxed); // Picked up lazily by the timer
         
         //LOG_SYS("Received %zd bytes from client %s:%d", bytes_received, sp->connection_info->_ip, ntohs(sp->connection_info->_addr.sin_port));
         sp->packet->data = (char *)realloc(sp->packet->data, sp->packet->length + bytes_received + 1);
         if (!sp->packet->data) {
             LOG_ERR("Failed to allocate memory for data: %s", strerror(errno));
-            pthread_mutex_unlock(sp->packet->mutex); // Unlock the mutex before exiting
-            pthread_exit(NULL); // Exit the thread if memory allocation fails
-            break;    
+            break; // Drop the client; the mutex is not held here
         }
 
         memcpy(sp->packet->data + sp->packet->length, buffer, bytes_received);
@@ -126,29 +491,38 @@ void *data_processing(void* socket_processing) {
         sp->packet->data[sp->packet->length] = '\0'; // Null-terminate the data buffer
         //LOG_DEBUG("Data: %s", sp->packet->data); // Log the received data
         
-        if (strchr(sp->packet->data, '\n'))
+        // Only the newly received bytes can hold the delimiter; scanning raw bytes also copes with embedded NULs
+        if (scan_first_newline(sp->packet->data + sp->packet->length - bytes_received, bytes_received))
         {   
             sp->packet->end_of_packet = true; // Set end_of_packet flag to true if newline is received
-            pthread_mutex_lock(sp->packet->mutex); // Lock the mutex for thread safety
-            write_to_file(AESD_SOCKET_FILE, sp->packet->data, sp->packet->length); // Write data to file
-            pthread_mutex_unlock(sp->packet->mutex); // Unlock the mutex after sending the response
+            throttle(sp, sp->packet->length);
+            size_t prefix;
+            struct log_shard *shard = namespace_route(sp->listener_shard, sp->packet->data, sp->packet->length, &prefix);
+            lock_shard(shard); // Lock the mutex for thread safety
+            store_record(shard, sp->packet->data + prefix, sp->packet->length - prefix); // Write data to the log
+            unlock_shard(shard); // Unlock the mutex after sending the response
+            sp->shard = shard; // Replayed below
             //LOG_SYS("Received %zd bytes from client %s:%d", bytes_received, sp->connection_info->_ip, ntohs(sp->connection_info->_addr.sin_port));
             //LOG_DEBUG("Data: %s", sp->packet->data); // Log the received data
         }
         if (sp->packet->end_of_packet) {
             //LOG_SYS("End of packet detected for client %s:%d", sp->connection_info->_ip, ntohs(sp->connection_info->_addr.sin_port));
             sp->connection_active = false; // Set connection_active flag to false
-            pthread_mutex_lock(sp->packet->mutex); // Lock the mutex for thread safety
-            size_t bytes_read = read_from_file(AESD_SOCKET_FILE, response, sizeof(response)); // Read data from file
-            //LOG_DEBUG("Response: %s", response); // Log the response data
-            if (send(sp->connection_info->_sockfd, response, bytes_read, MSG_NOSIGNAL) < 0) {
-                LOG_ERR("Failed to send response to client %s:%d: %s", sp->connection_info->_ip, ntohs(sp->connection_info->_addr.sin_port), strerror(errno));
-            }
-            pthread_mutex_unlock(sp->packet->mutex); // Unlock the mutex after sending the response
+            release_packet(sp); // The record is stored, free its buffer before reserving the replay's
+            replay_to_client(sp); // Stream the namespace's log back to the client
         }
     }   
+    free(buffer);
     //LOG_SYS("Closed connection with client %s:%d", sp->connection_info->_ip, ntohs(sp->connection_info->_addr.sin_port));
+    timer_cancel(&sp->deadline); // Must precede close(): an expiring deadline shuts the socket down
+    if (sp->ratelimited) ratelimit_connection_close(sp->connection_info->_addr.sin_addr);
+    memacct_unreserve(sp->packet->reserved, sp->connection_info->_sockfd); // Before close() frees the socket number
+    capture_end(sp->capture_id);
+    pthread_mutex_lock(&closing_mutex); // drain_connections() may be shutting the socket down
     close(sp->connection_info->_sockfd); // Close the client socket
+    atomic_store(&sp->node->finished, true); // The accept loop may join this thread now
+    pthread_mutex_unlock(&closing_mutex);
+    metrics_gauge_add(METRIC_CONNECTIONS_ACTIVE, -1);
     free(sp->packet->data); // Free the data buffer
     free(sp->packet); // Free the data packet structure
     free_connection_info(sp->connection_info); // Free the connection info structure
@@ -194,7 +568,7 @@ int setup_socket(void* connection_info) {
         return -1; // Return if binding the socket fails
     }
     
-    if (listen(conn_info->_sockfd, BACKLOG) < 0) {
+    if (listen(conn_info->_sockfd, listen_backlog) < 0) {
         LOG_ERR("Failed to listen on socket: %s", strerror(errno));
         close(conn_info->_sockfd); // Close the socket
         //free_connection_info(conn_info); // Free the connection info structure
@@ -205,82 +579,322 @@ int setup_socket(void* connection_info) {
     return 0;
 }
 
+// Earliest deadline of a connection in timer_now_ms() time, or 0 if it has none
+// Neither deadline runs during the replay, which ends the request: its length depends on the size of the log,
+// not on the client.
+static uint64_t next_deadline(struct socket_processing *sp) {
+    if (atomic_load(&sp->replaying)) return 0;
+    uint64_t deadline = 0;
+    uint64_t idle_ms = idle_timeout_ms, request_ms = request_timeout_ms; // One reading of each setting
+    if (idle_ms) deadline = atomic_load_explicit(&sp->last_activity_ms, memory_order_relaxed) + idle_ms;
+    if (request_ms && (!deadline || sp->accepted_ms + request_ms < deadline)) {
+        deadline = sp->accepted_ms + request_ms;
+    }
+    return deadline;
+}
+
+// Timer function of a connection deadline
+// Receiving data only updates last_activity_ms, so the idle deadline is pushed back here, lazily, instead of
+// re-arming the timer on every recv(). A connection past its deadline is shut down, which wakes its thread
+// from recv() or send(); the thread then cleans up as if the client had closed the connection.
+static uint64_t connection_deadline(struct timer_entry *entry, uint64_t now_ms) {
+    struct socket_processing *sp = (struct socket_processing *)((char *)entry - offsetof(struct socket_processing, deadline));
+    uint64_t deadline = next_deadline(sp);
+    if (deadline > now_ms) return deadline;
+    if (!deadline) return 0;
+    uint64_t request_ms = request_timeout_ms;
+    LOG_SYS("Evicting client %s: %s deadline expired", sp->connection_info->_ip,
+            sp->accepted_ms + request_ms <= now_ms && request_ms ? "request" : "idle");
+    metrics_add(METRIC_CONNECTIONS_EVICTED, 1);
+    shutdown(sp->connection_info->_sockfd, SHUT_RDWR);
+    return 0;
+}
+
+// Join the data processing threads that have finished, so their stacks are not kept until shutdown
+static void reap_connections(void) {
+    thread_node_t *node = SLIST_FIRST(&thread_list), *next;
+    thread_node_t *previous = NULL;
+    while (node) {
+        next = SLIST_NEXT(node, entries);
+        if (atomic_load(&node->finished)) {
+            pthread_join(node->data_node, NULL);
+            if (previous) SLIST_NEXT(previous, entries) = next;
+            else SLIST_FIRST(&thread_list) = next;
+            free(node);
+        } else {
+            previous = node;
+        }
+        node = next;
+    }
+}
+
+void drain_connections(uint64_t timeout_ms) {
+    thread_node_t *node;
+    if (timeout_ms) {
+        uint64_t deadline = timer_now_ms() + timeout_ms;
+        while (!SLIST_EMPTY(&thread_list) && timer_now_ms() < deadline) {
+            reap_connections();
+            usleep(10000);
+        }
+        unsigned aborted = 0;
+        pthread_mutex_lock(&closing_mutex); // A connection that has not finished still has its socket and sp
+        SLIST_FOREACH(node, &thread_list, entries) {
+            if (atomic_load(&node->finished)) continue;
+            shutdown(node->sp->connection_info->_sockfd, SHUT_RDWR); // Its thread cleans up as if the client left
+            aborted++;
+        }
+        pthread_mutex_unlock(&closing_mutex);
+        if (aborted) LOG_SYS("Shut down %u connections still open after %llu ms", aborted, (unsigned long long)timeout_ms);
+    }
+    while (!SLIST_EMPTY(&thread_list)) {
+        node = SLIST_FIRST(&thread_list);
+        pthread_join(node->data_node, NULL);
+        SLIST_REMOVE_HEAD(&thread_list, entries);
+        free(node);
+    }
+}
+
+// Allocate the per-connection state for an accepted client and start its data processing thread
+static void start_connection(int client_accepted, struct sockaddr_in *addr, char *ip, struct log_shard *shard) {
+    bool ratelimited = ratelimit_enabled(); // Decided once: a reload may change it before the connection ends
+    if (ratelimited && !ratelimit_connection_open(addr->sin_addr)) {
+        metrics_add(METRIC_CONNECTIONS_REJECTED, 1); // Over the per-address connection cap
+        close(client_accepted);
+        return;
+    }
+    // Create a new socket processing structure for the client
+    struct socket_processing *sp = (struct socket_processing *)malloc(sizeof(struct socket_processing));
+    if (!sp) {
+        LOG_ERR("Failed to allocate memory for socket processing structure: %s", strerror(errno));
+        close(client_accepted); // Close the client socket if memory allocation fails
+        if (ratelimited) ratelimit_connection_close(addr->sin_addr);
+        return; // Drop the client if memory allocation fails
+    }
+    
+    sp->connection_info = create_connection_info(client_accepted, addr, ip);
+    if (!sp->connection_info) {
+        LOG_ERR("Failed to create connection info structure");
+        free(sp); // Free the socket processing structure if connection info creation fails
+        close(client_accepted); // Close the client socket if connection info creation fails
+        if (ratelimited) ratelimit_connection_close(addr->sin_addr);
+        return; // Drop the client if connection info creation fails
+    }
+    
+    sp->packet = (struct data_packet *)malloc(sizeof(struct data_packet));
+    if (!sp->packet) {
+        LOG_ERR("Failed to allocate memory for data packet: %s", strerror(errno));
+        free_connection_info(sp->connection_info); // Free the connection info structure
+        free(sp); // Free the socket processing structure
+        close(client_accepted); // Close the client socket if data packet allocation fails
+        if (ratelimited) ratelimit_connection_close(addr->sin_addr);
+        return; // Drop the client if data packet allocation fails
+    }
+    
+    sp->listener_shard = shard; // Records without a namespace prefix go to the listener's namespace
+    sp->shard = shard; // Until a record names another one
+    sp->packet->mutex = shard ? shard->mutex : NULL;
+    sp->packet->data = NULL; // Initialize data pointer to NULL
+    sp->packet->length = 0; // Initialize length to 0
+    sp->packet->end_of_packet = false; // No delimiter seen yet
+    sp->packet->reserved = 0; // Nothing accounted for until the first read
+    sp->connection_active = true; // Initialize connection_active flag to false
+    
+    thread_node_t *node = (thread_node_t *)malloc(sizeof(thread_node_t));
+    if (!node) {
+        LOG_ERR("Failed to allocate memory for thread node: %s", strerror(errno));
+        free(sp->packet->data); // Free the data buffer if thread node allocation fails
+        free(sp->packet); // Free the data packet structure if thread node allocation fails
+        free_connection_info(sp->connection_info); // Free the connection info structure if thread node allocation fails
+        free(sp); // Free the socket processing structure if thread node allocation fails
+        close(client_accepted); // Close the client socket if thread node allocation fails
+        if (ratelimited) ratelimit_connection_close(addr->sin_addr);
+        return; // Drop the client if thread node allocation fails
+    }
+    node->sp = sp; // Set the socket processing structure in the thread node
+    atomic_init(&node->finished, false);
+    sp->node = node;
+    memset(&sp->deadline, 0, sizeof(sp->deadline));
+    sp->accepted_ms = timer_now_ms();
+    atomic_init(&sp->last_activity_ms, sp->accepted_ms);
+    atomic_init(&sp->replaying, false);
+    sp->capture_id = capture_connection();
+    sp->ratelimited = ratelimited;
+    uint64_t deadline = next_deadline(sp);
+    if (deadline) timer_arm(&sp->deadline, deadline, connection_deadline);
+    metrics_add(METRIC_CONNECTIONS_ACCEPTED, 1);
+    metrics_gauge_add(METRIC_CONNECTIONS_ACTIVE, 1); // Dropped again by the data processing thread
+    pthread_create(&node->data_node, NULL, data_processing, (void *)sp); // Create a new thread for data processing
+    SLIST_INSERT_HEAD(&thread_list, node, entries); // Insert the thread node into
+}
+
+// Create a listening AF_UNIX stream socket at path, replacing a stale socket file
+static int listen_unix(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        LOG_ERR("Unix socket path %s is too long", path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+        LOG_ERR("Failed to create unix socket: %s", strerror(errno));
+        return -1;
+    }
+    unlink(path); // Remove a stale socket left behind by a previous run
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LOG_ERR("Failed to bind unix socket %s: %s", path, strerror(errno));
+        close(sockfd);
+        return -1;
+    }
+    if (listen(sockfd, listen_backlog) < 0) {
+        LOG_ERR("Failed to listen on unix socket %s: %s", path, strerror(errno));
+        close(sockfd);
+        unlink(path);
+        return -1;
+    }
+    return sockfd;
+}
+
+int setup_unix_socket(const char *path) {
+    global_unix_socket_fd = listen_unix(path);
+    return global_unix_socket_fd;
+}
+
+int setup_stats_socket(const char *path) {
+    global_stats_socket_fd = listen_unix(path);
+    return global_stats_socket_fd;
+}
+
+// Log and export how long an event of the startup took, from the start of main()
+static void record_startup(enum metric_gauge gauge, const char *event) {
+    uint64_t us = (metrics_now() - startup_ns) / 1000;
+    metrics_gauge_add(gauge, (int64_t)us);
+    LOG_SYS("%s %llu.%03llu ms after start", event, (unsigned long long)(us / 1000), (unsigned long long)(us % 1000));
+}
+
 void client_handler(void* connection_info) {
     struct connection_info *conn_info = (struct connection_info *)connection_info;
     if (!conn_info) {
         LOG_ERR("Invalid connection info, thread, or mutex");
         return; // Return if any of the pointers are NULL
     }   
-    if (setup_socket(conn_info) != 0) {
+    if (conn_info->_sockfd < 0 && setup_socket(conn_info) != 0) { // Inherited listeners are already set up
         LOG_ERR("Failed to set up socket");
         shutdown(conn_info->_sockfd , SHUT_RDWR); // Shutdown the socket if setup fails
         close(conn_info->_sockfd); // Close the socket if setup fails
         return; // Return if socket setup fails
     }
 
-    while (!exit_requested) {
-        socklen_t addr_len = sizeof(conn_info->_addr);
-        // Accept client connections
-        int client_accepted = accept(conn_info->_sockfd, (struct sockaddr *)&conn_info->_addr, &addr_len);
-        if (client_accepted < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                // This is expected due to timeout, not a real error
-                continue;  // Just loop again to check exit_requested
+    struct pollfd listeners[5] = {
+        { .fd = conn_info->_sockfd, .events = POLLIN },
+        { .fd = global_unix_socket_fd, .events = POLLIN }, // Ignored by poll() while negative
+        { .fd = global_stats_socket_fd, .events = POLLIN },
+        { .fd = global_handoff_socket_fd, .events = POLLIN },
+        { .fd = global_replication_socket_fd, .events = POLLIN },
+    };
+    bool accepted_any = false;
+    record_startup(METRIC_STARTUP_READY_US, "Accepting connections");
+    if (daemon_ready_fd >= 0) { // Lets the parent of daemonize() exit with success
+        if (write(daemon_ready_fd, "", 1) != 1) LOG_ERR("Failed to report the start: %s", strerror(errno));
+        close(daemon_ready_fd);
+        daemon_ready_fd = -1;
+    }
+    while (!exit_requested && !handed_off) {
+        reap_connections();
+        if (lock_report_requested) {
+            lock_report_requested = 0;
+            log_lock_report();
+        }
+        if (reload_requested) {
+            reload_requested = 0;
+            config_reload();
+        }
+        // Wake up at least once a second so a signal delivered to another thread still ends the loop
+        int ready = poll(listeners, 5, 1000);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERR("Failed to poll listening sockets: %s", strerror(errno));
+            break;
+        }
+        if (ready == 0 || exit_requested) continue;
+
+        if (listeners[0].revents & POLLIN) {
+            socklen_t addr_len = sizeof(conn_info->_addr);
+            // Accept client connections
+            TRACE_BEGIN(accept_span);
+            int client_accepted = accept(conn_info->_sockfd, (struct sockaddr *)&conn_info->_addr, &addr_len);
+            TRACE_END(accept_span, "accept", client_accepted);
+            if (client_accepted >= 0) {
+                // Get client IP address
+                inet_ntop(AF_INET, &conn_info->_addr.sin_addr, conn_info->_ip, INET_ADDRSTRLEN);
+                //LOG_SYS("Accepted connection from %s:%d", conn_info->_ip, ntohs(conn_info->_addr.sin_port));
+                if (!accepted_any) record_startup(METRIC_STARTUP_FIRST_ACCEPT_US, "First connection accepted");
+                accepted_any = true;
+                start_connection(client_accepted, &conn_info->_addr, conn_info->_ip, &default_shard);
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK && !exit_requested) {
+                LOG_ERR("Failed to accept client connection: %s", strerror(errno));
             }
-            if (exit_requested) break; 
-            LOG_ERR("Failed to accept client connection: %s", strerror(errno));
-            continue; // Continue to the next iteration if accept fails
         }
-        
-        // Get client IP address
-        inet_ntop(AF_INET, &conn_info->_addr.sin_addr, conn_info->_ip, INET_ADDRSTRLEN);
-        //LOG_SYS("Accepted connection from %s:%d", conn_info->_ip, ntohs(conn_info->_addr.sin_port));
-        
-        // Create a new socket processing structure for the client
-        struct socket_processing *sp = (struct socket_processing *)malloc(sizeof(struct socket_processing));
-        if (!sp) {
-            LOG_ERR("Failed to allocate memory for socket processing structure: %s", strerror(errno));
-            close(client_accepted); // Close the client socket if memory allocation fails
-            continue; // Continue to the next iteration if memory allocation fails
+        if (listeners[1].revents & POLLIN) {
+            TRACE_BEGIN(accept_span);
+            int client_accepted = accept(listeners[1].fd, NULL, NULL);
+            TRACE_END(accept_span, "accept", client_accepted);
+            if (client_accepted >= 0) {
+                // Local clients have no address; they share the protocol and the log with TCP clients
+                struct sockaddr_in local_addr;
+                memset(&local_addr, 0, sizeof(local_addr));
+                if (!accepted_any) record_startup(METRIC_STARTUP_FIRST_ACCEPT_US, "First connection accepted");
+                accepted_any = true;
+                start_connection(client_accepted, &local_addr, "local", NULL); // local_shard, once it is set up
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK && !exit_requested) {
+                LOG_ERR("Failed to accept local client connection: %s", strerror(errno));
+            }
         }
-        
-        sp->connection_info = create_connection_info(client_accepted, &conn_info->_addr, conn_info->_ip);
-        if (!sp->connection_info) {
-            LOG_ERR("Failed to create connection info structure");
-            free(sp); // Free the socket processing structure if connection info creation fails
-            close(client_accepted); // Close the client socket if connection info creation fails
-            continue; // Continue to the next iteration if connection info creation fails
+        if (listeners[2].revents & POLLIN) {
+            int stats_client = accept(listeners[2].fd, NULL, NULL);
+            if (stats_client >= 0) {
+                metrics_serve(stats_client); // A few KB of text, answered inline
+            }
         }
-        
-        sp->packet = (struct data_packet *)malloc(sizeof(struct data_packet));
-        if (!sp->packet) {
-            LOG_ERR("Failed to allocate memory for data packet: %s", strerror(errno));
-            free_connection_info(sp->connection_info); // Free the connection info structure
-            free(sp); // Free the socket processing structure
-            close(client_accepted); // Close the client socket if data packet allocation fails
-            continue; // Continue to the next iteration if data packet allocation fails
+        if (listeners[3].revents & POLLIN) {
+            int control = accept(listeners[3].fd, NULL, NULL);
+            int fds[HANDOFF_LISTENERS] = { conn_info->_sockfd, global_unix_socket_fd, global_stats_socket_fd };
+            if (control >= 0 && handoff_send(control, fds) == 0) {
+                LOG_SYS("Listening sockets handed off to a new instance, draining connections");
+                handoff_control_fd = control;
+                handed_off = true;
+                global_server_socket_fd = -1; // The listener is shared now: a signal must not shut it down
+            } else if (control >= 0) {
+                close(control);
+            }
         }
-        
-        sp->packet->mutex = &file_mutex; // Use the global file mutex for thread safety
-        sp->packet->data = NULL; // Initialize data pointer to NULL
-        sp->packet->length = 0; // Initialize length to 0
-        sp->connection_active = true; // Initialize connection_active flag to false
-        
-        thread_node_t *node = (thread_node_t *)malloc(sizeof(thread_node_t));
-        if (!node) {
-            LOG_ERR("Failed to allocate memory for thread node: %s", strerror(errno));
-            free(sp->packet->data); // Free the data buffer if thread node allocation fails
-            free(sp->packet); // Free the data packet structure if thread node allocation fails
-            free_connection_info(sp->connection_info); // Free the connection info structure if thread node allocation fails
-            free(sp); // Free the socket processing structure if thread node allocation fails
-            close(client_accepted); // Close the client socket if thread node allocation fails
-            continue; // Continue to the next iteration if thread node allocation fails
+        if (listeners[4].revents & POLLIN) {
+            int follower = accept(listeners[4].fd, NULL, NULL);
+            if (follower >= 0) {
+                replication_serve(follower);
+            }
         }
-        node->sp = sp; // Set the socket processing structure in the thread node
-        pthread_create(&node->data_node, NULL, data_processing, (void *)sp); // Create a new thread for data processing
-        SLIST_INSERT_HEAD(&thread_list, node, entries); // Insert the thread node into
     }
     close(conn_info->_sockfd); // Close the server socket when exiting
+    if (global_unix_socket_fd >= 0) {
+        close(global_unix_socket_fd); // Close the local listener as well
+        global_unix_socket_fd = -1;
+    }
+    if (global_stats_socket_fd >= 0) {
+        close(global_stats_socket_fd);
+        global_stats_socket_fd = -1;
+    }
+    if (global_handoff_socket_fd >= 0) {
+        close(global_handoff_socket_fd);
+        global_handoff_socket_fd = -1;
+    }
+    if (global_replication_socket_fd >= 0) {
+        close(global_replication_socket_fd);
+        global_replication_socket_fd = -1;
+    }
 }
 
 void server_handler(void* connection_info) {
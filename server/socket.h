@@ -23,22 +23,53 @@
 #include <pthread.h>
 #include <sys/queue.h>
 #include <sys/time.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include "lockprof.h"
+#include "log.h" // LOG_SYS, LOG_ERR and LOG_DEBUG
+#include "timer_wheel.h"
+#include "namespace.h"
 
 #define MY_PORT 9000
 #define BACKLOG 10
 #define AESD_SOCKET_FILE "/var/tmp/aesdsocketdata.txt"
 #define BUFFER_SIZE 1024
+#define SEND_FILE_CHUNK (16 * BUFFER_SIZE) // Bytes read per read() by send_file()
+#define BINARY_PREAMBLE "\0LP1" // Sent first by clients that use length-prefixed framing
+#define BINARY_PREAMBLE_LEN 4
+#define BINARY_MAX_RECORD (16 * 1024 * 1024) // Largest record accepted in length-prefixed framing
+#define SHM_INGEST_BATCH 1024 // Records drained from the shared-memory ring per append
 
-#define LOG_SYS(fmt, ...) fprintf(stdout, "[SYS]: " fmt "\n", ##__VA_ARGS__)
-#define LOG_ERR(fmt, ...) fprintf(stderr, "[ERROR]: " fmt "\n", ##__VA_ARGS__)
-#define LOG_DEBUG(fmt, ...) fprintf(stdout, "[DEBUG]: " fmt "\n", ##__VA_ARGS__)
 
 extern sig_atomic_t exit_requested; // Flag to indicate if exit is requested
+extern sig_atomic_t lock_report_requested; // Set on SIGUSR2, client_handler() prints the lock report
+extern struct prof_mutex file_mutex; // Serializes every access to the log of the default namespace
+// Settings a reload (SIGHUP) changes while connections run are atomic, see config_reload()
+extern _Atomic uint64_t idle_timeout_ms; // Evict clients that send nothing for this long, 0 disables (-i seconds)
+extern _Atomic uint64_t request_timeout_ms; // Evict clients whose request takes longer than this, 0 disables (-T seconds)
+extern int listen_backlog; // Backlog of the listening sockets (-B)
+extern _Atomic size_t recv_buffer_size; // Bytes per recv() of newline-framed clients (-S)
+extern _Atomic unsigned timestamp_interval_s; // Seconds between timestamp records (-t)
 extern int global_server_socket_fd;
+extern int global_unix_socket_fd; // Listening AF_UNIX socket, -1 if disabled
+extern int global_stats_socket_fd; // Listening stats socket, -1 if disabled
+extern int global_replication_socket_fd; // Listening replication socket, -1 if disabled
+extern int global_handoff_socket_fd; // Listening handoff socket, -1 if disabled
+extern uint64_t startup_ns; // metrics_now() at the start of main()
+extern bool handed_off; // Set once a new instance has taken the listeners over; it owns the paths from then on
+extern int daemon_ready_fd; // Pipe to the parent of daemonize(), written once client_handler() accepts; -1 if none
+extern bool persistent_log; // True if records are kept in the crash-consistent record log (-p)
+
+enum fsync_policy {
+    FSYNC_ALWAYS, // fsync() after every append (default)
+    FSYNC_NEVER, // Leave write-back to the kernel (-f never)
+};
+extern _Atomic enum fsync_policy fsync_policy; // Reloadable
 
 typedef struct thread_node {
     pthread_t data_node; // Thread ID for the client connection
     struct socket_processing *sp;
+    atomic_bool finished; // Set by the data processing thread when it is done, so it can be joined early
     SLIST_ENTRY(thread_node) entries;
 } thread_node_t;
 SLIST_HEAD(thread_list_head, thread_node);
@@ -50,17 +81,27 @@ struct connection_info {
 };
 
 struct data_packet {
-    pthread_mutex_t *mutex; // Mutex to ensure thread safety
+    struct prof_mutex *mutex; // Mutex to ensure thread safety
     pthread_t thread_id; // Thread ID for the client connection
     char *data; // Pointer to hold the data received from the client
     size_t length; // Length of the data received
     bool end_of_packet; // Flag to indicate end of packet
+    size_t reserved; // Bytes of data accounted for in the in-flight memory budget (see memacct.h)
 };
 
 struct socket_processing {
     struct connection_info *connection_info; // Pointer to connection_info structure
     struct data_packet *packet; // Pointer to data_packet structure
     bool connection_active; // Flag to indicate if the connection is active
+    struct thread_node *node; // Node of the data processing thread in thread_list
+    struct timer_entry deadline; // Idle and request deadline (see connection_deadline())
+    uint64_t accepted_ms; // timer_now_ms() when the connection was accepted
+    _Atomic uint64_t last_activity_ms; // timer_now_ms() when data was last received
+    atomic_bool replaying; // The idle and request deadlines do not apply while the log is sent back
+    struct log_shard *listener_shard; // Namespace of the listener, where records without a prefix go
+    struct log_shard *shard; // Namespace replayed to the client: the listener's, then the one of the last record
+    uint32_t capture_id; // Connection number in the traffic capture, 0 if not capturing (see capture.h)
+    bool ratelimited; // Counted by ratelimit_connection_open(), released on close even if a reload disabled limits
 };
 // Function to create a connection_info structure
 // This function allocates memory for a connection_info structure and initializes it with the provided socket file
@@ -80,7 +121,8 @@ struct connection_info *create_connection_info(int sockfd, struct sockaddr_in *a
 // Note: This function should be called to avoid memory leaks after the connection is no longer needed
 void free_connection_info(struct connection_info *info);
 
-void *timestamp(void *arg); // Function to log the current timestamp every 10 seconds
+void *timestamp(void *arg); // Function to log the current timestamp every timestamp_interval_s seconds
+void *shm_ingest(void *arg); // Function to drain the shared-memory ring (struct shm_ring *) into the log
 
 // Function to handle client connections
 // This function accepts incoming client connections and processes the received data.
@@ -94,6 +136,12 @@ void *timestamp(void *arg); // Function to log the current timestamp every 10 se
 // Note: This function runs in a loop until a termination signal is received.
 void client_handler(void* connection_info);
 
+// Function to wait for the data processing threads to end
+// Parameters:
+// - timeout_ms: Connections still open after this long are shut down; 0 waits for all of them to end.
+// Note: Called by the thread that ran client_handler(), once it has returned.
+void drain_connections(uint64_t timeout_ms);
+
 // Function to handle socket setup
 // This function creates a socket, sets socket options, and binds the socket to the specified address
 // and port. It also handles errors during socket creation and binding.
@@ -108,8 +156,69 @@ void client_handler(void* connection_info);
 // even if the previous socket is still in the TIME_WAIT state.
 void server_handler(void* connection_info); 
 int setup_socket(void* connection_info); // Function to set up the socket and bind it to the specified address and port
+
+// Function to set up the local listener
+// This function creates an AF_UNIX stream socket at path, replacing a stale socket file, and listens on it.
+// client_handler() accepts from it alongside the TCP socket; local clients use the same protocol and log.
+// Parameters:
+// - path: Filesystem path of the socket, which should be absolute since daemonize() changes to /.
+// Returns: The listening socket (also stored in global_unix_socket_fd), or -1 on failure.
+int setup_unix_socket(const char *path);
+
+// Function to set up the stats socket
+// Every client connecting to this AF_UNIX socket receives the server metrics in the Prometheus text format,
+// e.g. `socat - UNIX-CONNECT:path`. The socket is served by client_handler() next to the data listeners.
+// Returns: The listening socket (also stored in global_stats_socket_fd), or -1 on failure.
+int setup_stats_socket(const char *path);
 void write_to_file(const char *filename, const char *data, size_t length); // Function to write data to a file
 size_t read_from_file(const char *filename, char *buffer, size_t buffer_size); //
+
+// Function to send a whole buffer to a socket
+// This function retries on partial sends and EINTR until all bytes have been sent.
+// Parameters:
+// - sockfd: The socket to send to.
+// - data: Pointer to the data to send.
+// - length: Number of bytes to send.
+// Returns: 0 on success, -1 on failure.
+int send_all(int sockfd, const char *data, size_t length);
+
+// Functions to take and release the mutex of a namespace's log
+// They record the wait and hold times of the mutex in the metrics (see metrics.h) and, with the call site
+// of lock_shard(), in the lock profiler (see lockprof.h).
+void lock_shard_at(struct log_shard *shard, const char *site);
+void unlock_shard(struct log_shard *shard);
+#define lock_shard(shard) lock_shard_at((shard), PROF_SITE)
+#define lock_file() lock_shard(&default_shard) // file_mutex
+#define unlock_file() unlock_shard(&default_shard)
+
+// Function to log the lock contention report (prof_mutex_report()) through LOG_SYS
+void log_lock_report(void);
+
+// Function to receive exactly length bytes from a socket
+// Returns: 0 on success, -1 on failure or if the peer closed the connection first.
+int recv_all(int sockfd, void *data, size_t length);
+
+// Function to append several records to a file with one writev() per IOV_MAX records and a single fsync
+void write_records_to_file(const char *filename, const struct iovec *records, size_t count);
+
+// Function to store a record in the log of a namespace
+// This function appends the record either to the namespace's text log or, in persistent mode, to its record log.
+// Note: The caller must hold the namespace's mutex (lock_shard()).
+void store_record(struct log_shard *shard, const char *data, size_t length);
+
+// Function to store a batch of records in the log of a namespace with a single sync
+// Note: The caller must hold the namespace's mutex (lock_shard()).
+void store_records(struct log_shard *shard, const struct iovec *records, size_t count);
+
+// Function to stream a whole file to a socket
+// Returns: Number of bytes sent, or -1 on failure.
+ssize_t send_file(const char *filename, int sockfd);
+
+// Function to replay the log of a namespace to a client
+// This function streams the whole log to the socket in chunks, so replays are not limited to BUFFER_SIZE.
+// Returns: Number of bytes sent, or -1 on failure.
+// Note: The caller must hold the namespace's mutex (lock_shard()).
+ssize_t replay_records(struct log_shard *shard, int sockfd);
 void setup_signal_handlers(); // Function to set up signal handlers for graceful shutdown
 void handle_signal(int signo); // Signal handler function to handle termination signals
 
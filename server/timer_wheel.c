@@ -0,0 +1,166 @@
+#include "timer_wheel.h"
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define MAX_DELTA ((1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1) // Furthest tick the wheel can hold
+
+static pthread_mutex_t wheel_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wheel_cond; // Signalled when the first timer is armed or on stop
+static struct timer_entry slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; // List heads
+static uint64_t current_tick; // Last tick processed
+static uint64_t start_ms; // timer_now_ms() at tick 0
+static size_t armed; // Number of armed timers
+static bool running = false;
+static pthread_t timer_thread;
+
+uint64_t timer_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+static void list_init(void) {
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            slots[level][slot].prev = slots[level][slot].next = &slots[level][slot];
+        }
+    }
+}
+
+static void unlink_entry(struct timer_entry *entry) {
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+// Put an entry in the slot of the lowest level whose range covers its expiry
+// The expiry must not be before current_tick; it may equal it only while cascading into the current tick.
+static void place(struct timer_entry *entry) {
+    if (entry->expires - current_tick > MAX_DELTA) entry->expires = current_tick + MAX_DELTA;
+    uint64_t delta = entry->expires - current_tick;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >> (TIMER_WHEEL_BITS * (level + 1))) level++;
+    struct timer_entry *head = &slots[level][(entry->expires >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK];
+    entry->next = head;
+    entry->prev = head->prev;
+    head->prev->next = entry;
+    head->prev = entry;
+}
+
+// First tick not before ms that has not been processed yet
+static uint64_t ms_to_tick(uint64_t ms) {
+    uint64_t tick = ms <= start_ms ? 0 : (ms - start_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    return tick > current_tick ? tick : current_tick + 1;
+}
+
+void timer_arm(struct timer_entry *entry, uint64_t deadline_ms, timer_fn fn) {
+    pthread_mutex_lock(&wheel_mutex);
+    if (!running) { // Deadlines are disabled, the entry stays disarmed
+        pthread_mutex_unlock(&wheel_mutex);
+        return;
+    }
+    if (entry->next) unlink_entry(entry);
+    else armed++;
+    entry->fn = fn;
+    entry->expires = ms_to_tick(deadline_ms);
+    place(entry);
+    if (armed == 1) pthread_cond_signal(&wheel_cond); // The timer thread sleeps while the wheel is empty
+    pthread_mutex_unlock(&wheel_mutex);
+}
+
+void timer_cancel(struct timer_entry *entry) {
+    pthread_mutex_lock(&wheel_mutex);
+    if (entry->next) {
+        unlink_entry(entry);
+        armed--;
+    }
+    pthread_mutex_unlock(&wheel_mutex);
+}
+
+// Move the entries of a higher level slot down now that their range has been reached
+static void cascade(int level, unsigned slot) {
+    struct timer_entry *head = &slots[level][slot];
+    struct timer_entry *entry = head->next;
+    head->prev = head->next = head;
+    while (entry != head) {
+        struct timer_entry *next = entry->next;
+        place(entry);
+        entry = next;
+    }
+}
+
+// Advance the wheel by one tick and run the timers that expire on it
+static void advance(uint64_t now_ms) {
+    current_tick++;
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        if ((current_tick >> (TIMER_WHEEL_BITS * (level - 1))) & SLOT_MASK) break;
+        cascade(level, (current_tick >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK);
+    }
+    struct timer_entry *head = &slots[0][current_tick & SLOT_MASK];
+    while (head->next != head) {
+        struct timer_entry *entry = head->next;
+        unlink_entry(entry);
+        uint64_t next = entry->fn(entry, now_ms);
+        if (next) {
+            entry->expires = ms_to_tick(next);
+            place(entry);
+        } else {
+            armed--;
+        }
+    }
+}
+
+static void *timer_loop(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&wheel_mutex);
+    while (running) {
+        uint64_t now = timer_now_ms();
+        uint64_t target = (now - start_ms) / TIMER_TICK_MS;
+        while (current_tick < target) advance(now);
+        struct timespec wakeup;
+        clock_gettime(CLOCK_MONOTONIC, &wakeup);
+        if (armed == 0) {
+            wakeup.tv_sec += 1; // Nothing to do; woken up early by the first timer_arm()
+        } else {
+            wakeup.tv_nsec += TIMER_TICK_MS * 1000000L;
+            if (wakeup.tv_nsec >= 1000000000L) {
+                wakeup.tv_sec++;
+                wakeup.tv_nsec -= 1000000000L;
+            }
+        }
+        pthread_cond_timedwait(&wheel_cond, &wheel_mutex, &wakeup);
+    }
+    pthread_mutex_unlock(&wheel_mutex);
+    return NULL;
+}
+
+int timer_wheel_start(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wheel_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_lock(&wheel_mutex);
+    list_init();
+    start_ms = timer_now_ms();
+    current_tick = 0;
+    armed = 0;
+    running = true;
+    pthread_mutex_unlock(&wheel_mutex);
+    if (pthread_create(&timer_thread, NULL, timer_loop, NULL) != 0) {
+        running = false;
+        return -1;
+    }
+    return 0;
+}
+
+void timer_wheel_stop(void) {
+    pthread_mutex_lock(&wheel_mutex);
+    bool was_running = running;
+    running = false;
+    pthread_cond_signal(&wheel_cond);
+    pthread_mutex_unlock(&wheel_mutex);
+    if (was_running) pthread_join(timer_thread, NULL);
+}
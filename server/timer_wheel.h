@@ -0,0 +1,55 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+// timer_wheel.h
+// Hierarchical timer wheel used for connection deadlines. Four levels of 64 slots with a tick of
+// TIMER_TICK_MS cover about 19 days; arming and cancelling a timer only link or unlink a list node, so both
+// are O(1) regardless of the number of connections. Timers fire on a single background thread.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TIMER_TICK_MS 100
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+struct timer_entry;
+
+// Function called when a timer expires, on the timer thread with the wheel locked
+// It must not arm or cancel timers itself; it returns the next deadline instead.
+// Parameters:
+// - entry: The expired timer.
+// - now_ms: Current time (timer_now_ms()).
+// Returns: New absolute deadline in milliseconds to re-arm the timer, or 0 to leave it disarmed.
+typedef uint64_t (*timer_fn)(struct timer_entry *entry, uint64_t now_ms);
+
+struct timer_entry {
+    struct timer_entry *prev; // Links in a wheel slot, NULL while disarmed
+    struct timer_entry *next;
+    uint64_t expires; // Tick at which the timer fires
+    timer_fn fn;
+};
+
+// Function to return the monotonic clock in milliseconds, the time base of all deadlines
+uint64_t timer_now_ms(void);
+
+// Function to start the timer thread
+// Returns: 0 on success, -1 on failure.
+int timer_wheel_start(void);
+
+// Function to stop the timer thread; armed timers do not fire anymore
+void timer_wheel_stop(void);
+
+// Function to arm (or re-arm) a timer
+// Parameters:
+// - entry: Timer to arm, zero-initialized before its first use.
+// - deadline_ms: Absolute deadline (timer_now_ms() time base), rounded up to the next tick.
+// - fn: Function to call on expiry.
+void timer_arm(struct timer_entry *entry, uint64_t deadline_ms, timer_fn fn);
+
+// Function to cancel a timer
+// When this function returns the timer's function is neither running nor going to run, so the memory
+// holding the entry can be freed.
+void timer_cancel(struct timer_entry *entry);
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,172 @@
+#include "trace.h"
+
+#ifdef AESD_TRACE
+#include "socket.h"
+#include <semaphore.h>
+#include <sys/syscall.h>
+
+struct trace_event {
+    const char *name; // String literal naming the phase
+    uint64_t start; // Nanoseconds, CLOCK_MONOTONIC
+    uint32_t duration; // Nanoseconds, saturated at about 4 seconds
+    uint32_t tid; // Kernel thread id, so rings can be reused by later threads
+    uint64_t arg;
+};
+
+struct trace_ring {
+    _Atomic uint64_t head; // Number of spans ever recorded; slot of span i is i % TRACE_RING_EVENTS
+    _Atomic int in_use; // Owned by a live thread
+    struct trace_ring *next; // All rings ever created, never freed
+    struct trace_event events[TRACE_RING_EVENTS];
+};
+
+static __thread struct trace_ring *local_ring = NULL;
+static __thread uint32_t local_tid = 0;
+static struct trace_ring *_Atomic rings = NULL;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static sem_t dump_request; // Posted by the signal handler
+static pthread_t dump_thread;
+static atomic_bool dump_running = false;
+
+static void release_ring(void *arg) {
+    atomic_store_explicit(&((struct trace_ring *)arg)->in_use, 0, memory_order_release);
+}
+
+static void create_ring_key(void) {
+    pthread_key_create(&ring_key, release_ring);
+}
+
+// Take over the ring of an exited thread or allocate a new one
+static struct trace_ring *attach_ring(void) {
+    pthread_once(&ring_key_once, create_ring_key);
+    struct trace_ring *ring = NULL;
+    pthread_mutex_lock(&rings_mutex);
+    for (struct trace_ring *r = atomic_load(&rings); r; r = r->next) {
+        if (!atomic_load_explicit(&r->in_use, memory_order_acquire)) {
+            ring = r;
+            break;
+        }
+    }
+    if (!ring) {
+        ring = (struct trace_ring *)calloc(1, sizeof(*ring));
+        if (ring) {
+            ring->next = atomic_load(&rings);
+            atomic_store(&rings, ring);
+        }
+    }
+    if (ring) atomic_store(&ring->in_use, 1);
+    pthread_mutex_unlock(&rings_mutex);
+    if (!ring) return NULL;
+    pthread_setspecific(ring_key, ring);
+    local_tid = (uint32_t)syscall(SYS_gettid);
+    local_ring = ring;
+    return ring;
+}
+
+void trace_record(const char *name, uint64_t start, uint64_t arg) {
+    uint64_t duration = trace_now() - start;
+    struct trace_ring *ring = local_ring;
+    if (__builtin_expect(!ring, 0) && !(ring = attach_ring())) return;
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    struct trace_event *event = &ring->events[head & (TRACE_RING_EVENTS - 1)];
+    event->name = name;
+    event->start = start;
+    event->duration = duration > UINT32_MAX ? UINT32_MAX : (uint32_t)duration;
+    event->tid = local_tid;
+    event->arg = arg;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release); // Publishes the span
+}
+
+// Copy the spans of a ring that are still intact, the owner keeps recording meanwhile
+static size_t snapshot_ring(struct trace_ring *ring, struct trace_event *copy) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+    for (uint64_t i = first; i < head; i++) copy[i - first] = ring->events[i & (TRACE_RING_EVENTS - 1)];
+    atomic_thread_fence(memory_order_acquire);
+    // Spans the owner may have overwritten while we copied: everything up to the one it is writing now
+    uint64_t after = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t valid = after + 1 > TRACE_RING_EVENTS ? after + 1 - TRACE_RING_EVENTS : 0;
+    if (valid <= first) return head - first;
+    if (valid >= head) return 0;
+    memmove(copy, copy + (valid - first), (head - valid) * sizeof(*copy));
+    return head - valid;
+}
+
+static void write_trace(void) {
+    static unsigned dumps = 0;
+    char path[64];
+    snprintf(path, sizeof(path), "/var/tmp/aesdsocket-trace.%d.%u.json", (int)getpid(), dumps++);
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        LOG_ERR("Failed to open trace file %s: %s", path, strerror(errno));
+        return;
+    }
+    struct trace_event *copy = (struct trace_event *)malloc(TRACE_RING_EVENTS * sizeof(*copy));
+    if (!copy) {
+        fclose(out);
+        return;
+    }
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    size_t written = 0;
+    int pid = (int)getpid();
+    for (struct trace_ring *r = atomic_load(&rings); r; r = r->next) {
+        size_t count = snapshot_ring(r, copy);
+        for (size_t i = 0; i < count; i++) {
+            struct trace_event *e = &copy[i];
+            fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"arg\":%llu}}",
+                    written++ ? ",\n" : "", e->name, pid, e->tid, e->start / 1e3, e->duration / 1e3,
+                    (unsigned long long)e->arg);
+        }
+    }
+    fprintf(out, "\n]}\n");
+    free(copy);
+    if (fclose(out) != 0) {
+        LOG_ERR("Failed to write trace file %s: %s", path, strerror(errno));
+        return;
+    }
+    LOG_SYS("Wrote %zu trace events to %s", written, path);
+}
+
+static void *dump_loop(void *arg) {
+    (void)arg;
+    while (atomic_load(&dump_running)) {
+        if (sem_wait(&dump_request) != 0) continue; // EINTR
+        if (atomic_load(&dump_running)) write_trace();
+    }
+    return NULL;
+}
+
+static void request_dump(int signo) {
+    (void)signo;
+    sem_post(&dump_request); // Async-signal-safe, the dump itself runs on dump_thread
+}
+
+int trace_start(void) {
+    if (sem_init(&dump_request, 0, 0) != 0) return -1;
+    atomic_store(&dump_running, true);
+    if (pthread_create(&dump_thread, NULL, dump_loop, NULL) != 0) {
+        atomic_store(&dump_running, false);
+        sem_destroy(&dump_request);
+        return -1;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_dump;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+    return 0;
+}
+
+void trace_stop(void) {
+    if (!atomic_exchange(&dump_running, false)) return;
+    signal(SIGUSR1, SIG_IGN);
+    sem_post(&dump_request);
+    pthread_join(dump_thread, NULL);
+    sem_destroy(&dump_request);
+}
+
+#endif // AESD_TRACE
@@ -0,0 +1,58 @@
+#ifndef TRACE_H
+#define TRACE_H
+// trace.h
+// Per-request phase tracing of the AESD socket server, compiled in only when AESD_TRACE is defined
+// (make TRACE=1). Tracepoints record complete spans (name, start, duration, one numeric argument) into
+// a per-thread ring buffer that keeps the most recent TRACE_RING_EVENTS spans of each thread. On SIGUSR1
+// a background thread writes all rings as a Chrome trace (chrome://tracing, ui.perfetto.dev) to
+// /var/tmp/aesdsocket-trace.<pid>.<n>.json.
+// Without AESD_TRACE every macro below expands to nothing and the arguments are not evaluated.
+//
+// Usage:
+//   TRACE_BEGIN(recv_span);
+//   ssize_t n = recv(...);
+//   TRACE_END(recv_span, "recv", n);
+
+#include <stdint.h>
+
+#ifdef AESD_TRACE
+#include <time.h>
+
+#define TRACE_RING_EVENTS 4096 // Spans kept per thread, must be a power of two
+
+static inline uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Function to record a span that started at start (trace_now()) and ends now
+// Parameters:
+// - name: Name of the phase, must be a string literal (only the pointer is stored).
+// - start: Start of the span in nanoseconds.
+// - arg: Numeric argument shown with the span, e.g. a byte count.
+void trace_record(const char *name, uint64_t start, uint64_t arg);
+
+// Function to start the thread that dumps the trace on SIGUSR1
+// Returns: 0 on success, -1 on failure.
+int trace_start(void);
+
+// Function to stop the dump thread
+void trace_stop(void);
+
+#define TRACE_BEGIN(var) uint64_t var = trace_now()
+#define TRACE_END(var, name, arg) trace_record(name, var, (uint64_t)(arg))
+#define TRACE_SPAN(name, start, arg) trace_record(name, start, (uint64_t)(arg))
+
+#else
+
+static inline int trace_start(void) { return 0; }
+static inline void trace_stop(void) {}
+
+#define TRACE_BEGIN(var) do {} while (0)
+#define TRACE_END(var, name, arg) do {} while (0)
+#define TRACE_SPAN(name, start, arg) do {} while (0)
+
+#endif // AESD_TRACE
+
+#endif // TRACE_H
@@ -0,0 +1,138 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../server/codec.h"
+
+#define BLOCK 65536
+
+/**
+* Compress length bytes of data with lz and decompress them into a buffer of exactly length bytes, so a
+* decoder writing past the end of its output shows up under valgrind or ASan.
+*/
+static void round_trip(const char *data, size_t length, const char *what)
+{
+    size_t capacity = lz_codec.bound(length);
+    char *packed = malloc(capacity);
+    char *unpacked = malloc(length ? length : 1);
+    TEST_ASSERT_NOT_NULL(packed);
+    TEST_ASSERT_NOT_NULL(unpacked);
+    ssize_t packed_length = lz_codec.compress(data, length, packed, capacity);
+    TEST_ASSERT_TRUE_MESSAGE(packed_length > 0 && (size_t)packed_length <= capacity, what);
+    ssize_t unpacked_length = lz_codec.decompress(packed, packed_length, unpacked, length);
+    TEST_ASSERT_EQUAL_INT_MESSAGE((int)length, (int)unpacked_length, what);
+    if (length) TEST_ASSERT_EQUAL_MEMORY_MESSAGE(data, unpacked, length, what);
+    free(packed);
+    free(unpacked);
+}
+
+/**
+* Fill a block with the kind of repetitive sensor lines the server logs
+*/
+static size_t sensor_lines(char *data, size_t capacity)
+{
+    size_t used = 0;
+    unsigned seed = 42;
+    while (used + 64 < capacity) {
+        seed = seed * 1103515245u + 12345u;
+        used += snprintf(data + used, capacity - used, "sensor=%u temp=%u.%u humidity=%u%% status=ok\n",
+                         seed >> 28, 20 + (seed >> 24) % 8, (seed >> 16) % 10, 40 + (seed >> 8) % 20);
+    }
+    return used;
+}
+
+void test_codec_round_trip()
+{
+    char *data = malloc(BLOCK);
+    TEST_ASSERT_NOT_NULL(data);
+    round_trip("", 0, "empty block");
+    round_trip("abc", 3, "block shorter than a match");
+    round_trip("abcdabcd", 8, "one minimal match");
+    memset(data, 'a', BLOCK);
+    round_trip(data, BLOCK, "overlapping match over a whole block");
+    unsigned seed = 7;
+    for (size_t i = 0; i < BLOCK; i++) {
+        seed = seed * 1103515245u + 12345u;
+        data[i] = (char)(seed >> 16);
+    }
+    round_trip(data, BLOCK, "incompressible block, literals only");
+    round_trip(data, 300, "literal run with extra length bytes");
+    size_t length = sensor_lines(data, BLOCK);
+    round_trip(data, length, "sensor lines");
+    for (size_t cut = 1; cut < 200; cut++) round_trip(data, cut, "short prefix of sensor lines");
+    TEST_ASSERT_EQUAL_PTR(&lz_codec, codec_find("lz"));
+    TEST_ASSERT_EQUAL_PTR(&lz_codec, codec_by_id(lz_codec.id));
+    TEST_ASSERT_NULL(codec_find("zstd"));
+    free(data);
+}
+
+void test_codec_truncated_input()
+{
+    char *data = malloc(BLOCK);
+    char *unpacked = malloc(BLOCK);
+    TEST_ASSERT_NOT_NULL(data);
+    TEST_ASSERT_NOT_NULL(unpacked);
+    size_t length = sensor_lines(data, 4096);
+    size_t capacity = lz_codec.bound(length);
+    char *packed = malloc(capacity);
+    TEST_ASSERT_NOT_NULL(packed);
+    ssize_t packed_length = lz_codec.compress(data, length, packed, capacity);
+    TEST_ASSERT_TRUE(packed_length > 0);
+    for (ssize_t cut = 0; cut < packed_length; cut++) {
+        // An exact copy of the prefix: reading past the cut is reading past the allocation
+        char *prefix = malloc(cut ? cut : 1);
+        TEST_ASSERT_NOT_NULL(prefix);
+        memcpy(prefix, packed, cut);
+        ssize_t got = lz_codec.decompress(prefix, cut, unpacked, BLOCK);
+        // A cut after a sequence's literals reads as a shorter block and anything else is rejected, except
+        // cutting the last token when it carries no literals: that one has nothing to lose
+        bool empty_last_token = cut == packed_length - 1 && packed[cut] == 0;
+        TEST_ASSERT_TRUE_MESSAGE(got < (ssize_t)length || empty_last_token, "truncated block decoded to the full length");
+        if (got > 0) TEST_ASSERT_EQUAL_MEMORY_MESSAGE(data, unpacked, got, "truncated block decoded to other bytes");
+        free(prefix);
+    }
+    // The decoded block does not fit: every capacity short of the length is rejected
+    for (size_t short_capacity = 0; short_capacity < length; short_capacity += 97) {
+        TEST_ASSERT_EQUAL_INT(-1, (int)lz_codec.decompress(packed, packed_length, unpacked, short_capacity));
+    }
+    free(packed);
+    free(unpacked);
+    free(data);
+}
+
+static ssize_t decode(const unsigned char *block, size_t length, char *out, size_t capacity)
+{
+    return lz_codec.decompress((const char *)block, length, out, capacity);
+}
+
+void test_codec_bad_offset_and_length()
+{
+    char out[64];
+    // One literal, then a match reaching two bytes back into one byte of output
+    const unsigned char offset_too_far[] = { 0x10, 'a', 0x02, 0x00 };
+    TEST_ASSERT_EQUAL_INT(-1, (int)decode(offset_too_far, sizeof(offset_too_far), out, sizeof(out)));
+    const unsigned char offset_zero[] = { 0x10, 'a', 0x00, 0x00 };
+    TEST_ASSERT_EQUAL_INT(-1, (int)decode(offset_zero, sizeof(offset_zero), out, sizeof(out)));
+    // The offset is cut after its first byte
+    const unsigned char offset_cut[] = { 0x10, 'a', 0x01 };
+    TEST_ASSERT_EQUAL_INT(-1, (int)decode(offset_cut, sizeof(offset_cut), out, sizeof(out)));
+    // Five literals announced, two present
+    const unsigned char literals_past_end[] = { 0x50, 'a', 'b' };
+    TEST_ASSERT_EQUAL_INT(-1, (int)decode(literals_past_end, sizeof(literals_past_end), out, sizeof(out)));
+    // A literal count of 15 continues in extra bytes that are missing, or that run past the input
+    const unsigned char literal_length_cut[] = { 0xf0 };
+    TEST_ASSERT_EQUAL_INT(-1, (int)decode(literal_length_cut, sizeof(literal_length_cut), out, sizeof(out)));
+    const unsigned char literal_length_past_end[] = { 0xf0, 0xff, 0xff, 0x10, 'a' };
+    TEST_ASSERT_EQUAL_INT(-1, (int)decode(literal_length_past_end, sizeof(literal_length_past_end), out, sizeof(out)));
+    // A match length of 15 continues in an extra byte that is missing
+    const unsigned char match_length_cut[] = { 0x1f, 'a', 0x01, 0x00 };
+    TEST_ASSERT_EQUAL_INT(-1, (int)decode(match_length_cut, sizeof(match_length_cut), out, sizeof(out)));
+    // A valid match longer than the output: 1 + 4 + 15 + 200 bytes into 64
+    const unsigned char match_past_capacity[] = { 0x1f, 'a', 0x01, 0x00, 200 };
+    TEST_ASSERT_EQUAL_INT(-1, (int)decode(match_past_capacity, sizeof(match_past_capacity), out, sizeof(out)));
+    // The same sequence fits in a larger output and repeats the literal
+    char large[256];
+    TEST_ASSERT_EQUAL_INT(220, (int)decode(match_past_capacity, sizeof(match_past_capacity), large, sizeof(large)));
+    TEST_ASSERT_EQUAL_INT('a', large[219]);
+}
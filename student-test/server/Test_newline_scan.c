@@ -0,0 +1,125 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../server/newline_scan.h"
+
+#define MAX_LENGTH (3 * 64 + 63) // Two full AVX2 blocks, a 32 byte step, and every tail length 0-63
+#define MAX_SHIFT 32 // Start offsets, so the vector loads see every alignment
+
+static const char *const impls[] = { "avx2", "sse2", "generic" };
+
+/**
+* Newline offsets of buf[0..length) found with memchr(), the reference of every scanner
+*/
+static size_t reference(const char *buf, size_t length, size_t *positions)
+{
+    size_t found = 0;
+    for (const char *p = buf; (p = memchr(p, '\n', length - (p - buf))) != NULL; p++) {
+        positions[found++] = p - buf;
+    }
+    return found;
+}
+
+/**
+* Compare the active scanner with memchr() on buf[0..length), for every max_positions from 0 past the count
+*/
+static void check(const char *buf, size_t length, const char *what)
+{
+    size_t expected[MAX_LENGTH], positions[MAX_LENGTH + 1];
+    size_t count = reference(buf, length, expected);
+    char message[160];
+    snprintf(message, sizeof(message), "%s scanner, %s, length %zu", scan_impl_name(), what, length);
+    const char *first = memchr(buf, '\n', length);
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(first, scan_first_newline(buf, length), message);
+    for (size_t max = 0; max <= count + 1; max++) {
+        size_t found = scan_newlines(buf, length, positions, max);
+        TEST_ASSERT_EQUAL_INT_MESSAGE((int)(max < count ? max : count), (int)found, message);
+        for (size_t i = 0; i < found; i++) TEST_ASSERT_EQUAL_INT_MESSAGE((int)expected[i], (int)positions[i], message);
+    }
+}
+
+/**
+* Run check() on every length and start offset of buf
+*/
+static void check_all(const char *buf, const char *what)
+{
+    for (size_t shift = 0; shift < MAX_SHIFT; shift++) {
+        for (size_t length = 0; length <= MAX_LENGTH; length++) check(buf + shift, length, what);
+    }
+}
+
+/**
+* Run fill on a buffer, then check_all() it with every scanner the CPU supports
+*/
+static void check_impls(void (*fill)(char *buf, size_t size), const char *what)
+{
+    char buf[MAX_SHIFT + MAX_LENGTH];
+    fill(buf, sizeof(buf));
+    size_t tested = 0;
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (scan_select(impls[i]) != 0) continue; // Not built for or not supported by this CPU
+        check_all(buf, what);
+        tested++;
+    }
+    scan_select(NULL);
+    TEST_ASSERT_TRUE_MESSAGE(tested > 0, "no scanner implementation available");
+}
+
+static void no_newlines(char *buf, size_t size)
+{
+    memset(buf, 'x', size);
+}
+
+static void only_newlines(char *buf, size_t size)
+{
+    memset(buf, '\n', size);
+}
+
+static void sparse_newlines(char *buf, size_t size)
+{
+    unsigned seed = 42;
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245u + 12345u;
+        buf[i] = (seed >> 16) % 23 == 0 ? '\n' : (char)(seed >> 24); // Raw bytes, NUL and 0x8a included
+    }
+}
+
+static void dense_newlines(char *buf, size_t size)
+{
+    unsigned seed = 7;
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245u + 12345u;
+        buf[i] = (seed >> 16) % 2 ? '\n' : '\0';
+    }
+}
+
+void test_newline_scan_no_newlines()
+{
+    check_impls(no_newlines, "no newlines");
+}
+
+void test_newline_scan_only_newlines()
+{
+    check_impls(only_newlines, "only newlines");
+}
+
+void test_newline_scan_sparse_newlines()
+{
+    check_impls(sparse_newlines, "sparse newlines in raw bytes");
+}
+
+void test_newline_scan_dense_newlines()
+{
+    check_impls(dense_newlines, "dense newlines between NULs");
+}
+
+void test_newline_scan_select()
+{
+    TEST_ASSERT_EQUAL_INT(0, scan_select("generic"));
+    TEST_ASSERT_EQUAL_STRING("generic", scan_impl_name());
+    TEST_ASSERT_EQUAL_INT(-1, scan_select("neon"));
+    TEST_ASSERT_EQUAL_STRING("generic", scan_impl_name());
+    TEST_ASSERT_EQUAL_INT(0, scan_select(NULL));
+}